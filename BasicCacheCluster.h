@@ -0,0 +1,343 @@
+#ifndef BASICCACHECLUSTER_H
+#define BASICCACHECLUSTER_H
+#include "ResultCode.h"
+#include "Log.h"
+#include "stock/utility/Utility.h"
+#include <hiredis/hiredis.h>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/*
+ * The policies of BasicCacheCluster, all the calls are static or inline so the compiler
+ * specializes the hot paths of each instantiation.
+ */
+
+/**
+ * item + "_" + owner, the key format of CCacheCluster.
+ */
+struct CItemOwnerKeyPolicy
+{
+	static std::string Generate(const std::string& strOwner, const std::string& strItem)
+	{
+		std::string strKey;
+		strKey.reserve(strItem.size() + 1 + strOwner.size());
+		strKey.append(strItem).append(1, '_').append(strOwner);
+		return strKey;
+	}
+};
+
+/**
+ * The value encoding of CCacheCluster.
+ */
+struct CCompressCodec
+{
+	static ResultCode Encode(const std::string& strValue, std::string& strEncoded)
+	{
+		return Stock::Utility::compress(strValue, strEncoded);
+	}
+
+	static ResultCode Decode(const char* pEncoded, size_t nLength, std::string& strValue)
+	{
+		return Stock::Utility::decompress(std::string(pEncoded, nLength), strValue);
+	}
+};
+
+/**
+ * The values are stored as they are, not readable by CCacheCluster.
+ */
+struct CRawCodec
+{
+	static ResultCode Encode(const std::string& strValue, std::string& strEncoded)
+	{
+		strEncoded = strValue;
+		return Stock::RS_SUCCESS;
+	}
+
+	static ResultCode Decode(const char* pEncoded, size_t nLength, std::string& strValue)
+	{
+		strValue.assign(pEncoded, nLength);
+		return Stock::RS_SUCCESS;
+	}
+};
+
+/**
+ * One hiredis connection, a failed command reconnects and retries nRetryCount times.
+ * CRedisTransport<0> never retries, the retry loop is compiled away.
+ */
+template<int nRetryCount>
+class CRedisTransport
+{
+public:
+	CRedisTransport () = default;
+	CRedisTransport (const CRedisTransport&) = delete;
+	CRedisTransport& operator=(const CRedisTransport&) = delete;
+
+	~CRedisTransport ()
+	{
+		Disconnect();
+	}
+
+	ResultCode Connect (const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+	{
+		Disconnect();
+		m_strServerAddress = strServerAddr;
+		m_nServerPort = nPort;
+		m_nTimeOutInMS = nTimeOutInMS;
+		return Reconnect();
+	}
+
+	void Disconnect ()
+	{
+		if(m_pServer != nullptr)
+			redisFree(m_pServer);
+		m_pServer = nullptr;
+	}
+
+	/**
+	 * @return the reply, nullptr when the connection failed on every attempt.
+	 */
+	template<typename... Args>
+	redisReply* Command (const char* format, Args... args)
+	{
+		for(int retry = 0; retry <= nRetryCount; retry++)
+		{
+			if(m_pServer == nullptr && RC_FAILED(Reconnect()))
+				return nullptr;
+			redisReply* reply = (redisReply*)redisCommand(m_pServer, format, args...);
+			if(reply != nullptr)
+				return reply;
+			LogError() << "Failed to execute command:" << format << "," << m_pServer->errstr;
+			Disconnect();
+		}
+		return nullptr;
+	}
+
+protected:
+	ResultCode Reconnect ()
+	{
+		timeval tv;
+		tv.tv_sec = m_nTimeOutInMS/1000;
+		tv.tv_usec = m_nTimeOutInMS%1000*1000;
+		m_pServer = redisConnectWithTimeout(m_strServerAddress.c_str(), m_nServerPort, tv);
+		if(m_pServer == nullptr || m_pServer->err)
+		{
+			LogError() << "Connect to Redis server " << m_strServerAddress << ":" << m_nServerPort << " Failed:"
+					<< (m_pServer ? m_pServer->errstr : "out of memory");
+			Disconnect();
+			return Stock::RE_COMMUNICATION;
+		}
+		return Stock::RS_SUCCESS;
+	}
+
+	redisContext* m_pServer = nullptr;
+	std::string m_strServerAddress;
+	int m_nServerPort = 6379;
+	int m_nTimeOutInMS = 1000;
+};
+
+/**
+ * The client is shared by threads.
+ */
+struct CMutexLockPolicy
+{
+	void lock()
+	{
+		m_mutex.lock();
+	}
+
+	void unlock()
+	{
+		m_mutex.unlock();
+	}
+
+	std::mutex m_mutex;
+};
+
+/**
+ * The client is owned by one thread, the locking is compiled away.
+ */
+struct CNoLockPolicy
+{
+	void lock()
+	{
+	}
+
+	void unlock()
+	{
+	}
+};
+
+
+/**
+ * class BasicCacheCluster
+ * The item value calls of CCacheCluster with the key format, the value encoding, the transport
+ * and the locking chosen at compile time, for the deployments which never change them and
+ * don't use the other features of CCacheCluster (deadlines, local/host tiers, prefetch, locks).
+ * Every policy call is resolved statically, so BasicCacheCluster<..., CRawCodec,
+ * CRedisTransport<0>, CNoLockPolicy> is straight-line code around redisCommand.
+ *
+ * CDefaultCacheCluster uses the key format and the encoding of CCacheCluster, they read and
+ * write the same values.
+ */
+template<typename KeyPolicy, typename Codec, typename Transport, typename LockPolicy>
+class BasicCacheCluster
+{
+public:
+	typedef std::lock_guard<LockPolicy> Guard;
+
+	BasicCacheCluster () = default;
+	BasicCacheCluster (const BasicCacheCluster&) = delete;
+	BasicCacheCluster& operator=(const BasicCacheCluster&) = delete;
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strServerAddr
+	 * @param  nPort
+	 * @param  nTimeOutInMS
+	 */
+	ResultCode ConnectCacheServer (const std::string& strServerAddr, int nPort, int nTimeOutInMS = 1000)
+	{
+		Guard guard(m_lock);
+		ResultCode rc = m_transport.Connect(strServerAddr, nPort, nTimeOutInMS);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		return Stock::RS_SUCCESS;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: the item doesn't exist.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  strValue [out]
+	 */
+	ResultCode GetItemValue (const std::string& strOwner, const std::string& strItem, std::string& strValue)
+	{
+		std::string strKey = KeyPolicy::Generate(strOwner, strItem);
+		redisReply* reply = nullptr;
+		{
+			Guard guard(m_lock);
+			reply = m_transport.Command("GET %b", strKey.data(), strKey.size());
+		}
+		if(reply == nullptr)
+			LogReturn(Stock::RE_COMMUNICATION);
+		ResultCode rc = Stock::RE_UNEXPECT;
+		if(reply->type == REDIS_REPLY_NIL)
+			rc = Stock::RE_NOT_EXISTS;
+		else if(reply->type == REDIS_REPLY_STRING)
+			rc = Codec::Decode(reply->str, reply->len, strValue);
+		else
+			LogError() << "get key failed for " << strKey << ":" << (reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+		freeReplyObject(reply);
+		return rc;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	ResultCode SetItemValue (const std::string& strOwner, const std::string& strItem, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1))
+	{
+		std::string strKey = KeyPolicy::Generate(strOwner, strItem);
+		std::string strEncoded;
+		ResultCode rc = Codec::Encode(strValue, strEncoded);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		redisReply* reply = nullptr;
+		{
+			Guard guard(m_lock);
+			if(nLifeCycleInSecond == size_t(-1))
+				reply = m_transport.Command("SET %b %b", strKey.data(), strKey.size(), strEncoded.data(), strEncoded.size());
+			else
+				reply = m_transport.Command("SETEX %b %llu %b", strKey.data(), strKey.size(),
+						(unsigned long long)nLifeCycleInSecond, strEncoded.data(), strEncoded.size());
+		}
+		if(reply == nullptr)
+			LogReturn(Stock::RE_COMMUNICATION);
+		rc = Stock::RS_SUCCESS;
+		if(reply->type == REDIS_REPLY_ERROR)
+		{
+			LogError() << "set key failed for " << strKey << ":" << reply->str;
+			rc = Stock::RE_ERROR;
+		}
+		freeReplyObject(reply);
+		return rc;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: the item doesn't exist.
+	 * @param  strOwner
+	 * @param  strItem
+	 */
+	ResultCode RemoveItemValue (const std::string& strOwner, const std::string& strItem)
+	{
+		std::string strKey = KeyPolicy::Generate(strOwner, strItem);
+		redisReply* reply = nullptr;
+		{
+			Guard guard(m_lock);
+			reply = m_transport.Command("DEL %b", strKey.data(), strKey.size());
+		}
+		if(reply == nullptr)
+			LogReturn(Stock::RE_COMMUNICATION);
+		ResultCode rc = Stock::RE_UNEXPECT;
+		if(reply->type == REDIS_REPLY_INTEGER)
+			rc = reply->integer == 0 ? Stock::RE_NOT_EXISTS : Stock::RS_SUCCESS;
+		freeReplyObject(reply);
+		return rc;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  bExists [out]
+	 */
+	ResultCode Exists (const std::string& strOwner, const std::string& strItem, bool& bExists)
+	{
+		std::string strKey = KeyPolicy::Generate(strOwner, strItem);
+		redisReply* reply = nullptr;
+		{
+			Guard guard(m_lock);
+			reply = m_transport.Command("EXISTS %b", strKey.data(), strKey.size());
+		}
+		if(reply == nullptr)
+			LogReturn(Stock::RE_COMMUNICATION);
+		ResultCode rc = Stock::RE_UNEXPECT;
+		if(reply->type == REDIS_REPLY_INTEGER)
+		{
+			bExists = reply->integer != 0;
+			rc = Stock::RS_SUCCESS;
+		}
+		freeReplyObject(reply);
+		return rc;
+	}
+
+
+	static std::string GenerateKey (const std::string& strOwner, const std::string& strItem)
+	{
+		return KeyPolicy::Generate(strOwner, strItem);
+	}
+
+
+protected:
+	Transport m_transport;
+	LockPolicy m_lock;
+
+
+};
+
+typedef BasicCacheCluster<CItemOwnerKeyPolicy, CCompressCodec, CRedisTransport<1>, CMutexLockPolicy> CDefaultCacheCluster;
+typedef BasicCacheCluster<CItemOwnerKeyPolicy, CRawCodec, CRedisTransport<0>, CNoLockPolicy> CRawCacheCluster;
+
+#endif // BASICCACHECLUSTER_H
@@ -0,0 +1,67 @@
+
+#ifndef CBLOOMFILTER_H
+#define CBLOOMFILTER_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+/**
+ * class CBloomFilter
+ * MayContain() never returns false for an added key.
+ * k probes are derived from one std::hash by double hashing.
+ */
+class CBloomFilter
+{
+public:
+	/**
+	 * @param  nExpectedCount expected key count, about 1% false positive at 10 bits per key.
+	 */
+	explicit CBloomFilter(size_t nExpectedCount = 0):
+		m_vectBit((std::max<size_t>(nExpectedCount, 1024) * 10 + 63) / 64, 0)
+	{
+	}
+
+	void Add(const std::string& strKey)
+	{
+		uint64_t nHash1, nHash2;
+		Hash(strKey, nHash1, nHash2);
+		size_t nBitCount = m_vectBit.size() * 64;
+		for(size_t i = 0; i < HASH_COUNT; i++)
+		{
+			size_t nBit = (nHash1 + i * nHash2) % nBitCount;
+			m_vectBit[nBit / 64] |= uint64_t(1) << (nBit % 64);
+		}
+	}
+
+	bool MayContain(const std::string& strKey) const
+	{
+		uint64_t nHash1, nHash2;
+		Hash(strKey, nHash1, nHash2);
+		size_t nBitCount = m_vectBit.size() * 64;
+		for(size_t i = 0; i < HASH_COUNT; i++)
+		{
+			size_t nBit = (nHash1 + i * nHash2) % nBitCount;
+			if(!(m_vectBit[nBit / 64] & (uint64_t(1) << (nBit % 64))))
+				return false;
+		}
+		return true;
+	}
+
+protected:
+	static const size_t HASH_COUNT = 7;
+
+	static void Hash(const std::string& strKey, uint64_t& nHash1, uint64_t& nHash2)
+	{
+		nHash1 = std::hash<std::string>()(strKey);
+		nHash2 = (nHash1 ^ (nHash1 >> 31)) * 0x94D049BB133111EBULL;
+		nHash2 = (nHash2 ^ (nHash2 >> 29)) | 1;
+	}
+
+	std::vector<uint64_t> m_vectBit;
+
+
+};
+
+#endif // CBLOOMFILTER_H
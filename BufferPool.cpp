@@ -0,0 +1,58 @@
+#include "BufferPool.h"
+#include <utility>
+
+// Constructors/Destructors
+//
+
+CBufferPool::CBufferPool (size_t nMinSize, size_t nMaxSize, size_t nMaxPerClass):
+		m_nMinSize(1), m_nMaxSize(nMaxSize), m_nMaxPerClass(nMaxPerClass)
+{
+	while(m_nMinSize < nMinSize)
+		m_nMinSize <<= 1;
+	size_t nClassCount = 1;
+	while((m_nMinSize << (nClassCount - 1)) < m_nMaxSize)
+		nClassCount++;
+	m_vectFree.resize(nClassCount);
+}
+
+CBufferPool::~CBufferPool ()
+{
+}
+
+//
+// Methods
+//
+
+std::string CBufferPool::Acquire (size_t nSize)
+{
+	if(nSize > m_nMaxSize)
+		return std::string(nSize, '\0');
+	size_t nClass = 0;
+	while((m_nMinSize << nClass) < nSize)
+		nClass++;
+	std::string strBuffer;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_vectFree[nClass].empty())
+		{
+			strBuffer.swap(m_vectFree[nClass].back());
+			m_vectFree[nClass].pop_back();
+		}
+	}
+	//the capacity of a pooled buffer holds its class, the resize doesn't allocate.
+	strBuffer.resize(m_nMinSize << nClass);
+	return strBuffer;
+}
+
+void CBufferPool::Release (std::string&& strBuffer)
+{
+	size_t nCapacity = strBuffer.capacity();
+	if(nCapacity < m_nMinSize)
+		return;
+	size_t nClass = 0;
+	while(nClass + 1 < m_vectFree.size() && (m_nMinSize << (nClass + 1)) <= nCapacity)
+		nClass++;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_vectFree[nClass].size() < m_nMaxPerClass)
+		m_vectFree[nClass].push_back(std::move(strBuffer));
+}
@@ -0,0 +1,59 @@
+#ifndef CBUFFERPOOL_H
+#define CBUFFERPOOL_H
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * class CBufferPool
+ * Reusable read buffers in power of two size classes from nMinSize to nMaxSize.
+ *
+ * A buffer is acquired for one read and released right after its content is copied out, so the
+ * pool keeps a few buffers per class in steady state. A size larger than nMaxSize is allocated
+ * and freed as usual.
+ */
+class CBufferPool
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * @param  nMinSize the smallest class, rounded up to a power of two.
+	 * @param  nMaxSize the largest class.
+	 * @param  nMaxPerClass free buffers kept for each class.
+	 */
+	CBufferPool (size_t nMinSize = 4096, size_t nMaxSize = 1024 * 1024, size_t nMaxPerClass = 8);
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CBufferPool ();
+
+
+	/**
+	 * @return a buffer whose size is the class size not less than nSize, the content is undefined.
+	 * @param  nSize
+	 */
+	std::string Acquire (size_t nSize);
+
+
+	/**
+	 * Keep the buffer for a later Acquire, by the largest class its capacity holds.
+	 * @param  strBuffer
+	 */
+	void Release (std::string&& strBuffer);
+
+
+protected:
+	size_t m_nMinSize;
+	size_t m_nMaxSize;
+	size_t m_nMaxPerClass;
+	std::vector<std::vector<std::string>> m_vectFree;	//by class, class i holds m_nMinSize << i bytes
+	std::mutex m_mutex;
+
+
+};
+
+#endif // CBUFFERPOOL_H
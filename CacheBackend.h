@@ -0,0 +1,193 @@
+#ifndef ICACHEBACKEND_H
+#define ICACHEBACKEND_H
+#include "ResultCode.h"
+#include "CacheDeadline.h"
+#include <string>
+#include <vector>
+
+/**
+ * class ICacheBackend
+ * The key value operations CCacheCluster needs from its store. CRedisCacheBackend keeps them
+ * on a Redis server, CMemoryCacheBackend keeps them in the process for the single box runs
+ * and the tests.
+ *
+ * All the implementations are thread safe, every operation is atomic on its key, so SetNX
+ * gives the same lock semantics on every backend. The Multi operations run the single key ones
+ * by default, checking the CCacheDeadline of the caller between the keys, a backend with a
+ * batch command overrides them.
+ */
+class ICacheBackend
+{
+public:
+	virtual ~ICacheBackend ()
+	{
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: not exists or expired.
+	 * @param  strKey
+	 * @param  strValue [out]
+	 */
+	virtual ResultCode Get (const std::string& strKey, std::string& strValue) = 0;
+
+
+	/**
+	 * Get with the remaining life cycle, the copies kept out of the backend expire with it.
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: not exists or expired.
+	 * @param  strKey
+	 * @param  strValue [out]
+	 * @param  nLifeCycleInMS [out] -1 means not limited.
+	 */
+	virtual ResultCode GetWithLifeCycle (const std::string& strKey, std::string& strValue,
+			long long& nLifeCycleInMS) = 0;
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strKey
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	virtual ResultCode Set (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1)) = 0;
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: not exists.
+	 * @param  strKey
+	 */
+	virtual ResultCode Delete (const std::string& strKey) = 0;
+
+
+	virtual ResultCode Exists (const std::string& strKey, bool& bExists) = 0;
+
+
+	/**
+	 * Set only when the key doesn't exist, the value and the life cycle are set atomically.
+	 * @return ResultCode
+	 * 		RE_BUSY: the key exists.
+	 * @param  strKey
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	virtual ResultCode SetNX (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1)) = 0;
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: not exists.
+	 * @param  strKey
+	 * @param  nLifeCycleInSecond
+	 */
+	virtual ResultCode Expire (const std::string& strKey, size_t nLifeCycleInSecond) = 0;
+
+
+	/**
+	 * @return ResultCode
+	 * @param  vectKey
+	 * @param  vectValue [out]
+	 * @param  vectLifeCycleInMS [out] the GetWithLifeCycle life cycle of each key, -2 means not exists.
+	 */
+	virtual ResultCode MultiGet (const std::vector<std::string>& vectKey, std::vector<std::string>& vectValue,
+			std::vector<long long>& vectLifeCycleInMS)
+	{
+		vectValue.assign(vectKey.size(), std::string());
+		vectLifeCycleInMS.assign(vectKey.size(), -2);
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			if(CCacheDeadline::GetRemainingMS(1) <= 0)
+				return Stock::RE_TIME_OUT;
+			ResultCode rc = GetWithLifeCycle(vectKey[i], vectValue[i], vectLifeCycleInMS[i]);
+			if(rc == Stock::RE_NOT_EXISTS)
+				vectLifeCycleInMS[i] = -2;
+			else if(RC_FAILED(rc))
+				return rc;
+		}
+		return Stock::RS_SUCCESS;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * @param  vectKey
+	 * @param  vectExists [out]
+	 */
+	virtual ResultCode MultiExists (const std::vector<std::string>& vectKey, std::vector<bool>& vectExists)
+	{
+		vectExists.assign(vectKey.size(), false);
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			if(CCacheDeadline::GetRemainingMS(1) <= 0)
+				return Stock::RE_TIME_OUT;
+			bool bExists = false;
+			ResultCode rc = Exists(vectKey[i], bExists);
+			if(RC_FAILED(rc))
+				return rc;
+			vectExists[i] = bExists;
+		}
+		return Stock::RS_SUCCESS;
+	}
+
+
+	/**
+	 * Set all the keys when none of them is held by others, or set none. By default the keys are
+	 * taken one by one in the given order and the taken ones are deleted again when one is held,
+	 * so it is all or none, though not in one atomic step.
+	 * @return ResultCode
+	 * 		RE_BUSY: nBlocking is the index of a key held by others.
+	 * @param  vectKey
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 * @param  nBlocking [out]
+	 */
+	virtual ResultCode MultiSetNX (const std::vector<std::string>& vectKey, const std::string& strValue,
+			size_t nLifeCycleInSecond, size_t& nBlocking)
+	{
+		ResultCode rc = Stock::RS_SUCCESS;
+		size_t nLocked = 0;
+		for(; nLocked < vectKey.size(); nLocked++)
+		{
+			rc = CCacheDeadline::GetRemainingMS(1) <= 0 ? Stock::RE_TIME_OUT
+					: SetNX(vectKey[nLocked], strValue, nLifeCycleInSecond);
+			if(RC_FAILED(rc))
+				break;
+		}
+		if(nLocked == vectKey.size())
+			return Stock::RS_SUCCESS;
+		for(size_t i = 0; i < nLocked; i++)
+			Delete(vectKey[i]);
+		nBlocking = nLocked;
+		return rc;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * @param  vectKey
+	 * @param  nDeleted [out] the count of the keys which existed.
+	 */
+	virtual ResultCode MultiDelete (const std::vector<std::string>& vectKey, size_t& nDeleted)
+	{
+		nDeleted = 0;
+		for(auto& strKey: vectKey)
+		{
+			if(CCacheDeadline::GetRemainingMS(1) <= 0)
+				return Stock::RE_TIME_OUT;
+			ResultCode rc = Delete(strKey);
+			if(RC_SUCCEEDED(rc))
+				nDeleted++;
+			else if(rc != Stock::RE_NOT_EXISTS)
+				return rc;
+		}
+		return Stock::RS_SUCCESS;
+	}
+
+
+};
+
+#endif // ICACHEBACKEND_H
@@ -1,6 +1,12 @@
 #include "CacheCluster.h"
+#include "BasicCacheCluster.h"
 #include "Log.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
 #include <chrono>
 #include <thread>
 #include "stock/utility/Utility.h"
@@ -11,17 +17,15 @@ static const std::string SEPERATOR = "_";
 // Constructors/Destructors
 //  
 
-CCacheCluster::CCacheCluster ()
+CCacheCluster::CCacheCluster ():m_pRedis(new CRedisConnection())
 {
+	m_pRedisBackend.reset(new CRedisCacheBackend(m_pRedis));
+	m_pBackend = m_pRedisBackend;
 }
 
 CCacheCluster::~CCacheCluster ()
 {
-	if(this->m_pServer != nullptr)
-	{
-		redisFree(m_pServer);
-		m_pServer = nullptr;
-	}
+	StopBackground();
 }
 
 //  
@@ -37,13 +41,7 @@ CCacheCluster::~CCacheCluster ()
 ResultCode CCacheCluster::ConnectCacheServer (const std::string& strServerAddr, int nPort,
 		int nTimeoutInMS)
 {
-	if(strServerAddr.empty())
-		return RE_INVALIDATE_PARAMETER;
-	std::lock_guard<std::mutex> lock(m_mutex);
-	m_strServerAddress = strServerAddr;
-	m_nServerPort = nPort;
-	this->m_nConnectTimeOutInMS = nTimeoutInMS;
-	return this->Reconnect();
+	return m_pRedis->Connect(strServerAddr, nPort, nTimeoutInMS);
 }
 
 /**
@@ -55,43 +53,55 @@ ResultCode CCacheCluster::ConnectCacheServer (const std::string& strServerAddr,
 ResultCode CCacheCluster::GetItemValue (const std::string& strOwner, const std::string& strItem,
 		std::string& strValue)
 {
-	std::lock_guard<std::mutex> lock(m_mutex);
-	ResultCode rc = RE_ERROR;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strKey = GenerateKey(strOwner, strItem);
-	redisReply* reply = nullptr;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
-
-	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
+	m_hotKeySampler.Record(strKey);
+	bool bAbsent = false;
+	if(GetLocalValue(strOwner, strKey, strValue, bAbsent))
+		return RS_SUCCESS;
+	if(bAbsent)
+		return RE_NOT_EXISTS;
+	unsigned long long nGeneration = GetLocalGeneration(strKey);
+	boost::shared_ptr<ICacheBackend> pBackend = boost::atomic_load(&m_pBackend);
+	ResultCode rc = RE_ERROR;
+	bool bHostTier = false;
+	//a hot key is pinned no longer than the backend copy lives, -2 means not known.
+	long long nLifeCycleInMS = -2;
+	bool bHot = m_hotKeySampler.IsHot(strKey);
+	if(GetHostTierValue(strKey, strValue, bHostTier))
+		rc = RS_SUCCESS;
+	else
 	{
-		reply = (redisReply*)redisCommand(this->m_pServer, "get %s", strKey.c_str());
-		if ( reply ==nullptr || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL))
-		{
-			LogError() << "Failed to execute command:" << "get " << strKey;
-
-			freeReplyObject(reply);
-			if(RC_FAILED(Reconnect()))
-				LogReturn(RE_COMMUNICATION);
-			reply = nullptr;
-			rc = RE_ERROR;
-			continue;
-		}
-		if(reply->type == REDIS_REPLY_NIL)
-			rc = RE_NOT_EXISTS;
+		if(CCacheDeadline::GetRemainingMS(1) <= 0)
+			LogReturn(RE_TIME_OUT);
+		//the remaining life cycle comes in the same round trip, so the host and the pinned copies
+		//expire with the backend copy.
+		if(bHostTier || bHot)
+			rc = pBackend->GetWithLifeCycle(strKey, strValue, nLifeCycleInMS);
 		else
-		{
-			strValue.assign(reply->str, reply->len);
-			rc = RS_SUCCESS;
-		}
+			rc = pBackend->Get(strKey, strValue);
+		if(rc == RE_NOT_EXISTS)
+			SetLocalAbsent(strKey, nGeneration);
+		else if(RC_SUCCEEDED(rc) && bHostTier)
+			PutHostTierValue(strKey, strValue, nLifeCycleInMS < 0 ? size_t(-1) : size_t((nLifeCycleInMS + 999)/1000));
 	}
 
-	freeReplyObject(reply);
 	if(RC_SUCCEEDED(rc))
 	{
 		std::string strTemp;
 		strTemp.swap(strValue);
-		rc = Stock::Utility::decompress(strTemp, strValue);
+		rc = CCompressCodec::Decode(strTemp.data(), strTemp.size(), strValue);
 		LogErrorCode(rc);
+		//not pinned when the life cycle is unknown, -1 is a value without TTL.
+		if(RC_SUCCEEDED(rc) && bHot && nLifeCycleInMS != -2)
+		{
+			std::lock_guard<std::mutex> lockLocal(m_mutexLocal);
+			long long nPinInMS = m_nHotKeyLifeCycleInMS;
+			if(nLifeCycleInMS >= 0)
+				nPinInMS = std::min(nPinInMS, nLifeCycleInMS);
+			if(LocalGeneration(strKey) == nGeneration)
+				SetLocalValue(strKey, strValue, nPinInMS);
+		}
 	}
 	LogTrace2() << "Get Item Value for " << strOwner << ":" << strItem << "=" << strValue <<
 				";";
@@ -112,48 +122,21 @@ ResultCode CCacheCluster::SetItemValue (const std::string& strOwner, const std::
 {
 	LogTrace2() << "Set Item Value for " << strOwner << ":" << strItem << "=" << strOrigValue <<
 			"; life cycle ="  <<  nLifeCycleInSecond;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strValue;
-	Stock::Utility::compress(strOrigValue, strValue);
-	std::lock_guard<std::mutex> lock(m_mutex);
+	ResultCode rcEncode = CCompressCodec::Encode(strOrigValue, strValue);
+	if(RC_FAILED(rcEncode))
+		LogReturn(rcEncode);
 	std::string strKey = GenerateKey(strOwner, strItem);
-	redisReply* reply = nullptr;
-	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
-
-	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
-	{
-		if(nLifeCycleInSecond == size_t(-1))
-		{
-			reply = (redisReply*)redisCommand(this->m_pServer, "SET %s %b",
-					strKey.c_str(), strValue.c_str(), strValue.size());
-		}
-		else
-		{
-			reply = (redisReply*)redisCommand(m_pServer, "SETEX %s %d %b",
-					strKey.c_str(), nLifeCycleInSecond, strValue.c_str(), strValue.size());
-
-		}
-		if(reply == nullptr)
-		{
-			LogError() << "set key failed for " << strKey;
-			if(RC_FAILED(Reconnect()))
-				LogReturn(RE_COMMUNICATION);
-			rc = RE_ERROR;
-			continue;
-		}
-		if (!(reply->type == REDIS_REPLY_STATUS && strcasecmp(reply->str,"OK") == 0))
-		{
-			LogError() << "set key failed for " << strKey << ":" << reply->str;
-			freeReplyObject(reply);
-			reply = nullptr;
-			rc = RE_ERROR;
-			continue;
-		}
-		rc = RS_SUCCESS;
-	}
-
-	freeReplyObject(reply);
+	CLocalInvalidation invalidation(this, strKey);
+	AddOwnerFilterKey(strOwner, strKey);
+	if(CCacheDeadline::GetRemainingMS(1) <= 0)
+		LogReturn(RE_TIME_OUT);
+	ResultCode rc = boost::atomic_load(&m_pBackend)->Set(strKey, strValue, nLifeCycleInSecond);
+	if(RC_SUCCEEDED(rc))
+		PutHostTierValue(strKey, strValue, nLifeCycleInSecond);
+	else
+		RemoveHostTierValue(strKey);
 	return rc;
 }
 
@@ -165,37 +148,16 @@ ResultCode CCacheCluster::SetItemValue (const std::string& strOwner, const std::
  */
 ResultCode CCacheCluster::RemoveItemValue (const std::string& strOwner, const std::string& strItem)
 {
-	std::lock_guard<std::mutex> lock(m_mutex);
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strKey = GenerateKey(strOwner, strItem);
-	redisReply* reply = nullptr;
-	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
-
-	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
-	{
-
-		reply = (redisReply*)redisCommand(this->m_pServer, "DEL %s",
-						strKey.c_str());
-
-		if ( reply ==nullptr || reply->type != REDIS_REPLY_INTEGER || reply->integer != 1)
-		{
-			if(reply && reply->type == REDIS_REPLY_INTEGER &&  reply->integer == 0)
-				rc = RE_NOT_EXISTS;
-			else
-				rc = RE_ERROR;
-			LogTrace2() << "Failed to execute command:" << "DEL " << strKey;
-			freeReplyObject(reply);
-			if(RC_FAILED(Reconnect()))
-				LogReturn(RE_COMMUNICATION);
-			reply = nullptr;
-
-			continue;
-		}
-		rc = RS_SUCCESS;
-	}
-
-	freeReplyObject(reply);
+	CLocalInvalidation invalidation(this, strKey);
+	RemoveHostTierValue(strKey);
+	if(CCacheDeadline::GetRemainingMS(1) <= 0)
+		LogReturn(RE_TIME_OUT);
+	ResultCode rc = boost::atomic_load(&m_pBackend)->Delete(strKey);
+	invalidation.Invalidate();
+	if(RC_SUCCEEDED(rc) || rc == RE_NOT_EXISTS)
+		SetLocalAbsent(strKey, GetLocalGeneration(strKey));
 	return rc;
 }
 
@@ -210,16 +172,14 @@ ResultCode CCacheCluster::TryGetProduceRight (const std::string& strOwner, const
 {
 	if(nRightSpanInSecond <= 0)
 		return RE_INVALIDATE_PARAMETER;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strKey = GenerateKey(strOwner, strItem);
-	redisReply* reply = nullptr;
 	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
 
 	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
 	{
 		bool bExists = false;
-		rc = Exists(strOwner, strItem, bExists);
+		rc = ExistsOnServer(strOwner, strItem, bExists);
 		if(RC_FAILED(rc))
 		{
 			continue;
@@ -256,18 +216,26 @@ ResultCode CCacheCluster::WaitForItemValue (const std::string& strOwner, const s
 	std::chrono::time_point<std::chrono::system_clock> currentTime = std::chrono::system_clock::now();
 	auto nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
 	auto nStart = nCurrent;
+	std::string strKey = GenerateKey(strOwner, strItem);
 	do
 	{
+		//the concurrent waiters of the same item share one round trip per absent life cycle.
 		bool bExists = false;
-		rc = Exists(strOwner, strItem, bExists);
-		if(RC_FAILED(rc))
+		if(!IsKnownAbsent(strOwner, strKey, false))
 		{
-			break;
+			unsigned long long nGeneration = GetLocalGeneration(strKey);
+			rc = ExistsOnServer(strOwner, strItem, bExists);
+			if(RC_FAILED(rc))
+			{
+				break;
+			}
+			if(!bExists)
+				SetLocalAbsent(strKey, nGeneration);
 		}
 		if(bExists)
 			return RS_SUCCESS;
-		if(nTimeOutInMS != 0)
-			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		if(nTimeOutInMS != 0 && !CCacheDeadline::SleepBeforeDeadline(200))
+			break;
 		currentTime = std::chrono::system_clock::now();
 		nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
 	}
@@ -276,227 +244,1293 @@ ResultCode CCacheCluster::WaitForItemValue (const std::string& strOwner, const s
 
 }
 
+ResultCode CCacheCluster::EnableDiskCache(const std::string& strDirPath, size_t nMaxSizeInMB)
+{
+	boost::shared_ptr<CCacheDiskStore> pDiskStore(new CCacheDiskStore());
+	ResultCode rc = pDiskStore->Open(strDirPath, nMaxSizeInMB);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	boost::atomic_store(&m_pDiskStore, pDiskStore);
+	return RS_SUCCESS;
+}
+
+void CCacheCluster::DisableDiskCache()
+{
+	boost::atomic_store(&m_pDiskStore, boost::shared_ptr<CCacheDiskStore>());
+}
+
+ResultCode CCacheCluster::EnableSharedMemoryCache(const std::string& strName, size_t nMaxSizeInMB, size_t nMaxKeyCount)
+{
+	boost::shared_ptr<CCacheShmStore> pShmStore(new CCacheShmStore());
+	ResultCode rc = pShmStore->Open(strName, nMaxSizeInMB, nMaxKeyCount);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	boost::atomic_store(&m_pShmStore, pShmStore);
+	return RS_SUCCESS;
+}
+
+void CCacheCluster::DisableSharedMemoryCache()
+{
+	boost::atomic_store(&m_pShmStore, boost::shared_ptr<CCacheShmStore>());
+}
+
+void CCacheCluster::SetHostTierMaxLifeCycle(size_t nMaxLifeCycleInSecond)
+{
+	m_nHostTierMaxLifeCycleInSecond = nMaxLifeCycleInSecond;
+}
+
+void CCacheCluster::SetBackend(const boost::shared_ptr<ICacheBackend>& pBackend)
+{
+	if(pBackend)
+		boost::atomic_store(&m_pBackend, pBackend);
+	else
+		boost::atomic_store(&m_pBackend, boost::shared_ptr<ICacheBackend>(m_pRedisBackend));
+	//the local copies and the owner filters describe the old store, the fills in flight are dropped.
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	m_mapLocalValue.clear();
+	m_mapLocalAbsent.clear();
+	m_mapOwnerFilter.clear();
+	for(auto& nGeneration: m_nLocalGeneration)
+		nGeneration++;
+	m_deqPrefetch.clear();
+	m_setInFlight.clear();
+	m_cvPrefetch.notify_all();
+}
+
+/*
+ * Shared memory first, then disk, a disk hit is promoted to the shared memory.
+ * bEnabled tells whether any host tier is enabled.
+ */
+bool CCacheCluster::GetHostTierValue(const std::string& strKey, std::string& strValue, bool& bEnabled)
+{
+	boost::shared_ptr<CCacheShmStore> pShmStore = boost::atomic_load(&m_pShmStore);
+	boost::shared_ptr<CCacheDiskStore> pDiskStore = boost::atomic_load(&m_pDiskStore);
+	bEnabled = pShmStore || pDiskStore;
+	if(pShmStore && RC_SUCCEEDED(pShmStore->Get(strKey, strValue)))
+		return true;
+	if(!pDiskStore || RC_FAILED(pDiskStore->Get(strKey, strValue)))
+		return false;
+	if(pShmStore)
+	{
+		//the disk copy doesn't keep the remaining TTL, the same as the local values fetched from disk.
+		int nLocalLifeCycleInMS = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutexLocal);
+			nLocalLifeCycleInMS = m_nLocalLifeCycleInMS;
+		}
+		pShmStore->Put(strKey, strValue, std::min(size_t(nLocalLifeCycleInMS + 999)/1000,
+				m_nHostTierMaxLifeCycleInSecond.load()));
+	}
+	return true;
+}
+
+/*
+ * The host copies are not invalidated by the writes of other hosts, their life cycle is capped so
+ * a value without TTL on the server is not served from them forever.
+ */
+void CCacheCluster::PutHostTierValue(const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	boost::shared_ptr<CCacheShmStore> pShmStore = boost::atomic_load(&m_pShmStore);
+	boost::shared_ptr<CCacheDiskStore> pDiskStore = boost::atomic_load(&m_pDiskStore);
+	nLifeCycleInSecond = std::min(nLifeCycleInSecond, m_nHostTierMaxLifeCycleInSecond.load());
+	if(pShmStore)
+		pShmStore->Put(strKey, strValue, nLifeCycleInSecond);
+	if(pDiskStore)
+		pDiskStore->Put(strKey, strValue, nLifeCycleInSecond);
+}
+
+void CCacheCluster::RemoveHostTierValue(const std::string& strKey)
+{
+	boost::shared_ptr<CCacheShmStore> pShmStore = boost::atomic_load(&m_pShmStore);
+	boost::shared_ptr<CCacheDiskStore> pDiskStore = boost::atomic_load(&m_pDiskStore);
+	if(pShmStore)
+		pShmStore->Remove(strKey);
+	if(pDiskStore)
+		pDiskStore->Remove(strKey);
+}
+
 std::string CCacheCluster::GenerateKey(const std::string& strOwner, const std::string& strItem) const
 {
-	return strItem + SEPERATOR + strOwner;
+	return CItemOwnerKeyPolicy::Generate(strOwner, strItem);
+}
+
+/*
+ * The Redis only commands run on m_pRedis, only while the default backend is set.
+ */
+bool CCacheCluster::IsRedisBackend()
+{
+	return boost::atomic_load(&m_pBackend) == m_pRedisBackend;
+}
+
+void CCacheCluster::EnableThreadConnection(bool bEnable)
+{
+	m_pRedis->EnableThreadConnection(bEnable);
+}
+
+ResultCode CCacheCluster::EnableMultiplexedConnection(bool bEnable, size_t nMaxBatchSize)
+{
+	return m_pRedis->EnableMultiplexedConnection(bEnable, nMaxBatchSize);
+}
+
+void CCacheCluster::SetDefaultTimeOut(int nTimeOutInMS)
+{
+	m_nDefaultTimeOutInMS = nTimeOutInMS;
+}
+
+ResultCode CCacheCluster::Exists(const std::string& strOwner, const std::string& strItem, bool& bExists)
+{
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::string strKey = GenerateKey(strOwner, strItem);
+	if(IsKnownAbsent(strOwner, strKey, true))
+	{
+		bExists = false;
+		return RS_SUCCESS;
+	}
+	unsigned long long nGeneration = GetLocalGeneration(strKey);
+	ResultCode rc = ExistsOnServer(strOwner, strItem, bExists);
+	if(RC_SUCCEEDED(rc) && !bExists)
+		SetLocalAbsent(strKey, nGeneration);
+	return rc;
+}
+
+ResultCode CCacheCluster::ExistsOnServer(const std::string& strOwner, const std::string& strItem, bool& bExists)
+{
+	if(CCacheDeadline::GetRemainingMS(1) <= 0)
+		LogReturn(RE_TIME_OUT);
+	return boost::atomic_load(&m_pBackend)->Exists(GenerateKey(strOwner, strItem), bExists);
+}
+
+ResultCode CCacheCluster::TryLock(const std::string& strOwner, const std::string& strItem, int nLockPeriodInSecond,
+		int nTimeoutInMS)
+{
+	//0 tries once, the attempt has the budget of a single call, the waits between the attempts end
+	//at the deadline.
+	CDeadlineScope scope(nTimeoutInMS == 0 ? m_nDefaultTimeOutInMS : nTimeoutInMS);
+	std::string strKeyLock = GenerateKey(strOwner, strItem) + SEPERATOR + "Lock";
+	boost::shared_ptr<ICacheBackend> pBackend = boost::atomic_load(&m_pBackend);
+	std::chrono::time_point<std::chrono::system_clock> currentTime = std::chrono::system_clock::now();
+	auto nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
+	auto nStart = nCurrent;
+	do
+	{
+		if(CCacheDeadline::GetRemainingMS(1) <= 0)
+			return RE_TIME_OUT;
+		ResultCode rc = pBackend->SetNX(strKeyLock, strKeyLock,
+				nLockPeriodInSecond <= 0 ? size_t(-1) : size_t(nLockPeriodInSecond));
+		if(rc != RE_BUSY)
+			return rc;
+		if(nTimeoutInMS != 0 && !CCacheDeadline::SleepBeforeDeadline(200))
+			break;
+		currentTime = std::chrono::system_clock::now();
+		nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
+	}
+	while(nCurrent - nStart	<= nTimeoutInMS);
+	return RE_TIME_OUT;
+}
+
+ResultCode CCacheCluster::Unlock(const std::string& strOwner, const std::string& strItem)
+{
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::string strKeyLock = GenerateKey(strOwner, strItem) + SEPERATOR + "Lock";
+	if(CCacheDeadline::GetRemainingMS(1) <= 0)
+		LogReturn(RE_TIME_OUT);
+	ResultCode rc = boost::atomic_load(&m_pBackend)->Delete(strKeyLock);
+	return rc == RE_NOT_EXISTS ? RS_NOT_EXISTS : rc;
+}
+
+bool CCacheCluster::IsLocalCacheAvail(const std::string& strOwner, const std::string& strItem) const
+{
+	auto it = m_mapLocalCacheAvail.find(GenerateKey(strOwner, strItem));
+	if(it != m_mapLocalCacheAvail.end())
+		return it->second;
+	return false;
+}
+
+void CCacheCluster::SetLocalCacheAvail(const std::string& strOwner, const std::string& strItem)
+{
+	m_mapLocalCacheAvail.insert(std::make_pair(GenerateKey(strOwner, strItem), true));
 }
 
-ResultCode CCacheCluster::Reconnect()
+ResultCode CCacheCluster::Prefetch(const std::vector<ItemKey>& vectKey)
 {
-	if(this->m_pServer != nullptr)
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	if(m_bStopBackground)
+		LogReturn(RE_NOT_INITIALIZE);
+	auto tpNow = std::chrono::steady_clock::now();
+	for(auto& key: vectKey)
 	{
-		redisFree(m_pServer);
-		m_pServer = nullptr;
+		std::string strKey = GenerateKey(key.first, key.second);
+		auto it = m_mapLocalValue.find(strKey);
+		if(it != m_mapLocalValue.end() && it->second.tpExpire > tpNow)
+			continue;
+		if(!m_setInFlight.insert(strKey).second)
+			continue;
+		m_deqPrefetch.push_back(strKey);
 	}
-	timeval tv;
-	tv.tv_sec = m_nConnectTimeOutInMS/1000;
-	tv.tv_usec = m_nConnectTimeOutInMS%1000*1000;
+	while(m_vectPrefetchThread.size() < m_nPrefetchConcurrency)
+		m_vectPrefetchThread.push_back(std::thread(&CCacheCluster::PrefetchThread, this));
+	m_cvPrefetchQueue.notify_all();
+	return RS_SUCCESS;
+}
 
-	m_pServer = redisConnectWithTimeout(m_strServerAddress.c_str(), m_nServerPort, tv);
-	if(m_pServer->err)
+ResultCode CCacheCluster::WarmUp(const std::vector<ItemKey>& vectKey, int nTimeOutInMS)
+{
+	ResultCode rc = Prefetch(vectKey);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	auto tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeOutInMS);
+	std::unique_lock<std::mutex> lock(m_mutexLocal);
+	for(auto& key: vectKey)
 	{
-		LogError() << "Connect to Redis server " << m_strServerAddress << ":" << m_nServerPort << " Failed:" << m_pServer->errstr;
-		redisFree(m_pServer);
-		m_pServer = nullptr;
+		std::string strKey = GenerateKey(key.first, key.second);
+		while(m_setInFlight.count(strKey) != 0)
+		{
+			if(nTimeOutInMS < 0)
+				m_cvPrefetch.wait(lock);
+			else if(m_cvPrefetch.wait_until(lock, tpDeadline) == std::cv_status::timeout)
+				return RE_TIME_OUT;
+		}
+	}
+	return RS_SUCCESS;
+}
+
+void CCacheCluster::SetPrefetchOption(size_t nBatchSize, size_t nMaxConcurrency, int nLocalLifeCycleInMS)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	if(nBatchSize > 0)
+		m_nPrefetchBatchSize = nBatchSize;
+	if(nMaxConcurrency > 0)
+		m_nPrefetchConcurrency = nMaxConcurrency;
+	m_nLocalLifeCycleInMS = nLocalLifeCycleInMS;
+}
+
+void CCacheCluster::GetHotKeys(std::vector<std::pair<std::string, size_t>>& vectHotKey)
+{
+	m_hotKeySampler.GetHotKeys(vectHotKey);
+}
 
-		return Stock::RE_ERROR;
+void CCacheCluster::SetHotKeyOption(size_t nTopK, double dHotRatio, int nLocalLifeCycleInMS)
+{
+	m_hotKeySampler.SetOption(nTopK, dHotRatio);
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	m_nHotKeyLifeCycleInMS = nLocalLifeCycleInMS;
+}
+
+bool CCacheCluster::GetLocalValue(const std::string& strOwner, const std::string& strKey, std::string& strValue,
+		bool& bAbsent)
+{
+	int nConnectTimeOutInMS = m_pRedis->GetConnectTimeOut();
+	std::unique_lock<std::mutex> lock(m_mutexLocal);
+	//an in-flight prefetch is cheaper than a duplicate request, but a stuck batch is not waited
+	//for longer than a connect time out, the value is fetched directly then.
+	auto tpDeadline = std::min(CCacheDeadline::Deadline(), std::chrono::steady_clock::now() + std::chrono::milliseconds(nConnectTimeOutInMS));
+	while(m_setInFlight.count(strKey) != 0)
+	{
+		if(m_cvPrefetch.wait_until(lock, tpDeadline) == std::cv_status::timeout)
+			break;
+	}
+	lock.unlock();
+	bAbsent = IsKnownAbsent(strOwner, strKey, true);
+	if(bAbsent)
+		return false;
+	lock.lock();
+	auto it = m_mapLocalValue.find(strKey);
+	if(it == m_mapLocalValue.end())
+		return false;
+	if(it->second.tpExpire <= std::chrono::steady_clock::now())
+	{
+		m_mapLocalValue.erase(it);
+		return false;
 	}
-	LogDebug() << "Connect To Redis server succeeded:" << m_strServerAddress << ":" << m_nServerPort;
-	return Stock::RS_SUCCESS;
+	strValue = it->second.strValue;
+	return true;
 }
 
-ResultCode CCacheCluster::Exists(const std::string& strOwner, const std::string& strItem, bool& bExists)
+void CCacheCluster::SetLocalValue(const std::string& strKey, const std::string& strValue, long long nLifeCycleInMS)
+{
+	if(nLifeCycleInMS <= 0)
+		return;
+	LocalValue& value = m_mapLocalValue[strKey];
+	value.strValue = strValue;
+	value.tpExpire = std::chrono::steady_clock::now() + std::chrono::milliseconds(nLifeCycleInMS);
+}
+
+void CCacheCluster::RemoveLocalValue(const std::string& strKey)
 {
-	std::lock_guard<std::mutex> lock(m_mutex);
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	LocalGeneration(strKey)++;
+	m_mapLocalValue.erase(strKey);
+	m_mapLocalAbsent.erase(strKey);
+	//the in-flight prefetch may carry the old value, drop it.
+	if(m_setInFlight.erase(strKey) != 0)
+		m_cvPrefetch.notify_all();
+}
+
+void CCacheCluster::StopBackground()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutexLocal);
+		m_bStopBackground = true;
+		m_cvPrefetchQueue.notify_all();
+		m_cvFilterSync.notify_all();
+	}
+	for(auto& thread: m_vectPrefetchThread)
+		thread.join();
+	m_vectPrefetchThread.clear();
+	if(m_threadFilterSync.joinable())
+		m_threadFilterSync.join();
+	{
+		std::lock_guard<std::mutex> lock(m_mutexCounter);
+		m_bStopCounterFlush = true;
+		m_cvCounterFlush.notify_all();
+	}
+	if(m_threadCounterFlush.joinable())
+		m_threadCounterFlush.join();
+
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	m_deqPrefetch.clear();
+	m_setInFlight.clear();
+	m_cvPrefetch.notify_all();
+}
+
+/*
+ * On the Redis server each prefetch thread owns its connection, so the batches overlap with the
+ * foreground commands.
+ */
+void CCacheCluster::PrefetchThread()
+{
+	boost::shared_ptr<CRedisConnection> pConnection(new CRedisConnection());
+	CRedisCacheBackend redisBackend(pConnection);
+	std::unique_lock<std::mutex> lock(m_mutexLocal);
+	while(!m_bStopBackground)
+	{
+		if(m_deqPrefetch.empty())
+		{
+			m_cvPrefetchQueue.wait(lock);
+			continue;
+		}
+		std::vector<std::string> vectKey;
+		while(!m_deqPrefetch.empty() && vectKey.size() < m_nPrefetchBatchSize)
+		{
+			vectKey.push_back(m_deqPrefetch.front());
+			m_deqPrefetch.pop_front();
+		}
+		long long nLocalLifeCycleInMS = m_nLocalLifeCycleInMS;
+		lock.unlock();
+
+		std::vector<std::string> vectValue(vectKey.size());
+		//-2: not exists, -3: not known, the batch failed.
+		std::vector<long long> vectLifeCycle(vectKey.size(), -3);
+		std::vector<std::string> vectFetchKey;
+		std::vector<size_t> vectFetch;
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			bool bHostTier = false;
+			if(GetHostTierValue(vectKey[i], vectValue[i], bHostTier))
+				vectLifeCycle[i] = nLocalLifeCycleInMS;
+			else
+			{
+				vectFetchKey.push_back(vectKey[i]);
+				vectFetch.push_back(i);
+			}
+		}
+
+		boost::shared_ptr<ICacheBackend> pBackend = boost::atomic_load(&m_pBackend);
+		ICacheBackend* pFetchBackend = pBackend.get();
+		std::string strServerAddr;
+		int nPort = 0, nTimeOutInMS = 0;
+		m_pRedis->GetServer(strServerAddr, nPort, nTimeOutInMS);
+		if(pBackend == m_pRedisBackend)
+		{
+			pConnection->SetServer(strServerAddr, nPort, nTimeOutInMS);
+			pFetchBackend = &redisBackend;
+		}
+		std::vector<std::string> vectFetchValue;
+		std::vector<long long> vectFetchLifeCycle;
+		CDeadlineScope scope(nTimeOutInMS);
+		if(!vectFetch.empty() && RC_SUCCEEDED(pFetchBackend->MultiGet(vectFetchKey, vectFetchValue, vectFetchLifeCycle)))
+		{
+			for(size_t j = 0; j < vectFetch.size(); j++)
+			{
+				size_t i = vectFetch[j];
+				vectLifeCycle[i] = vectFetchLifeCycle[j];
+				if(vectLifeCycle[i] == -2)
+					continue;
+				vectValue[i].swap(vectFetchValue[j]);
+				PutHostTierValue(vectKey[i], vectValue[i],
+						vectLifeCycle[i] < 0 ? size_t(-1) : size_t((vectLifeCycle[i] + 999)/1000));
+			}
+		}
+		else if(!vectFetch.empty())
+			LogError() << "prefetch batch of " << vectFetch.size() << " keys failed";
+
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			if(vectLifeCycle[i] == -2 || vectLifeCycle[i] == -3)
+				continue;
+			std::string strValue;
+			if(RC_FAILED(CCompressCodec::Decode(vectValue[i].data(), vectValue[i].size(), strValue)))
+			{
+				vectLifeCycle[i] = -3;
+				continue;
+			}
+			vectValue[i].swap(strValue);
+			if(vectLifeCycle[i] < 0 || vectLifeCycle[i] > nLocalLifeCycleInMS)
+				vectLifeCycle[i] = nLocalLifeCycleInMS;
+		}
+
+		lock.lock();
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			//a SetItemValue/RemoveItemValue during the fetch removed the key from the in-flight set
+			if(m_setInFlight.erase(vectKey[i]) == 0)
+				continue;
+			//a key not known is left to the direct fetch of GetItemValue.
+			if(vectLifeCycle[i] >= 0)
+				SetLocalValue(vectKey[i], vectValue[i], vectLifeCycle[i]);
+			else if(vectLifeCycle[i] == -2 && m_nAbsentLifeCycleInMS > 0)
+				m_mapLocalAbsent[vectKey[i]] = std::chrono::steady_clock::now()
+						+ std::chrono::milliseconds(m_nAbsentLifeCycleInMS);
+		}
+		m_cvPrefetch.notify_all();
+	}
+}
+
+void CCacheCluster::SetAbsentLifeCycle(int nLifeCycleInMS)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	m_nAbsentLifeCycleInMS = nLifeCycleInMS;
+	if(nLifeCycleInMS <= 0)
+		m_mapLocalAbsent.clear();
+}
+
+bool CCacheCluster::IsKnownAbsent(const std::string& strOwner, const std::string& strKey, bool bUseOwnerFilter)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	auto it = m_mapLocalAbsent.find(strKey);
+	if(it != m_mapLocalAbsent.end())
+	{
+		if(it->second > std::chrono::steady_clock::now())
+			return true;
+		m_mapLocalAbsent.erase(it);
+	}
+	if(!bUseOwnerFilter || m_mapOwnerFilter.empty())
+		return false;
+	auto itFilter = m_mapOwnerFilter.find(strOwner);
+	return itFilter != m_mapOwnerFilter.end() && itFilter->second.bValid
+			&& !itFilter->second.filter.MayContain(strKey);
+}
+
+/*
+ * nGeneration is taken by GetLocalGeneration before the read which found the key absent.
+ */
+void CCacheCluster::SetLocalAbsent(const std::string& strKey, unsigned long long nGeneration)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	if(m_nAbsentLifeCycleInMS <= 0 || LocalGeneration(strKey) != nGeneration)
+		return;
+	m_mapLocalAbsent[strKey] = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_nAbsentLifeCycleInMS);
+}
+
+/*
+ * Called with m_mutexLocal locked.
+ */
+unsigned long long& CCacheCluster::LocalGeneration(const std::string& strKey)
+{
+	return m_nLocalGeneration[std::hash<std::string>()(strKey) % LOCAL_GENERATION_STRIPES];
+}
+
+unsigned long long CCacheCluster::GetLocalGeneration(const std::string& strKey)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	return LocalGeneration(strKey);
+}
+
+CCacheCluster::CLocalInvalidation::CLocalInvalidation(CCacheCluster* pCluster, const std::string& strKey)
+		:m_pCluster(pCluster), m_strKey(strKey)
+{
+}
+
+CCacheCluster::CLocalInvalidation::~CLocalInvalidation()
+{
+	Invalidate();
+}
+
+void CCacheCluster::CLocalInvalidation::Invalidate()
+{
+	if(m_pCluster != nullptr)
+		m_pCluster->RemoveLocalValue(m_strKey);
+	m_pCluster = nullptr;
+}
+
+void CCacheCluster::AddOwnerFilterKey(const std::string& strOwner, const std::string& strKey)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	auto it = m_mapOwnerFilter.find(strOwner);
+	if(it == m_mapOwnerFilter.end())
+		return;
+	it->second.filter.Add(strKey);
+	if(it->second.bSyncing)
+		it->second.vectAddedDuringSync.push_back(strKey);
+}
+
+ResultCode CCacheCluster::EnableOwnerFilter(const std::string& strOwner, int nSyncIntervalInMS)
+{
+	if(nSyncIntervalInMS <= 0)
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	{
+		std::lock_guard<std::mutex> lock(m_mutexLocal);
+		if(m_bStopBackground)
+			LogReturn(RE_NOT_INITIALIZE);
+		m_mapOwnerFilter[strOwner].nSyncIntervalInMS = nSyncIntervalInMS;
+	}
+	redisContext* pServer = nullptr;
+	ResultCode rc = SyncOwnerFilter(pServer, strOwner);
+	if(pServer != nullptr)
+		redisFree(pServer);
+	if(RC_FAILED(rc) || rc == RS_NOT_SUPPORT)
+	{
+		DisableOwnerFilter(strOwner);
+		LogReturn(rc);
+	}
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	if(!m_threadFilterSync.joinable())
+		m_threadFilterSync = std::thread(&CCacheCluster::FilterSyncThread, this);
+	return RS_SUCCESS;
+}
+
+void CCacheCluster::DisableOwnerFilter(const std::string& strOwner)
+{
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	m_mapOwnerFilter.erase(strOwner);
+}
+
+/*
+ * Rebuild the owner's filter from a SCAN of the key space, the keys set locally
+ * during the scan are merged so that they are never reported absent.
+ */
+ResultCode CCacheCluster::SyncOwnerFilter(redisContext*& pServer, const std::string& strOwner)
+{
+	if(!IsRedisBackend())
+	{
+		//the backend can't list its keys, a filter enabled before SetBackend is dropped.
+		DisableOwnerFilter(strOwner);
+		return RS_NOT_SUPPORT;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutexLocal);
+		auto it = m_mapOwnerFilter.find(strOwner);
+		if(it == m_mapOwnerFilter.end())
+			return RE_NOT_EXISTS;
+		it->second.bSyncing = true;
+		it->second.vectAddedDuringSync.clear();
+	}
+	if(pServer == nullptr)
+	{
+		std::string strServerAddr;
+		int nPort = 0, nTimeOutInMS = 0;
+		m_pRedis->GetServer(strServerAddr, nPort, nTimeOutInMS);
+		pServer = CRedisConnection::OpenContext(strServerAddr, nPort, nTimeOutInMS, nTimeOutInMS);
+	}
+
+	std::string strPattern = "*" + SEPERATOR;
+	for(auto c: strOwner)
+	{
+		if(c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')
+			strPattern += '\\';
+		strPattern += c;
+	}
+	ResultCode rc = pServer == nullptr ? RE_COMMUNICATION : RS_SUCCESS;
+	std::vector<std::string> vectKey;
+	std::string strCursor = "0";
+	while(RC_SUCCEEDED(rc))
+	{
+		redisReply* reply = (redisReply*)redisCommand(pServer, "SCAN %s MATCH %s COUNT 1000",
+				strCursor.c_str(), strPattern.c_str());
+		if(reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2
+				|| reply->element[0]->type != REDIS_REPLY_STRING || reply->element[1]->type != REDIS_REPLY_ARRAY)
+		{
+			LogError() << "SCAN failed for owner filter:" << strOwner;
+			freeReplyObject(reply);
+			redisFree(pServer);
+			pServer = nullptr;
+			rc = RE_COMMUNICATION;
+			break;
+		}
+		strCursor.assign(reply->element[0]->str, reply->element[0]->len);
+		for(size_t i = 0; i < reply->element[1]->elements; i++)
+		{
+			redisReply* key = reply->element[1]->element[i];
+			vectKey.push_back(std::string(key->str, key->len));
+		}
+		freeReplyObject(reply);
+		if(strCursor == "0")
+			break;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutexLocal);
+	auto it = m_mapOwnerFilter.find(strOwner);
+	if(it == m_mapOwnerFilter.end())
+		return RE_NOT_EXISTS;
+	OwnerFilter& ownerFilter = it->second;
+	ownerFilter.bSyncing = false;
+	ownerFilter.tpNextSync = std::chrono::steady_clock::now() + std::chrono::milliseconds(ownerFilter.nSyncIntervalInMS);
+	if(RC_FAILED(rc))
+		return rc;
+	CBloomFilter filter(vectKey.size() + ownerFilter.vectAddedDuringSync.size());
+	for(auto& strKey: vectKey)
+		filter.Add(strKey);
+	for(auto& strKey: ownerFilter.vectAddedDuringSync)
+		filter.Add(strKey);
+	ownerFilter.vectAddedDuringSync.clear();
+	ownerFilter.filter = filter;
+	ownerFilter.bValid = true;
+	LogTrace() << "owner filter synced:" << strOwner << ", keys:" << vectKey.size();
+	return RS_SUCCESS;
+}
+
+void CCacheCluster::FilterSyncThread()
+{
+	redisContext* pServer = nullptr;
+	std::unique_lock<std::mutex> lock(m_mutexLocal);
+	while(!m_bStopBackground)
+	{
+		auto tpNow = std::chrono::steady_clock::now();
+		std::string strOwner;
+		for(auto& item: m_mapOwnerFilter)
+		{
+			if(!item.second.bSyncing && item.second.tpNextSync <= tpNow)
+			{
+				strOwner = item.first;
+				break;
+			}
+		}
+		if(strOwner.empty())
+		{
+			m_cvFilterSync.wait_for(lock, std::chrono::milliseconds(100));
+			continue;
+		}
+		lock.unlock();
+		SyncOwnerFilter(pServer, strOwner);
+		lock.lock();
+	}
+	lock.unlock();
+	if(pServer != nullptr)
+		redisFree(pServer);
+}
+
+ResultCode CCacheCluster::IncrementCounter(const std::string& strOwner, const std::string& strItem, long long nDelta,
+		long long& nValue)
+{
+	return IncrementCounter(strOwner, strItem, std::string(), nDelta, nValue);
+}
+
+ResultCode CCacheCluster::IncrementCounter(const std::string& strOwner, const std::string& strItem,
+		const std::string& strField, long long nDelta, long long& nValue)
+{
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strKey = GenerateKey(strOwner, strItem);
+	CLocalInvalidation invalidation(this, strKey);
+	AddOwnerFilterKey(strOwner, strKey);
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pRedis->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
 	redisReply* reply = nullptr;
 	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
+	if(!m_pRedis->IsConnected() && RC_FAILED(m_pRedis->Reconnect()))
+		LogReturn(CCacheDeadline::TimeOutOr(RE_ERROR));
 
-	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
+	//not retried, the lost reply may belong to an applied increment.
+	if(strField.empty())
+		reply = m_pRedis->Command("INCRBY %s %lld", strKey.c_str(), nDelta);
+	else
+		reply = m_pRedis->Command("HINCRBY %s %b %lld", strKey.c_str(), strField.c_str(), strField.size(), nDelta);
+	if(reply == nullptr)
 	{
+		LogError() << "increase counter failed for " << strKey << ":" << strField;
+		m_pRedis->Reconnect();
+		rc = CCacheDeadline::TimeOutOr(RE_COMMUNICATION);
+	}
+	else if(reply->type != REDIS_REPLY_INTEGER)
+	{
+		LogError() << "increase counter failed for " << strKey << ":" << strField << ":"
+				<< (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		rc = RE_INVALIDATE_DATA;
+	}
+	else
+	{
+		nValue = reply->integer;
+		rc = RS_SUCCESS;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CCacheCluster::GetCounter(const std::string& strOwner, const std::string& strItem, long long& nValue)
+{
+	return GetCounter(strOwner, strItem, std::string(), nValue);
+}
+
+ResultCode CCacheCluster::GetCounter(const std::string& strOwner, const std::string& strItem,
+		const std::string& strField, long long& nValue)
+{
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::string strKey = GenerateKey(strOwner, strItem);
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pRedis->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	redisReply* reply = nullptr;
+	ResultCode rc = RE_ERROR;
+	if(!m_pRedis->IsConnected() && RC_FAILED(m_pRedis->Reconnect()))
+		LogReturn(CCacheDeadline::TimeOutOr(RE_ERROR));
 
-		/*1.check whether the data exists*/
-		reply = (redisReply*)redisCommand(this->m_pServer, "EXISTS %s",
-						strKey.c_str());
+	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
+	{
+		if(strField.empty())
+			reply = m_pRedis->Command("GET %s", strKey.c_str());
+		else
+			reply = m_pRedis->Command("HGET %s %b", strKey.c_str(), strField.c_str(), strField.size());
 		if(reply == nullptr)
 		{
-			LogError() << "EXISTS " << strKey << " failed";
-			if(RC_FAILED(Reconnect()))
-				LogReturn(RE_COMMUNICATION);
+			LogError() << "get counter failed for " << strKey << ":" << strField;
+			if(RC_FAILED(m_pRedis->Reconnect()))
+				LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+			rc = RE_ERROR;
 			continue;
 		}
-		if(reply->type != REDIS_REPLY_INTEGER)
+		if(reply->type == REDIS_REPLY_NIL)
 		{
-			freeReplyObject(reply);
-			reply = nullptr;
-			continue;
+			nValue = 0;
+			rc = RS_NOT_EXISTS;
 		}
-		if(reply->integer == 1)
+		else if(reply->type == REDIS_REPLY_STRING)
 		{
-			bExists = true;
+			char* pEnd = nullptr;
+			nValue = strtoll(reply->str, &pEnd, 10);
+			rc = (reply->len > 0 && pEnd == reply->str + reply->len) ? RS_SUCCESS : RE_INVALIDATE_DATA;
 		}
 		else
-		{
-			bExists = false;
-		}
+			rc = RE_INVALIDATE_DATA;
 		freeReplyObject(reply);
 		reply = nullptr;
-		rc = RS_SUCCESS;
+		if(rc == RE_INVALIDATE_DATA)
+			LogReturn(rc);
 	}
-
 	return rc;
 }
 
-ResultCode CCacheCluster::TryLock(const std::string& strOwner, const std::string& strItem, int nLockPeriodInSecond,
-		int nTimeoutInMS)
+ResultCode CCacheCluster::AddCounter(const std::string& strOwner, const std::string& strItem, long long nDelta,
+		const std::string& strField)
 {
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
 	std::string strKey = GenerateKey(strOwner, strItem);
-	std::string strKeyLock = strKey + SEPERATOR + "Lock";
-	redisReply* reply = nullptr;
-	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
-	std::chrono::time_point<std::chrono::system_clock> currentTime = std::chrono::system_clock::now();
-	auto nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
-	auto nStart = nCurrent;
-	do
 	{
-		for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
+		std::lock_guard<std::mutex> lock(m_mutexCounter);
+		if(m_threadCounterFlush.joinable())
 		{
+			m_mapCounterDelta[std::make_pair(strKey, strField)] += nDelta;
+			return RS_SUCCESS;
+		}
+	}
+	long long nValue = 0;
+	return IncrementCounter(strOwner, strItem, strField, nDelta, nValue);
+}
 
-			/*2. not exists, create the lock*/
-			std::lock_guard<std::mutex> lock(m_mutex);
-			std::string strKeyLock = strKey + SEPERATOR + "Lock";
-			reply = (redisReply*)redisCommand(this->m_pServer, "SETNX %s %b",
-							strKeyLock.c_str(), strKeyLock.c_str(), 1);
-			if(reply == nullptr)
-			{
-				LogError() << "Lock failed:" << strKeyLock;
-				if(RC_FAILED(Reconnect()))
-					LogReturn(RE_COMMUNICATION);
-				continue;
-			}
-			if (!(reply->type == REDIS_REPLY_INTEGER && reply->integer == 1))
-			{
-				if(reply->type == REDIS_REPLY_INTEGER && reply->integer == 0)
-				{
-					auto reply2= (redisReply*)redisCommand(this->m_pServer, "TTL %s",
-							strKeyLock.c_str());
-					if(reply2->type == REDIS_REPLY_INTEGER && reply2->integer == -1 )
-					{
-						LogException() << "Lock without expire, reset expire:" << strKeyLock;
-						auto reply3 = (redisReply*)redisCommand(this->m_pServer, "Expire %s %d",
-													strKeyLock.c_str(), nLockPeriodInSecond);
-						freeReplyObject(reply3);
-					}
-					freeReplyObject(reply2);
-					rc = RE_BUSY;
-				}
-				else
-					rc = RE_ERROR;
-				freeReplyObject(reply);
-				reply = nullptr;
-				LogError() << "Lock failed:" << strKeyLock;
-				if(rc == RE_BUSY)
-					break;
-				continue;
-			}
-			rc = RE_ERROR;
-			for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
-			{
-				if(nLockPeriodInSecond <= 0)
-				{
-					rc = RS_SUCCESS;
-					break;
-				}
-				reply = (redisReply*)redisCommand(this->m_pServer, "Expire %s %d",
-								strKeyLock.c_str(), nLockPeriodInSecond);
-
-				if(reply == nullptr)
-				{
-					LogError() << "Lock failed:" << strKeyLock;
-					if(RC_FAILED(Reconnect()))
-						LogReturn(RE_COMMUNICATION);
-					continue;
-				}
-				if (!(reply->type == REDIS_REPLY_INTEGER && reply->integer == 1))
-				{
-					rc = RE_ERROR;
-					freeReplyObject(reply);
-					reply = nullptr;
-					LogError() << "Lock failed:" << strKeyLock;
-					if(rc == RE_BUSY)
-						break;
-					continue;
-				}
-				else break;
-			}
+void CCacheCluster::EnableCounterAggregation(int nFlushIntervalInMS)
+{
+	std::thread threadFlush;
+	{
+		std::lock_guard<std::mutex> lock(m_mutexCounter);
+		m_nCounterFlushIntervalInMS = nFlushIntervalInMS;
+		if(nFlushIntervalInMS > 0)
+		{
+			if(!m_threadCounterFlush.joinable() && !m_bStopCounterFlush)
+				m_threadCounterFlush = std::thread(&CCacheCluster::CounterFlushThread, this);
+			m_cvCounterFlush.notify_all();
+			return;
+		}
+		threadFlush.swap(m_threadCounterFlush);
+		m_cvCounterFlush.notify_all();
+	}
+	//the thread flushes the remaining deltas before it exits.
+	if(threadFlush.joinable())
+		threadFlush.join();
+}
 
-			rc = RS_SUCCESS;
-			freeReplyObject(reply);
-			reply = nullptr;
-			return rc;
+ResultCode CCacheCluster::FlushCounters()
+{
+	redisContext* pServer = nullptr;
+	ResultCode rc = FlushCounterDelta(pServer);
+	if(pServer != nullptr)
+		redisFree(pServer);
+	return rc;
+}
 
+/*
+ * Send the merged deltas in one pipeline. The deltas are put back when the connection
+ * could not be made, but not after a broken pipeline, since some of them may have
+ * been applied already, a counter is never increased twice by a retry.
+ */
+ResultCode CCacheCluster::FlushCounterDelta(redisContext*& pServer)
+{
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	std::map<std::pair<std::string, std::string>, long long> mapDelta;
+	{
+		std::lock_guard<std::mutex> lock(m_mutexCounter);
+		mapDelta.swap(m_mapCounterDelta);
+	}
+	if(mapDelta.empty())
+		return RS_SUCCESS;
+	if(pServer == nullptr)
+	{
+		std::string strServerAddr;
+		int nPort = 0, nTimeOutInMS = 0;
+		m_pRedis->GetServer(strServerAddr, nPort, nTimeOutInMS);
+		pServer = CRedisConnection::OpenContext(strServerAddr, nPort, nTimeOutInMS, nTimeOutInMS);
+	}
+	if(pServer == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(m_mutexCounter);
+		for(auto& item: mapDelta)
+			m_mapCounterDelta[item.first] += item.second;
+		LogReturn(RE_COMMUNICATION);
+	}
+
+	size_t nCount = 0;
+	for(auto& item: mapDelta)
+	{
+		if(item.second == 0)
+			continue;
+		if(item.first.second.empty())
+			redisAppendCommand(pServer, "INCRBY %s %lld", item.first.first.c_str(), item.second);
+		else
+			redisAppendCommand(pServer, "HINCRBY %s %b %lld", item.first.first.c_str(),
+					item.first.second.c_str(), item.first.second.size(), item.second);
+		nCount++;
+	}
+	ResultCode rc = RS_SUCCESS;
+	for(size_t i = 0; i < nCount; i++)
+	{
+		redisReply* reply = nullptr;
+		if(redisGetReply(pServer, (void**)&reply) != REDIS_OK)
+		{
+			LogError() << "flush counters failed, " << nCount - i << " deltas are in doubt:" << pServer->errstr;
+			redisFree(pServer);
+			pServer = nullptr;
+			LogReturn(RE_COMMUNICATION);
 		}
-		if(nTimeoutInMS != 0)
-			std::this_thread::sleep_for(std::chrono::milliseconds(200));
-		currentTime = std::chrono::system_clock::now();
-		nCurrent = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime.time_since_epoch()).count();
+		if(reply == nullptr || reply->type != REDIS_REPLY_INTEGER)
+		{
+			LogError() << "flush counter failed:" << (reply && reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+			rc = RE_INVALIDATE_DATA;
+		}
+		freeReplyObject(reply);
 	}
-	while(nCurrent - nStart	<= nTimeoutInMS);
-	return RE_TIME_OUT;
+	return rc;
+}
+
+void CCacheCluster::CounterFlushThread()
+{
+	redisContext* pServer = nullptr;
+	std::unique_lock<std::mutex> lock(m_mutexCounter);
+	//a disabled thread is detached from m_threadCounterFlush, it exits after the last flush.
+	while(!m_bStopCounterFlush && m_threadCounterFlush.get_id() == std::this_thread::get_id())
+	{
+		m_cvCounterFlush.wait_for(lock, std::chrono::milliseconds(m_nCounterFlushIntervalInMS));
+		lock.unlock();
+		FlushCounterDelta(pServer);
+		lock.lock();
+	}
+	lock.unlock();
+	FlushCounterDelta(pServer);
+	if(pServer != nullptr)
+		redisFree(pServer);
+}
+
+/*
+ * KEYS[1]: the bucket, ARGV: rate per second, burst, min count, max count.
+ * The bucket is refilled by the server time, so the clocks of the clients don't matter.
+ * Return {acquired count, wait in ms until min count is available}.
+ */
+static const char* TOKEN_BUCKET_SCRIPT =
+		"if redis.replicate_commands then redis.replicate_commands() end\n"
+		"local rate = tonumber(ARGV[1]) / 1000\n"
+		"local burst = tonumber(ARGV[2])\n"
+		"local nmin = tonumber(ARGV[3])\n"
+		"local nmax = tonumber(ARGV[4])\n"
+		"local t = redis.call('TIME')\n"
+		"local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000)\n"
+		"local b = redis.call('HMGET', KEYS[1], 'tokens', 'ts')\n"
+		"local tokens = tonumber(b[1]) or burst\n"
+		"local ts = tonumber(b[2]) or now\n"
+		"if now > ts then tokens = math.min(burst, tokens + (now - ts) * rate) end\n"
+		"local n = 0\n"
+		"local wait = 0\n"
+		"if tokens >= nmin then\n"
+		"  n = math.min(nmax, math.floor(tokens))\n"
+		"  tokens = tokens - n\n"
+		"else\n"
+		"  wait = math.ceil((nmin - tokens) / rate)\n"
+		"end\n"
+		"redis.call('HMSET', KEYS[1], 'tokens', tostring(tokens), 'ts', tostring(now))\n"
+		"redis.call('PEXPIRE', KEYS[1], math.ceil(burst / rate) + 1000)\n"
+		"return {n, wait}\n";
+
+ResultCode CCacheCluster::TryAcquireTokens(const std::string& strOwner, const std::string& strItem, double dRatePerSecond,
+		long long nBurst, long long nMinCount, long long nMaxCount, long long& nAcquired, long long& nWaitInMS)
+{
+	if(dRatePerSecond <= 0 || nMinCount <= 0 || nMaxCount < nMinCount || nMinCount > nBurst)
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::string strKey = GenerateKey(strOwner, strItem) + SEPERATOR + "TokenBucket";
+	std::string strRate = std::to_string(dRatePerSecond);
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pRedis->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	redisReply* reply = nullptr;
+	ResultCode rc = RE_ERROR;
+	if(!m_pRedis->IsConnected() && RC_FAILED(m_pRedis->Reconnect()))
+		LogReturn(CCacheDeadline::TimeOutOr(RE_ERROR));
 
+	//not retried, the lost reply may belong to taken tokens.
+	std::vector<std::string> vectArg{"1", strKey, strRate, std::to_string(nBurst), std::to_string(nMinCount),
+			std::to_string(nMaxCount)};
+	reply = m_pRedis->EvalScript(TOKEN_BUCKET_SCRIPT, m_strTokenScriptSha, vectArg);
+	if(reply == nullptr)
+	{
+		LogError() << "acquire tokens failed for " << strKey;
+		//a script refused before it was sent keeps the connection, see CRedisConnection::Reconnect.
+		m_pRedis->Reconnect();
+		rc = CCacheDeadline::TimeOutOr(RE_COMMUNICATION);
+	}
+	else if(reply->type != REDIS_REPLY_ARRAY || reply->elements != 2
+			|| reply->element[0]->type != REDIS_REPLY_INTEGER || reply->element[1]->type != REDIS_REPLY_INTEGER)
+	{
+		LogError() << "acquire tokens failed for " << strKey << ":"
+				<< (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		rc = RE_UNEXPECT;
+	}
+	else
+	{
+		nAcquired = reply->element[0]->integer;
+		nWaitInMS = reply->element[1]->integer;
+		rc = nAcquired > 0 ? RS_SUCCESS : RE_BUSY;
+	}
+	freeReplyObject(reply);
 	return rc;
 }
 
-ResultCode CCacheCluster::Unlock(const std::string& strOwner, const std::string& strItem)
+ResultCode CCacheCluster::AcquireTokens(const std::string& strOwner, const std::string& strItem, double dRatePerSecond,
+		long long nBurst, long long nMinCount, long long nMaxCount, long long& nAcquired, int nTimeOutInMS)
+{
+	//0 tries once, the attempt has the budget of a single call.
+	CDeadlineScope scope(nTimeOutInMS == 0 ? m_nDefaultTimeOutInMS : nTimeOutInMS);
+	while(true)
+	{
+		long long nWaitInMS = 0;
+		ResultCode rc = TryAcquireTokens(strOwner, strItem, dRatePerSecond, nBurst, nMinCount, nMaxCount,
+				nAcquired, nWaitInMS);
+		if(rc != RE_BUSY)
+			return rc;
+		if(nTimeOutInMS == 0)
+			return RE_TIME_OUT;
+		//sleep exactly until the tokens are refilled, a shorter budget fails now.
+		if(CCacheDeadline::GetRemainingMS(nWaitInMS) < nWaitInMS)
+			return RE_TIME_OUT;
+		std::this_thread::sleep_for(std::chrono::milliseconds(nWaitInMS));
+	}
+}
+
+/*
+ * KEYS[1]: the value, KEYS[2]: the version, ARGV: expected version, value, life cycle in second.
+ * Return {1, new version} when set, {0, current version} on conflict.
+ */
+static const char* COMPARE_AND_SET_SCRIPT =
+		"local v = tonumber(redis.call('GET', KEYS[2]) or 0)\n"
+		"if v ~= tonumber(ARGV[1]) then return {0, v} end\n"
+		"local ttl = tonumber(ARGV[3])\n"
+		"if ttl > 0 then redis.call('SET', KEYS[1], ARGV[2], 'EX', ttl) else redis.call('SET', KEYS[1], ARGV[2]) end\n"
+		"v = redis.call('INCR', KEYS[2])\n"
+		"if ttl > 0 then redis.call('EXPIRE', KEYS[2], ttl) else redis.call('PERSIST', KEYS[2]) end\n"
+		"return {1, v}\n";
+
+ResultCode CCacheCluster::GetItemValue(const std::string& strOwner, const std::string& strItem, std::string& strValue,
+		long long& nVersion)
 {
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
 	std::string strKey = GenerateKey(strOwner, strItem);
-	std::string strKeyLock = strKey + SEPERATOR + "Lock";
-	std::lock_guard<std::mutex> lock(m_mutex);
+	std::string strKeyVersion = strKey + SEPERATOR + "Version";
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pRedis->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
 	redisReply* reply = nullptr;
 	ResultCode rc = RE_ERROR;
-	if(m_pServer == nullptr && RC_FAILED(Reconnect()))
-		LogReturn(RE_ERROR);
+	if(!m_pRedis->IsConnected() && RC_FAILED(m_pRedis->Reconnect()))
+		LogReturn(CCacheDeadline::TimeOutOr(RE_ERROR));
 
 	for(int retry = 0; retry <= RETRY_COUNT && RC_FAILED(rc); retry++)
 	{
-
-		reply = (redisReply*)redisCommand(this->m_pServer, "DEL %s",
-				strKeyLock.c_str());
-
-		if ( reply ==nullptr || reply->type != REDIS_REPLY_INTEGER || reply->integer != 1)
+		reply = m_pRedis->Command("MGET %s %s", strKey.c_str(), strKeyVersion.c_str());
+		if(reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
 		{
-			if(reply && reply->type == REDIS_REPLY_INTEGER &&  reply->integer == 0)
-				rc = RS_NOT_EXISTS;
-			else
-				rc = RE_ERROR;
-			LogTrace2() << "Failed to execute command:" << "DEL " << strKeyLock;
+			LogError() << "Failed to execute command:" << "MGET " << strKey << " " << strKeyVersion;
 			freeReplyObject(reply);
-			if(RC_FAILED(Reconnect()))
-				LogReturn(RE_COMMUNICATION);
 			reply = nullptr;
-
+			if(RC_FAILED(m_pRedis->Reconnect()))
+				LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+			rc = RE_ERROR;
 			continue;
 		}
-		rc = RS_SUCCESS;
+		redisReply* replyValue = reply->element[0];
+		redisReply* replyVersion = reply->element[1];
+		nVersion = replyVersion->type == REDIS_REPLY_STRING ? strtoll(replyVersion->str, nullptr, 10) : 0;
+		if(replyValue->type == REDIS_REPLY_STRING)
+		{
+			rc = CCompressCodec::Decode(replyValue->str, replyValue->len, strValue);
+			LogErrorCode(rc);
+		}
+		else
+			rc = RE_NOT_EXISTS;
+		freeReplyObject(reply);
+		reply = nullptr;
+		break;
 	}
+	return rc;
+}
+
+ResultCode CCacheCluster::CompareAndSetItemValue(const std::string& strOwner, const std::string& strItem,
+		long long& nVersion, const std::string& strOrigValue, size_t nLifeCycleInSecond)
+{
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::string strValue;
+	ResultCode rcEncode = CCompressCodec::Encode(strOrigValue, strValue);
+	if(RC_FAILED(rcEncode))
+		LogReturn(rcEncode);
+	std::string strKey = GenerateKey(strOwner, strItem);
+	std::string strKeyVersion = strKey + SEPERATOR + "Version";
+	long long nLifeCycle = nLifeCycleInSecond == size_t(-1) ? -1 : (long long)nLifeCycleInSecond;
+	CLocalInvalidation invalidation(this, strKey);
+	AddOwnerFilterKey(strOwner, strKey);
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pRedis->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	redisReply* reply = nullptr;
+	ResultCode rc = RE_ERROR;
+	if(!m_pRedis->IsConnected() && RC_FAILED(m_pRedis->Reconnect()))
+		LogReturn(CCacheDeadline::TimeOutOr(RE_ERROR));
 
+	//not retried, the lost reply may belong to an applied update.
+	reply = m_pRedis->Command("EVAL %s 2 %s %s %lld %b %lld", COMPARE_AND_SET_SCRIPT, strKey.c_str(), strKeyVersion.c_str(),
+			nVersion, strValue.c_str(), strValue.size(), nLifeCycle);
+	if(reply == nullptr)
+	{
+		LogError() << "compare and set failed for " << strKey;
+		m_pRedis->Reconnect();
+		rc = CCacheDeadline::TimeOutOr(RE_COMMUNICATION);
+	}
+	else if(reply->type != REDIS_REPLY_ARRAY || reply->elements != 2
+			|| reply->element[0]->type != REDIS_REPLY_INTEGER || reply->element[1]->type != REDIS_REPLY_INTEGER)
+	{
+		LogError() << "compare and set failed for " << strKey << ":"
+				<< (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		rc = RE_UNEXPECT;
+	}
+	else
+	{
+		rc = reply->element[0]->integer == 1 ? RS_SUCCESS : RE_BUSY;
+		nVersion = reply->element[1]->integer;
+	}
 	freeReplyObject(reply);
+
+	if(RC_SUCCEEDED(rc))
+		PutHostTierValue(strKey, strValue, nLifeCycleInSecond);
+	else
+		RemoveHostTierValue(strKey);
 	return rc;
 }
 
-bool CCacheCluster::IsLocalCacheAvail(const std::string& strOwner, const std::string& strItem) const
+ResultCode CCacheCluster::UpdateItemValue(const std::string& strOwner, const std::string& strItem,
+		const std::function<ResultCode(std::string& strValue, bool bExists)>& fnUpdate, size_t nLifeCycleInSecond,
+		int nMaxRetry)
 {
-	auto it = m_mapLocalCacheAvail.find(GenerateKey(strOwner, strItem));
-	if(it != m_mapLocalCacheAvail.end())
-		return it->second;
-	return false;
+	if(!IsRedisBackend())
+		return RS_NOT_SUPPORT;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	static thread_local std::minstd_rand s_random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	ResultCode rc = RE_BUSY;
+	for(int retry = 0; retry <= nMaxRetry && rc == RE_BUSY; retry++)
+	{
+		if(retry > 0)
+		{
+			//a short randomized backoff, the conflicting updater is only one round trip ahead.
+			int nBackoffInMS = int(s_random() % (1u << std::min(retry, 5)));
+			if(nBackoffInMS > 0 && !CCacheDeadline::SleepBeforeDeadline(nBackoffInMS))
+				return RE_TIME_OUT;
+		}
+		std::string strValue;
+		long long nVersion = 0;
+		rc = GetItemValue(strOwner, strItem, strValue, nVersion);
+		if(rc == RS_NOT_SUPPORT)
+			return rc;
+		if(RC_FAILED(rc) && rc != RE_NOT_EXISTS)
+			LogReturn(rc);
+		bool bExists = rc != RE_NOT_EXISTS;
+		if(!bExists)
+			strValue.clear();
+		rc = fnUpdate(strValue, bExists);
+		if(RC_FAILED(rc))
+			return rc;
+		rc = CompareAndSetItemValue(strOwner, strItem, nVersion, strValue, nLifeCycleInSecond);
+	}
+	return rc;
 }
 
-void CCacheCluster::SetLocalCacheAvail(const std::string& strOwner, const std::string& strItem)
+ResultCode CCacheCluster::WaitForAll(const std::vector<ItemKey>& vectKey, int nTimeOutInMS, std::vector<bool>& vectReady)
 {
-	m_mapLocalCacheAvail.insert(std::make_pair(GenerateKey(strOwner, strItem), true));
+	return WaitForItemValues(vectKey, vectKey.size(), nTimeOutInMS, vectReady);
+}
+
+ResultCode CCacheCluster::WaitForAny(const std::vector<ItemKey>& vectKey, int nTimeOutInMS, std::vector<bool>& vectReady)
+{
+	if(vectKey.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	return WaitForItemValues(vectKey, 1, nTimeOutInMS, vectReady);
+}
+
+/*
+ * One pipelined EXISTS batch per round for the keys not ready yet, the rounds share
+ * a backoff from 10ms to 200ms, so the latency doesn't grow with the key count.
+ */
+ResultCode CCacheCluster::WaitForItemValues(const std::vector<ItemKey>& vectKey, size_t nMinReady, int nTimeOutInMS,
+		std::vector<bool>& vectReady)
+{
+	//0 checks once, the batch has the budget of a single call.
+	CDeadlineScope scope(nTimeOutInMS == 0 ? m_nDefaultTimeOutInMS : nTimeOutInMS);
+	vectReady.assign(vectKey.size(), false);
+	std::vector<size_t> vectPending;
+	for(size_t i = 0; i < vectKey.size(); i++)
+		vectPending.push_back(i);
+	size_t nReady = 0;
+	int nIntervalInMS = 10;
+	std::vector<std::string> vectPendingKey;
+	std::vector<bool> vectExists;
+	while(nReady < nMinReady)
+	{
+		vectPendingKey.clear();
+		for(auto i: vectPending)
+			vectPendingKey.push_back(GenerateKey(vectKey[i].first, vectKey[i].second));
+		ResultCode rc = ExistsOnServer(vectPendingKey, vectExists);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		size_t nPending = 0;
+		for(size_t j = 0; j < vectPending.size(); j++)
+		{
+			if(vectExists[j])
+			{
+				vectReady[vectPending[j]] = true;
+				nReady++;
+			}
+			else
+				vectPending[nPending++] = vectPending[j];
+		}
+		vectPending.resize(nPending);
+		if(nReady >= nMinReady)
+			break;
+		if(nTimeOutInMS == 0 || !CCacheDeadline::SleepBeforeDeadline(nIntervalInMS))
+			return RE_TIME_OUT;
+		nIntervalInMS = std::min(nIntervalInMS * 2, 200);
+	}
+	return RS_SUCCESS;
+}
+
+ResultCode CCacheCluster::ExistsOnServer(const std::vector<std::string>& vectKey, std::vector<bool>& vectExists)
+{
+	vectExists.assign(vectKey.size(), false);
+	if(vectKey.empty())
+		return RS_SUCCESS;
+	if(CCacheDeadline::GetRemainingMS(1) <= 0)
+		LogReturn(RE_TIME_OUT);
+	ResultCode rc = boost::atomic_load(&m_pBackend)->MultiExists(vectKey, vectExists);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	return RS_SUCCESS;
+}
+
+static std::string GenerateLockToken()
+{
+	static thread_local std::mt19937_64 s_random(std::random_device{}());
+	char szToken[40];
+	snprintf(szToken, sizeof(szToken), "%016llx%016llx", (unsigned long long)s_random(), (unsigned long long)s_random());
+	return szToken;
+}
+
+ResultCode CCacheCluster::TryLock(const std::vector<ItemKey>& vectKey, int nLockPeriodInSecond, int nTimeoutInMS,
+		ItemKey* pBlockingKey)
+{
+	if(vectKey.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	//0 tries once, the attempt has the budget of a single call.
+	CDeadlineScope scope(nTimeoutInMS == 0 ? m_nDefaultTimeOutInMS : nTimeoutInMS);
+	//the canonical order, the same lock set is always reported blocked by the same key.
+	std::vector<std::pair<std::string, size_t>> vectLock;
+	for(size_t i = 0; i < vectKey.size(); i++)
+		vectLock.push_back(std::make_pair(GenerateKey(vectKey[i].first, vectKey[i].second) + SEPERATOR + "Lock", i));
+	std::sort(vectLock.begin(), vectLock.end());
+	vectLock.erase(std::unique(vectLock.begin(), vectLock.end(),
+			[](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b){return a.first == b.first;}),
+			vectLock.end());
+
+	std::vector<std::string> vectLockKey;
+	for(auto& lock: vectLock)
+		vectLockKey.push_back(lock.first);
+
+	//a lock holding the token of the caller is taken as its own, so a retried request is harmless.
+	std::string strToken = GenerateLockToken();
+	int nIntervalInMS = 10;
+	while(true)
+	{
+		size_t nBlocking = 0;
+		ResultCode rc = boost::atomic_load(&m_pBackend)->MultiSetNX(vectLockKey, strToken,
+				nLockPeriodInSecond <= 0 ? size_t(-1) : size_t(nLockPeriodInSecond), nBlocking);
+		if(RC_SUCCEEDED(rc))
+			return RS_SUCCESS;
+		if(rc != RE_BUSY)
+			LogReturn(rc);
+		if(pBlockingKey != nullptr && nBlocking < vectLock.size())
+			*pBlockingKey = vectKey[vectLock[nBlocking].second];
+		if(nTimeoutInMS == 0 || !CCacheDeadline::SleepBeforeDeadline(nIntervalInMS))
+			return RE_TIME_OUT;
+		nIntervalInMS = std::min(nIntervalInMS * 2, 200);
+	}
+}
+
+ResultCode CCacheCluster::Unlock(const std::vector<ItemKey>& vectKey)
+{
+	if(vectKey.empty())
+		return RS_SUCCESS;
+	CDeadlineScope scope(m_nDefaultTimeOutInMS);
+	std::vector<std::string> vectLockKey;
+	for(auto& key: vectKey)
+		vectLockKey.push_back(GenerateKey(key.first, key.second) + SEPERATOR + "Lock");
+	std::sort(vectLockKey.begin(), vectLockKey.end());
+	vectLockKey.erase(std::unique(vectLockKey.begin(), vectLockKey.end()), vectLockKey.end());
+	size_t nDeleted = 0;
+	ResultCode rc = boost::atomic_load(&m_pBackend)->MultiDelete(vectLockKey, nDeleted);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	return nDeleted == vectLockKey.size() ? RS_SUCCESS : RS_NOT_EXISTS;
 }
@@ -2,9 +2,25 @@
 #ifndef CCACHECLUSTER_H
 #define CCACHECLUSTER_H
 #include "ResultCode.h"
+#include "CacheDiskStore.h"
+#include "CacheShmStore.h"
+#include "CacheDeadline.h"
+#include "RedisCacheBackend.h"
+#include "HotKeySampler.h"
+#include "BloomFilter.h"
 #include <hiredis/hiredis.h>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
 #include <boost/shared_ptr.hpp>
 
 
@@ -12,6 +28,14 @@
 class CCacheCluster
 {
 public:
+	typedef std::pair<std::string, std::string> ItemKey;	//(owner, item)
+
+
+	/**
+	 * Deadline of the calling thread for the CCacheCluster calls inside the scope, see CCacheDeadline.
+	 */
+	typedef CCacheDeadline CDeadlineScope;
+
 	// Constructors/Destructors
 	//  
 
@@ -82,10 +106,36 @@ public:
 	bool IsLocalCacheAvail(const std::string& strOwner, const std::string& strItem) const;
 	void SetLocalCacheAvail(const std::string& strOwner, const std::string& strItem);
 
+	/**
+	 * @param  nTimeoutInMS 0 means try once.
+	 */
 	ResultCode TryLock(const std::string& strOwner, const std::string& strItem, int nLockPeriodInSecond, int nTimeoutInMS);
 	ResultCode Unlock(const std::string& strOwner, const std::string& strItem);
 
 
+	/**
+	 * Lock all the items in one atomic server side step, or none of them. The lock keys are the same
+	 * as TryLock's, so the single and the multi-key locks exclude each other.
+	 * @return ResultCode
+	 * 		RE_TIME_OUT: some item is locked by others until the time out.
+	 * @param  vectKey
+	 * @param  nLockPeriodInSecond
+	 * @param  nTimeoutInMS 0 means try once, -1 means not limited.
+	 * @param  pBlockingKey [out] the item which blocked the last attempt.
+	 */
+	ResultCode TryLock(const std::vector<ItemKey>& vectKey, int nLockPeriodInSecond, int nTimeoutInMS,
+			ItemKey* pBlockingKey = nullptr);
+
+
+	/**
+	 * Release all the items in one round trip.
+	 * @return ResultCode
+	 * 		RS_NOT_EXISTS: some lock is already released or expired.
+	 * @param  vectKey
+	 */
+	ResultCode Unlock(const std::vector<ItemKey>& vectKey);
+
+
 	/**
 	 * @return ResultCode
 	 * @param  strOwner
@@ -96,24 +146,422 @@ public:
 			int nTimeOutInMS);
 
 
+	/**
+	 * Wait until all (WaitForAll) or any (WaitForAny) of the items exist, under one deadline.
+	 * The pending items are checked by one pipelined batch per poll.
+	 * @return ResultCode
+	 * 		RE_TIME_OUT: not satisfied within the time out, vectReady tells the ready ones.
+	 * @param  vectKey
+	 * @param  nTimeOutInMS -1 means not limited.
+	 * @param  vectReady [out] the items exist, in the order of vectKey.
+	 */
+	ResultCode WaitForAll(const std::vector<ItemKey>& vectKey, int nTimeOutInMS, std::vector<bool>& vectReady);
+	ResultCode WaitForAny(const std::vector<ItemKey>& vectKey, int nTimeOutInMS, std::vector<bool>& vectReady);
+
+
 	ResultCode Exists(const std::string& strOwner, const std::string& strItem, bool& bExists);
 
 	void ResetLocalCache()
 	{
 		this->m_mapLocalCacheAvail.clear();
+		std::lock_guard<std::mutex> lock(m_mutexLocal);
+		this->m_mapLocalValue.clear();
+		this->m_mapLocalAbsent.clear();
 	}
 
 
+	/**
+	 * Fetch the items into the local cache by background pipelined batches, return immediately.
+	 * A later GetItemValue on an in-flight item waits for the prefetch instead of issuing
+	 * a duplicate request, at most the connect time out, each batch is bounded by the connect
+	 * time out too.
+	 * @return ResultCode
+	 * @param  vectKey
+	 */
+	ResultCode Prefetch(const std::vector<ItemKey>& vectKey);
+
+
+	/**
+	 * Prefetch the items and wait until all of them are fetched.
+	 * @return ResultCode
+	 * 		RS_SUCCESS: all fetched, the non-exists items are not cached.
+	 * 		RE_TIME_OUT: some items are still in flight.
+	 * @param  vectKey
+	 * @param  nTimeOutInMS -1 means wait until finished.
+	 */
+	ResultCode WarmUp(const std::vector<ItemKey>& vectKey, int nTimeOutInMS = -1);
+
+
+	/**
+	 * @param  nBatchSize keys per pipelined batch.
+	 * @param  nMaxConcurrency count of the prefetch connections, only take effect before the first Prefetch.
+	 * @param  nLocalLifeCycleInMS how long a prefetched value stays in the local cache, bounded by the server TTL.
+	 */
+	void SetPrefetchOption(size_t nBatchSize, size_t nMaxConcurrency, int nLocalLifeCycleInMS);
+
+
+	/**
+	 * The hot keys of the recent GetItemValue calls, they are pinned in the local cache
+	 * for a short life cycle.
+	 * @param  vectHotKey [out] (key, estimated recent accesses) ordered by accesses desc.
+	 */
+	void GetHotKeys(std::vector<std::pair<std::string, size_t>>& vectHotKey);
+
+
+	/**
+	 * @param  nTopK count of the tracked hot key candidates.
+	 * @param  dHotRatio a key is hot when it takes at least this share of the recent accesses.
+	 * @param  nLocalLifeCycleInMS life cycle of the pinned local copy, capped at the remaining TTL of
+	 * 		the server copy, 0 means not pinned.
+	 */
+	void SetHotKeyOption(size_t nTopK, double dHotRatio, int nLocalLifeCycleInMS);
+
+
+	/**
+	 * The keys found absent on the server are remembered for a short life cycle, GetItemValue
+	 * and Exists answer them locally, a local SetItemValue clears the entry.
+	 * @param  nLifeCycleInMS 0 means disabled.
+	 */
+	void SetAbsentLifeCycle(int nLifeCycleInMS);
+
+
+	/**
+	 * Keep a bloom filter of the existing keys of the owner, synced from the server periodically
+	 * (by SCAN, which walks the whole key space), GetItemValue and Exists answer "definitely absent"
+	 * locally for the owner's keys. The keys written by this client are added at once, a key created
+	 * by another client is not visible until the next sync, so the filter suits the owners written
+	 * through this client or loaded once. WaitForItemValue and TryGetProduceRight do not consult it.
+	 * @return ResultCode
+	 * @param  strOwner
+	 * @param  nSyncIntervalInMS each sync scans the whole key space, keep it in minutes.
+	 */
+	ResultCode EnableOwnerFilter(const std::string& strOwner, int nSyncIntervalInMS = 5*60*1000);
+	void DisableOwnerFilter(const std::string& strOwner);
+
+
+	/**
+	 * Enable the persistent on-disk L2 tier, GetItemValue checks it before going to the server,
+	 * and the values fetched from the server are kept with their remaining TTL, at most the
+	 * SetHostTierMaxLifeCycle limit. A write from another host is not seen here until the copy
+	 * expires, so a value without TTL on the server may be stale for up to that limit.
+	 * @return ResultCode
+	 * 		RE_BUSY: the directory is used by another process or cluster, each needs its own.
+	 * @param  strDirPath the directory of the segment files, the content survives restarts.
+	 * @param  nMaxSizeInMB the disk budget.
+	 */
+	ResultCode EnableDiskCache(const std::string& strDirPath, size_t nMaxSizeInMB);
+	void DisableDiskCache();
+
+
+	/**
+	 * Enable the host tier shared by the worker processes of the host, checked before the disk
+	 * tier and the server, filled the same way as the disk tier and stale the same way, bounded
+	 * by SetHostTierMaxLifeCycle. The processes with the same name share the values.
+	 * @return ResultCode
+	 * @param  strName the POSIX shared memory name.
+	 * @param  nMaxSizeInMB the size of the value arena.
+	 * @param  nMaxKeyCount
+	 */
+	ResultCode EnableSharedMemoryCache(const std::string& strName, size_t nMaxSizeInMB, size_t nMaxKeyCount);
+	void DisableSharedMemoryCache();
+
+
+	/**
+	 * The longest a value stays in the disk and shared memory tiers, a value without TTL on the
+	 * server or with a longer TTL is fetched again after it. 600 seconds by default.
+	 * @param  nMaxLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	void SetHostTierMaxLifeCycle(size_t nMaxLifeCycleInSecond);
+
+
+	/**
+	 * Keep the item values and the locks in the backend instead of the Redis server of
+	 * ConnectCacheServer, e.g. a CMemoryCacheBackend for the single box runs without network.
+	 * The item values, Exists, WaitForItemValue/WaitForAll/WaitForAny, Prefetch/WarmUp,
+	 * TryGetProduceRight and the single and multi-key TryLock/Unlock always go through ICacheBackend,
+	 * the Redis server is the default CRedisCacheBackend, with the same local and host tiers and
+	 * deadlines on every backend. The multi-key TryLock is atomic as far as the backend's MultiSetNX is.
+	 * The calls that need Redis commands beyond ICacheBackend return RS_NOT_SUPPORT and change nothing
+	 * while another backend is set: the counters, the token buckets, the versioned values,
+	 * CompareAndSetItemValue/UpdateItemValue and EnableOwnerFilter. The local copies and the owner
+	 * filters of the old store are dropped.
+	 * @param  pBackend null goes back to the Redis server.
+	 */
+	void SetBackend(const boost::shared_ptr<ICacheBackend>& pBackend);
+
+
+	/**
+	 * The budget of each GetItemValue/SetItemValue/RemoveItemValue/Exists/TryGetProduceRight/Unlock
+	 * call, an enclosing CDeadlineScope can only shorten it. TryLock and WaitForItemValue are bounded by
+	 * their own time out and the enclosing scope.
+	 * @param  nTimeOutInMS -1 means not limited.
+	 */
+	void SetDefaultTimeOut(int nTimeOutInMS);
+
+
+	/**
+	 * Each calling thread lazily opens its own connection, the commands of different threads
+	 * take no lock on the connection. Suits a fixed pool of worker threads, every thread costs
+	 * one server connection, closed when the thread exits or the cluster is destroyed.
+	 * ConnectCacheServer reaches every thread connection, each reconnects on its next use.
+	 * Call before the cluster is shared by the threads.
+	 * @param  bEnable
+	 */
+	void EnableThreadConnection(bool bEnable);
+
+
+	/**
+	 * All the threads share one connection, the requests of different threads are queued and
+	 * written in coalesced batches, so they are pipelined without any change of the callers.
+	 * Takes precedence over EnableThreadConnection. Call before the cluster is shared by the threads.
+	 * @return ResultCode
+	 * @param  bEnable
+	 * @param  nMaxBatchSize max requests written in one batch.
+	 */
+	ResultCode EnableMultiplexedConnection(bool bEnable, size_t nMaxBatchSize = 1024);
+
+
+	/**
+	 * Atomic INCRBY of a counter, or HINCRBY of a field of a counter hash. The counters are kept as
+	 * plain integers, read them by GetCounter, not by GetItemValue.
+	 * @return ResultCode
+	 * 		RE_INVALIDATE_DATA: the existing value is not an integer.
+	 * 		RE_COMMUNICATION: not retried, the increment may or may not be applied.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  strField empty means the plain counter.
+	 * @param  nDelta
+	 * @param  nValue [out] the value after the increment.
+	 */
+	ResultCode IncrementCounter(const std::string& strOwner, const std::string& strItem, long long nDelta,
+			long long& nValue);
+	ResultCode IncrementCounter(const std::string& strOwner, const std::string& strItem,
+			const std::string& strField, long long nDelta, long long& nValue);
+
+
+	/**
+	 * @return ResultCode
+	 * 		RS_NOT_EXISTS: the counter is not created yet, nValue is 0.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  strField empty means the plain counter.
+	 * @param  nValue [out]
+	 */
+	ResultCode GetCounter(const std::string& strOwner, const std::string& strItem, long long& nValue);
+	ResultCode GetCounter(const std::string& strOwner, const std::string& strItem,
+			const std::string& strField, long long& nValue);
+
+
+	/**
+	 * Increase a counter without waiting for the result. With the aggregation enabled, the deltas of
+	 * the same counter are merged locally and flushed periodically in one pipeline, otherwise the same
+	 * as IncrementCounter.
+	 * @return ResultCode
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  nDelta
+	 * @param  strField empty means the plain counter.
+	 */
+	ResultCode AddCounter(const std::string& strOwner, const std::string& strItem, long long nDelta,
+			const std::string& strField = std::string());
+
+
+	/**
+	 * The aggregated deltas are visible to GetCounter after the flush. A delta may be lost
+	 * when the connection breaks in the middle of a flush, it is never applied twice.
+	 * @param  nFlushIntervalInMS 0 means disabled, the pending deltas are flushed.
+	 */
+	void EnableCounterAggregation(int nFlushIntervalInMS);
+
+
+	/**
+	 * Flush the aggregated deltas now.
+	 * @return ResultCode
+	 */
+	ResultCode FlushCounters();
+
+
+	/**
+	 * Token bucket rate limiter shared by all the clients, refilled at dRatePerSecond up to nBurst tokens,
+	 * updated atomically by a server side script. Take nMaxCount tokens at most, when at least nMinCount are
+	 * available, the extra ones can be spent locally (see CLocalTokenBucket).
+	 * @return ResultCode
+	 * 		RS_SUCCESS: nAcquired tokens are taken.
+	 * 		RE_BUSY: no token taken, nWaitInMS is the time until nMinCount tokens are available.
+	 * 		RE_COMMUNICATION: not retried, the tokens may or may not be taken.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  dRatePerSecond
+	 * @param  nBurst capacity of the bucket, a new bucket is full.
+	 * @param  nMinCount
+	 * @param  nMaxCount
+	 * @param  nAcquired [out]
+	 * @param  nWaitInMS [out]
+	 */
+	ResultCode TryAcquireTokens(const std::string& strOwner, const std::string& strItem, double dRatePerSecond,
+			long long nBurst, long long nMinCount, long long nMaxCount, long long& nAcquired, long long& nWaitInMS);
+
+
+	/**
+	 * TryAcquireTokens, sleep the returned wait time and retry until acquired.
+	 * @return ResultCode
+	 * 		RE_TIME_OUT: the tokens are not available within the time out.
+	 * @param  nTimeOutInMS 0 means try once, -1 means wait until acquired.
+	 */
+	ResultCode AcquireTokens(const std::string& strOwner, const std::string& strItem, double dRatePerSecond,
+			long long nBurst, long long nMinCount, long long nMaxCount, long long& nAcquired, int nTimeOutInMS = -1);
+
+
+	/**
+	 * Get the value with its version, read from the server directly, the local tiers are bypassed.
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: the value doesn't exist, nVersion is still returned.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  strValue [out]
+	 * @param  nVersion [out] 0 means never set by CompareAndSetItemValue.
+	 */
+	ResultCode GetItemValue (const std::string& strOwner, const std::string& strItem,
+			std::string& strValue, long long& nVersion);
+
+
+	/**
+	 * Set the value only when its version is still nVersion, atomically on the server, the version is
+	 * increased on success. The version is kept in the key "<item>_<owner>_Version" and is only maintained
+	 * by CompareAndSetItemValue and UpdateItemValue, SetItemValue doesn't change it.
+	 * @return ResultCode
+	 * 		RS_SUCCESS: set, nVersion is the new version.
+	 * 		RE_BUSY: the version changed, nVersion is the current version.
+	 * 		RE_COMMUNICATION: not retried, the value may or may not be set.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  nVersion [in/out]
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond applied to the value and the version.
+	 */
+	ResultCode CompareAndSetItemValue (const std::string& strOwner, const std::string& strItem,
+			long long& nVersion, const std::string& strValue, size_t nLifeCycleInSecond = size_t(-1));
+
+
+	/**
+	 * Read-modify-write without a lock, the versioned value is read, modified by fnUpdate and written back
+	 * by CompareAndSetItemValue, retried with a short backoff when another updater wins.
+	 * @return ResultCode
+	 * 		RE_BUSY: still conflicted after nMaxRetry retries.
+	 * 		the failure of fnUpdate, which cancels the update.
+	 * @param  strOwner
+	 * @param  strItem
+	 * @param  fnUpdate modify strValue in place, bExists is false for a new value, may be called more than once.
+	 * @param  nLifeCycleInSecond
+	 * @param  nMaxRetry
+	 */
+	ResultCode UpdateItemValue (const std::string& strOwner, const std::string& strItem,
+			const std::function<ResultCode(std::string& strValue, bool bExists)>& fnUpdate,
+			size_t nLifeCycleInSecond = size_t(-1), int nMaxRetry = 16);
+
+
 protected:
-	std::string GenerateKey(const std::string& strOwner, const std::string& strItem) const;
-	ResultCode Reconnect();
+	struct LocalValue
+	{
+		std::string strValue;
+		std::chrono::steady_clock::time_point tpExpire;
+	};
 
-	redisContext* m_pServer = nullptr;
-	std::string m_strServerAddress;
-	int m_nServerPort = 6379;
-	int m_nConnectTimeOutInMS = 1000;
+	std::string GenerateKey(const std::string& strOwner, const std::string& strItem) const;
+	bool IsRedisBackend();
+	struct OwnerFilter
+	{
+		CBloomFilter filter;
+		bool bValid = false;
+		bool bSyncing = false;
+		int nSyncIntervalInMS = 5*60*1000;
+		std::chrono::steady_clock::time_point tpNextSync;
+		std::vector<std::string> vectAddedDuringSync;
+	};
+
+	std::string m_strTokenScriptSha;	//guarded by m_pRedis
+	ResultCode ExistsOnServer(const std::string& strOwner, const std::string& strItem, bool& bExists);
+	ResultCode ExistsOnServer(const std::vector<std::string>& vectKey, std::vector<bool>& vectExists);
+	ResultCode WaitForItemValues(const std::vector<ItemKey>& vectKey, size_t nMinReady, int nTimeOutInMS,
+			std::vector<bool>& vectReady);
+	bool GetLocalValue(const std::string& strOwner, const std::string& strKey, std::string& strValue, bool& bAbsent);
+	void SetLocalValue(const std::string& strKey, const std::string& strValue, long long nLifeCycleInMS);
+	void RemoveLocalValue(const std::string& strKey);
+	bool IsKnownAbsent(const std::string& strOwner, const std::string& strKey, bool bUseOwnerFilter);
+	void SetLocalAbsent(const std::string& strKey, unsigned long long nGeneration);
+	unsigned long long& LocalGeneration(const std::string& strKey);
+	unsigned long long GetLocalGeneration(const std::string& strKey);
+
+	/*
+	 * Drop the local copies of the key when the write returns, after the server has the new value,
+	 * so a read racing the write can't cache the old value again.
+	 */
+	class CLocalInvalidation
+	{
+	public:
+		CLocalInvalidation(CCacheCluster* pCluster, const std::string& strKey);
+		~CLocalInvalidation();
+		void Invalidate();
+	protected:
+		CCacheCluster* m_pCluster;
+		std::string m_strKey;
+	};
+	bool GetHostTierValue(const std::string& strKey, std::string& strValue, bool& bEnabled);
+	void PutHostTierValue(const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond);
+	void RemoveHostTierValue(const std::string& strKey);
+	void AddOwnerFilterKey(const std::string& strOwner, const std::string& strKey);
+	ResultCode SyncOwnerFilter(redisContext*& pServer, const std::string& strOwner);
+	void PrefetchThread();
+	void FilterSyncThread();
+	ResultCode FlushCounterDelta(redisContext*& pServer);
+	void CounterFlushThread();
+	void StopBackground();
+
+	//the connection of ConnectCacheServer, shared by the default backend and the Redis only features
+	boost::shared_ptr<CRedisConnection> m_pRedis;
+	boost::shared_ptr<CRedisCacheBackend> m_pRedisBackend;
+
+	int m_nDefaultTimeOutInMS = -1;
 	std::unordered_map<std::string, bool> m_mapLocalCacheAvail;
-	std::mutex m_mutex;
+	boost::shared_ptr<CCacheDiskStore> m_pDiskStore;	//accessed by boost::atomic_load/atomic_store
+	boost::shared_ptr<CCacheShmStore> m_pShmStore;	//accessed by boost::atomic_load/atomic_store
+	std::atomic<size_t> m_nHostTierMaxLifeCycleInSecond{600};
+	boost::shared_ptr<ICacheBackend> m_pBackend;	//never null, accessed by boost::atomic_load/atomic_store
+
+	//local values fetched by Prefetch, guarded by m_mutexLocal
+	std::unordered_map<std::string, LocalValue> m_mapLocalValue;
+	std::unordered_set<std::string> m_setInFlight;
+	std::deque<std::string> m_deqPrefetch;
+	std::vector<std::thread> m_vectPrefetchThread;
+	size_t m_nPrefetchBatchSize = 100;
+	size_t m_nPrefetchConcurrency = 4;
+	int m_nLocalLifeCycleInMS = 60*1000;
+	bool m_bStopBackground = false;
+	std::mutex m_mutexLocal;
+	std::condition_variable m_cvPrefetchQueue;
+	std::condition_variable m_cvPrefetch;
+
+	//negative lookups, guarded by m_mutexLocal
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> m_mapLocalAbsent;
+	int m_nAbsentLifeCycleInMS = 100;
+	//bumped by each local invalidation of the keys of the stripe, a local fill of a read started
+	//before is dropped.
+	static const size_t LOCAL_GENERATION_STRIPES = 256;
+	unsigned long long m_nLocalGeneration[LOCAL_GENERATION_STRIPES] = {};
+	std::unordered_map<std::string, OwnerFilter> m_mapOwnerFilter;
+	std::thread m_threadFilterSync;
+	std::condition_variable m_cvFilterSync;
+
+	//aggregated counter deltas of (key, field), guarded by m_mutexCounter
+	std::map<std::pair<std::string, std::string>, long long> m_mapCounterDelta;
+	int m_nCounterFlushIntervalInMS = 0;
+	bool m_bStopCounterFlush = false;
+	std::thread m_threadCounterFlush;
+	std::mutex m_mutexCounter;
+	std::condition_variable m_cvCounterFlush;
+
+	CHotKeySampler m_hotKeySampler;
+	int m_nHotKeyLifeCycleInMS = 500;
 
 
 };
@@ -151,6 +599,92 @@ protected:
 	ResultCode m_rc;
 
 
+};
+
+class CMultiLockGuard
+{
+public:
+	CMultiLockGuard(boost::shared_ptr<CCacheCluster> pCacheCluster,
+			const std::vector<CCacheCluster::ItemKey>& vectKey,
+			int nLockPeriodInSecond, int nTimeoutInMS):m_pCacheCluster(pCacheCluster), m_vectKey(vectKey)
+{
+		if(pCacheCluster == nullptr)
+		{
+			m_rc = Stock::RS_NOT_SUPPORT;
+			return;
+		}
+		m_rc = pCacheCluster->TryLock(vectKey, nLockPeriodInSecond, nTimeoutInMS, &m_blockingKey);
+}
+	~CMultiLockGuard()
+	{
+		if(RC_SUCCEEDED(m_rc))
+		{
+			if(m_pCacheCluster)
+				m_pCacheCluster->Unlock(m_vectKey);
+		}
+
+	}
+	ResultCode Result(){return m_rc;};
+	const CCacheCluster::ItemKey& BlockingKey(){return m_blockingKey;};
+protected:
+	boost::shared_ptr<CCacheCluster> m_pCacheCluster;
+	std::vector<CCacheCluster::ItemKey> m_vectKey;
+	CCacheCluster::ItemKey m_blockingKey;
+	ResultCode m_rc;
+
+
+};
+
+
+/**
+ * class CLocalTokenBucket
+ * Spend the tokens of a CCacheCluster token bucket locally, a batch of up to nBatchSize tokens is
+ * taken in one round trip when the local ones run out. The unspent tokens are forfeited when the
+ * object is destroyed. Not thread safe, one object per thread.
+ */
+class CLocalTokenBucket
+{
+public:
+	CLocalTokenBucket(boost::shared_ptr<CCacheCluster> pCacheCluster,
+			const std::string& strOwner, const std::string& strItem,
+			double dRatePerSecond, long long nBurst, long long nBatchSize):m_pCacheCluster(pCacheCluster),
+			m_strOwner(strOwner), m_strItem(strItem), m_dRatePerSecond(dRatePerSecond), m_nBurst(nBurst),
+			m_nBatchSize(std::max(1LL, std::min(nBatchSize, nBurst)))
+	{
+	}
+
+	/**
+	 * @return ResultCode
+	 * @param  nTimeOutInMS 0 means take a local token or try the bucket once, -1 means wait until acquired.
+	 */
+	ResultCode Acquire(int nTimeOutInMS = -1)
+	{
+		if(m_nToken > 0)
+		{
+			m_nToken--;
+			return Stock::RS_SUCCESS;
+		}
+		if(m_pCacheCluster == nullptr)
+			return Stock::RS_NOT_SUPPORT;
+		long long nAcquired = 0;
+		ResultCode rc = m_pCacheCluster->AcquireTokens(m_strOwner, m_strItem, m_dRatePerSecond, m_nBurst,
+				1, m_nBatchSize, nAcquired, nTimeOutInMS);
+		if(RC_FAILED(rc) || rc == Stock::RS_NOT_SUPPORT)
+			return rc;
+		m_nToken = nAcquired - 1;
+		return Stock::RS_SUCCESS;
+	}
+	long long GetLocalTokenCount() const {return m_nToken;};
+protected:
+	boost::shared_ptr<CCacheCluster> m_pCacheCluster;
+	std::string m_strOwner;
+	std::string m_strItem;
+	double m_dRatePerSecond;
+	long long m_nBurst;
+	long long m_nBatchSize;
+	long long m_nToken = 0;
+
+
 };
 
 #endif // CCACHECLUSTER_H
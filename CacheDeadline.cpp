@@ -0,0 +1,55 @@
+#include "CacheDeadline.h"
+#include <algorithm>
+#include <thread>
+using namespace Stock;
+
+// Constructors/Destructors
+//
+
+CCacheDeadline::CCacheDeadline(int nTimeOutInMS):m_tpOuter(Deadline())
+{
+	if(nTimeOutInMS < 0)
+		return;
+	auto tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeOutInMS);
+	if(tpDeadline < m_tpOuter)
+		Deadline() = tpDeadline;
+}
+
+CCacheDeadline::~CCacheDeadline()
+{
+	Deadline() = m_tpOuter;
+}
+
+//
+// Methods
+//
+
+std::chrono::steady_clock::time_point& CCacheDeadline::Deadline()
+{
+	static thread_local std::chrono::steady_clock::time_point s_tpDeadline = std::chrono::steady_clock::time_point::max();
+	return s_tpDeadline;
+}
+
+long long CCacheDeadline::GetRemainingMS(long long nMaxInMS)
+{
+	auto tpDeadline = Deadline();
+	if(tpDeadline == std::chrono::steady_clock::time_point::max())
+		return nMaxInMS;
+	long long nRemainingInMS = std::chrono::duration_cast<std::chrono::milliseconds>(
+			tpDeadline - std::chrono::steady_clock::now()).count();
+	return std::min(nRemainingInMS, nMaxInMS);
+}
+
+ResultCode CCacheDeadline::TimeOutOr(ResultCode rc)
+{
+	return GetRemainingMS(1) <= 0 ? RE_TIME_OUT : rc;
+}
+
+bool CCacheDeadline::SleepBeforeDeadline(int nIntervalInMS)
+{
+	long long nSleepInMS = GetRemainingMS(nIntervalInMS);
+	if(nSleepInMS <= 0)
+		return false;
+	std::this_thread::sleep_for(std::chrono::milliseconds(nSleepInMS));
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef CCACHEDEADLINE_H
+#define CCACHEDEADLINE_H
+#include "ResultCode.h"
+#include <chrono>
+
+/**
+ * class CCacheDeadline
+ * Deadline of the calling thread for the cache calls inside the scope, shared by CCacheCluster,
+ * its backends and the Redis connections. Command I/O, retries, reconnects, lock waits and polling
+ * are bounded by it, and the call returns RE_TIME_OUT when it is exceeded. A nested scope never
+ * extends the outer deadline.
+ */
+class CCacheDeadline
+{
+public:
+	/**
+	 * @param  nTimeOutInMS -1 means keep the outer deadline.
+	 */
+	explicit CCacheDeadline(int nTimeOutInMS);
+	~CCacheDeadline();
+
+
+	/**
+	 * @return the deadline of the calling thread, time_point::max() means not limited.
+	 */
+	static std::chrono::steady_clock::time_point& Deadline();
+
+
+	/**
+	 * @return the time left before the deadline, at most nMaxInMS.
+	 */
+	static long long GetRemainingMS(long long nMaxInMS);
+
+
+	/**
+	 * @return RE_TIME_OUT when the deadline is passed, otherwise rc.
+	 */
+	static ResultCode TimeOutOr(ResultCode rc);
+
+
+	/**
+	 * @return false when the deadline is passed, nothing is slept then.
+	 */
+	static bool SleepBeforeDeadline(int nIntervalInMS);
+
+
+protected:
+	std::chrono::steady_clock::time_point m_tpOuter;
+
+
+};
+
+#endif // CCACHEDEADLINE_H
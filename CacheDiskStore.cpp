@@ -0,0 +1,483 @@
+#include "CacheDiskStore.h"
+#include "Log.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+using namespace Stock;
+
+static const uint32_t RECORD_MAGIC = 0x4B534443;	//"CDSK"
+static const uint32_t RECORD_FLAG_REMOVED = 0x01;
+static const std::string SEGMENT_PREFIX = "segment.";
+static const std::string SEGMENT_SUFFIX = ".dat";
+static const std::string LOCK_FILE = "LOCK";
+
+// Constructors/Destructors
+//
+
+CCacheDiskStore::CCacheDiskStore ()
+{
+}
+
+CCacheDiskStore::~CCacheDiskStore ()
+{
+	Close();
+}
+
+//
+// Methods
+//
+
+ResultCode CCacheDiskStore::Open (const std::string& strDirPath, size_t nMaxSizeInMB, size_t nSegmentSizeInMB)
+{
+	if(strDirPath.empty() || nSegmentSizeInMB == 0 || nMaxSizeInMB < nSegmentSizeInMB * 2)
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	Close();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_strDirPath = strDirPath;
+	m_nMaxSize = nMaxSizeInMB * 1024 * 1024;
+	m_nSegmentSize = nSegmentSizeInMB * 1024 * 1024;
+
+	//create the directory chain
+	for(size_t pos = strDirPath.find('/', 1); ; pos = strDirPath.find('/', pos + 1))
+	{
+		std::string strPath = strDirPath.substr(0, pos);
+		if(mkdir(strPath.c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			LogError() << "create directory failed:" << strPath << "," << strerror(errno);
+			return RE_ERROR;
+		}
+		if(pos == std::string::npos)
+			break;
+	}
+	ResultCode rc = LockDir();
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+
+	DIR* pDir = opendir(strDirPath.c_str());
+	if(pDir == nullptr)
+	{
+		LogError() << "open directory failed:" << strDirPath << "," << strerror(errno);
+		UnlockDir();
+		return RE_ERROR;
+	}
+	std::vector<size_t> vectId;
+	for(dirent* pEntry = readdir(pDir); pEntry != nullptr; pEntry = readdir(pDir))
+	{
+		std::string strName = pEntry->d_name;
+		if(strName.size() <= SEGMENT_PREFIX.size() + SEGMENT_SUFFIX.size()
+				|| strName.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) != 0
+				|| strName.compare(strName.size() - SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX) != 0)
+			continue;
+		vectId.push_back(strtoull(strName.c_str() + SEGMENT_PREFIX.size(), nullptr, 10));
+	}
+	closedir(pDir);
+	std::sort(vectId.begin(), vectId.end());
+
+	//replay the segments from the oldest to the newest, the later record wins.
+	for(auto nId: vectId)
+	{
+		if(RC_FAILED(OpenSegment(nId, false)))
+			continue;
+		ScanSegment(m_mapSegment[nId]);
+	}
+	if(m_mapSegment.empty())
+	{
+		rc = OpenSegment(1, true);
+		if(RC_FAILED(rc))
+		{
+			UnlockDir();
+			LogReturn(rc);
+		}
+	}
+	m_nActiveSegment = m_mapSegment.rbegin()->first;
+	m_bOpen = true;
+	m_bStop = false;
+	LogDebug() << "disk cache opened:" << strDirPath << ", segments:" << m_mapSegment.size()
+			<< ", keys:" << m_mapIndex.size();
+	lock.unlock();
+
+	m_threadCompaction = std::thread(&CCacheDiskStore::CompactionThread, this);
+	return RS_SUCCESS;
+}
+
+void CCacheDiskStore::Close ()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStop = true;
+		m_cvCompaction.notify_all();
+	}
+	if(m_threadCompaction.joinable())
+		m_threadCompaction.join();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(auto& item: m_mapSegment)
+		CloseSegment(item.second, false);
+	m_mapSegment.clear();
+	m_mapIndex.clear();
+	m_bOpen = false;
+	UnlockDir();
+}
+
+/*
+ * Called with m_mutex locked. The flock belongs to the open file, a second store of the same
+ * process is refused as well, the lock is dropped with the process if it dies.
+ */
+ResultCode CCacheDiskStore::LockDir()
+{
+	std::string strPath = m_strDirPath + "/" + LOCK_FILE;
+	int nFd = open(strPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(nFd < 0)
+	{
+		LogError() << "open lock file failed:" << strPath << "," << strerror(errno);
+		return RE_ERROR;
+	}
+	if(flock(nFd, LOCK_EX | LOCK_NB) != 0)
+	{
+		int nError = errno;
+		close(nFd);
+		if(nError == EWOULDBLOCK)
+		{
+			LogError() << "disk cache is opened by another store:" << m_strDirPath;
+			return RE_BUSY;
+		}
+		LogError() << "lock failed:" << strPath << "," << strerror(nError);
+		return RE_ERROR;
+	}
+	m_nLockFd = nFd;
+	return RS_SUCCESS;
+}
+
+void CCacheDiskStore::UnlockDir()
+{
+	if(m_nLockFd < 0)
+		return;
+	close(m_nLockFd);	//releases the flock
+	m_nLockFd = -1;
+}
+
+ResultCode CCacheDiskStore::Get (const std::string& strKey, std::string& strValue)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_bOpen)
+		return RE_NOT_INITIALIZE;
+	auto it = m_mapIndex.find(strKey);
+	if(it == m_mapIndex.end())
+		return RE_NOT_EXISTS;
+	const Location& location = it->second;
+	if(location.nExpireAt != 0 && location.nExpireAt <= Now())
+	{
+		DropLocation(location);
+		m_mapIndex.erase(it);
+		return RE_NOT_EXISTS;
+	}
+	const Segment& segment = m_mapSegment[location.nSegmentId];
+	strValue.assign(segment.pData + location.nOffset + sizeof(RecordHeader) + location.nKeyLen,
+			location.nValueLen);
+	return RS_SUCCESS;
+}
+
+ResultCode CCacheDiskStore::Put (const std::string& strKey, const std::string& strValue,
+		size_t nLifeCycleInSecond)
+{
+	int64_t nExpireAt = 0;
+	if(nLifeCycleInSecond != size_t(-1))
+	{
+		if(nLifeCycleInSecond == 0)
+			return Remove(strKey);
+		nExpireAt = Now() + nLifeCycleInSecond;
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_bOpen)
+		return RE_NOT_INITIALIZE;
+	Location location;
+	ResultCode rc = AppendRecord(strKey, strValue.data(), strValue.size(), nExpireAt, 0, location);
+	if(RC_FAILED(rc))
+		return rc;
+	auto it = m_mapIndex.find(strKey);
+	if(it != m_mapIndex.end())
+	{
+		DropLocation(it->second);
+		it->second = location;
+	}
+	else
+		m_mapIndex.insert(std::make_pair(strKey, location));
+	m_mapSegment[location.nSegmentId].nLiveBytes += RecordSize(location.nKeyLen, location.nValueLen);
+	return RS_SUCCESS;
+}
+
+ResultCode CCacheDiskStore::Remove (const std::string& strKey)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_bOpen)
+		return RE_NOT_INITIALIZE;
+	auto it = m_mapIndex.find(strKey);
+	if(it == m_mapIndex.end())
+		return RE_NOT_EXISTS;
+	DropLocation(it->second);
+	m_mapIndex.erase(it);
+	//write a tombstone so that the older record will not be restored on recovery.
+	Location location;
+	return AppendRecord(strKey, nullptr, 0, 0, RECORD_FLAG_REMOVED, location);
+}
+
+ResultCode CCacheDiskStore::Compact ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_bOpen)
+		return RE_NOT_INITIALIZE;
+	return CompactOldest();
+}
+
+size_t CCacheDiskStore::GetDiskSize ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t nSize = 0;
+	for(auto& item: m_mapSegment)
+		nSize += item.second.nSize;
+	return nSize;
+}
+
+size_t CCacheDiskStore::GetKeyCount ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_mapIndex.size();
+}
+
+size_t CCacheDiskStore::RecordSize(size_t nKeyLen, size_t nValueLen)
+{
+	return (sizeof(RecordHeader) + nKeyLen + nValueLen + 7) & ~size_t(7);
+}
+
+int64_t CCacheDiskStore::Now()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string CCacheDiskStore::GetSegmentPath(size_t nId) const
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%010zu", nId);
+	return m_strDirPath + "/" + SEGMENT_PREFIX + buffer + SEGMENT_SUFFIX;
+}
+
+ResultCode CCacheDiskStore::OpenSegment(size_t nId, bool bCreate)
+{
+	Segment segment;
+	segment.nId = nId;
+	segment.strPath = GetSegmentPath(nId);
+	segment.nFd = open(segment.strPath.c_str(), bCreate ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0644);
+	if(segment.nFd < 0)
+	{
+		LogError() << "open segment failed:" << segment.strPath << "," << strerror(errno);
+		return RE_ERROR;
+	}
+	struct stat st;
+	if(bCreate)
+	{
+		if(ftruncate(segment.nFd, m_nSegmentSize) != 0)
+		{
+			LogError() << "allocate segment failed:" << segment.strPath << "," << strerror(errno);
+			CloseSegment(segment, true);
+			return RE_OUT_OF_RESOURCE;
+		}
+		segment.nSize = m_nSegmentSize;
+	}
+	else
+	{
+		if(fstat(segment.nFd, &st) != 0 || st.st_size < (off_t)sizeof(RecordHeader))
+		{
+			LogError() << "invalid segment, removed:" << segment.strPath;
+			CloseSegment(segment, true);
+			return RE_INVALIDATE_DATA;
+		}
+		segment.nSize = st.st_size;
+	}
+	void* pData = mmap(nullptr, segment.nSize, PROT_READ | PROT_WRITE, MAP_SHARED, segment.nFd, 0);
+	if(pData == MAP_FAILED)
+	{
+		LogError() << "mmap segment failed:" << segment.strPath << "," << strerror(errno);
+		CloseSegment(segment, false);
+		return RE_OUT_OF_RESOURCE;
+	}
+	segment.pData = (char*)pData;
+	m_mapSegment[nId] = segment;
+	return RS_SUCCESS;
+}
+
+void CCacheDiskStore::CloseSegment(Segment& segment, bool bUnlink)
+{
+	if(segment.pData != nullptr)
+		munmap(segment.pData, segment.nSize);
+	segment.pData = nullptr;
+	if(segment.nFd >= 0)
+		close(segment.nFd);
+	segment.nFd = -1;
+	if(bUnlink)
+		unlink(segment.strPath.c_str());
+}
+
+void CCacheDiskStore::ScanSegment(Segment& segment)
+{
+	int64_t nNow = Now();
+	size_t nPos = 0;
+	while(nPos + sizeof(RecordHeader) <= segment.nSize)
+	{
+		RecordHeader header;
+		memcpy(&header, segment.pData + nPos, sizeof(header));
+		if(header.nMagic != RECORD_MAGIC)
+			break;
+		size_t nRecordSize = RecordSize(header.nKeyLen, header.nValueLen);
+		if(nPos + nRecordSize > segment.nSize)
+			break;
+		std::string strKey(segment.pData + nPos + sizeof(RecordHeader), header.nKeyLen);
+		auto it = m_mapIndex.find(strKey);
+		if(it != m_mapIndex.end())
+		{
+			DropLocation(it->second);
+			m_mapIndex.erase(it);
+		}
+		if(!(header.nFlags & RECORD_FLAG_REMOVED) && (header.nExpireAt == 0 || header.nExpireAt > nNow))
+		{
+			Location location = {segment.nId, nPos, header.nKeyLen, header.nValueLen, header.nExpireAt};
+			m_mapIndex.insert(std::make_pair(strKey, location));
+			segment.nLiveBytes += nRecordSize;
+		}
+		nPos += nRecordSize;
+	}
+	segment.nWritePos = nPos;
+}
+
+ResultCode CCacheDiskStore::AppendRecord(const std::string& strKey, const char* pValue, size_t nValueLen,
+		int64_t nExpireAt, uint32_t nFlags, Location& location)
+{
+	size_t nRecordSize = RecordSize(strKey.size(), nValueLen);
+	if(nRecordSize > m_nSegmentSize)
+		return RE_INVALIDATE_PARAMETER;
+	Segment* pSegment = &m_mapSegment[m_nActiveSegment];
+	if(pSegment->nWritePos + nRecordSize > pSegment->nSize)
+	{
+		ResultCode rc = OpenSegment(m_nActiveSegment + 1, true);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		m_nActiveSegment++;
+		pSegment = &m_mapSegment[m_nActiveSegment];
+		m_cvCompaction.notify_all();
+	}
+
+	char* pRecord = pSegment->pData + pSegment->nWritePos;
+	RecordHeader header = {0, (uint32_t)strKey.size(), (uint32_t)nValueLen, nFlags, nExpireAt};
+	memcpy(pRecord + sizeof(RecordHeader), strKey.data(), strKey.size());
+	if(nValueLen != 0)
+		memcpy(pRecord + sizeof(RecordHeader) + strKey.size(), pValue, nValueLen);
+	memcpy(pRecord, &header, sizeof(header));
+	//publish the magic last, so that a torn record is never replayed.
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(pRecord, &RECORD_MAGIC, sizeof(RECORD_MAGIC));
+
+	location.nSegmentId = pSegment->nId;
+	location.nOffset = pSegment->nWritePos;
+	location.nKeyLen = header.nKeyLen;
+	location.nValueLen = header.nValueLen;
+	location.nExpireAt = nExpireAt;
+	pSegment->nWritePos += nRecordSize;
+	return RS_SUCCESS;
+}
+
+void CCacheDiskStore::DropLocation(const Location& location)
+{
+	auto it = m_mapSegment.find(location.nSegmentId);
+	if(it == m_mapSegment.end())
+		return;
+	size_t nRecordSize = RecordSize(location.nKeyLen, location.nValueLen);
+	it->second.nLiveBytes -= std::min(it->second.nLiveBytes, nRecordSize);
+}
+
+bool CCacheDiskStore::NeedCompaction() const
+{
+	if(m_mapSegment.size() < 2)
+		return false;
+	const Segment& oldest = m_mapSegment.begin()->second;
+	if(oldest.nLiveBytes * 2 < oldest.nWritePos)
+		return true;
+	return m_mapSegment.size() * m_nSegmentSize > m_nMaxSize;
+}
+
+/*
+ * Only the oldest segment is compacted, so the tombstones in it never guard an
+ * older record and can be dropped safely.
+ * If the oldest segment is mostly dead, its live records are rewritten to the active
+ * segment, otherwise(over budget) the whole segment is evicted.
+ */
+ResultCode CCacheDiskStore::CompactOldest()
+{
+	if(!NeedCompaction())
+		return RS_NOT_EXISTS;
+	Segment& oldest = m_mapSegment.begin()->second;
+	size_t nOldestId = oldest.nId;
+	bool bRewrite = oldest.nLiveBytes * 2 < oldest.nWritePos;
+	int64_t nNow = Now();
+	size_t nMoved = 0, nEvicted = 0;
+
+	for(auto it = m_mapIndex.begin(); it != m_mapIndex.end();)
+	{
+		Location& location = it->second;
+		if(location.nSegmentId != nOldestId)
+		{
+			++it;
+			continue;
+		}
+		if(bRewrite && (location.nExpireAt == 0 || location.nExpireAt > nNow))
+		{
+			Segment& segment = m_mapSegment[nOldestId];
+			const char* pValue = segment.pData + location.nOffset + sizeof(RecordHeader) + location.nKeyLen;
+			Location newLocation;
+			if(RC_SUCCEEDED(AppendRecord(it->first, pValue, location.nValueLen, location.nExpireAt, 0, newLocation)))
+			{
+				location = newLocation;
+				m_mapSegment[newLocation.nSegmentId].nLiveBytes += RecordSize(newLocation.nKeyLen, newLocation.nValueLen);
+				nMoved++;
+				++it;
+				continue;
+			}
+		}
+		it = m_mapIndex.erase(it);
+		nEvicted++;
+	}
+
+	CloseSegment(m_mapSegment[nOldestId], true);
+	m_mapSegment.erase(nOldestId);
+	LogDebug() << "disk cache segment compacted:" << nOldestId << ", moved:" << nMoved << ", evicted:" << nEvicted;
+	return RS_SUCCESS;
+}
+
+void CCacheDiskStore::CompactionThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_bStop)
+	{
+		if(NeedCompaction())
+		{
+			CompactOldest();
+			//give the readers a chance between two segments.
+			lock.unlock();
+			std::this_thread::yield();
+			lock.lock();
+			continue;
+		}
+		m_cvCompaction.wait_for(lock, std::chrono::seconds(10));
+	}
+}
@@ -0,0 +1,179 @@
+
+#ifndef CCACHEDISKSTORE_H
+#define CCACHEDISKSTORE_H
+#include "ResultCode.h"
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <string>
+
+/**
+ * class CCacheDiskStore
+ * Persistent L2 tier for CCacheCluster.
+ *
+ * Values are appended to fixed size segment files which are mapped into memory,
+ * an in-memory index(rebuilt by scanning the segments on Open) points to the latest
+ * record of each key, so reads are served at page cache speed and survive restarts.
+ * The store keeps the value bytes as they are given, CCacheCluster stores the already
+ * compressed redis value.
+ *
+ * Segment file layout: a sequence of records, each record is
+ * 		RecordHeader | key | value | padding to 8 bytes
+ * the header's magic is written last, so a partially written record is ignored on recovery.
+ *
+ * One store per directory: the index lives in the memory of the opening process, Open takes an
+ * exclusive flock on the LOCK file of the directory, held until Close.
+ */
+class CCacheDiskStore
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * Empty Constructor
+	 */
+	CCacheDiskStore ();
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CCacheDiskStore ();
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_BUSY: the directory is opened by another store, in this or another process.
+	 * @param  strDirPath the directory for the segment files, created if not exists.
+	 * @param  nMaxSizeInMB the disk budget, the oldest segments are compacted/evicted when exceeded.
+	 * @param  nSegmentSizeInMB size of each segment file.
+	 */
+	ResultCode Open (const std::string& strDirPath, size_t nMaxSizeInMB, size_t nSegmentSizeInMB = 64);
+
+
+	void Close ();
+
+
+	bool IsOpen () const
+	{
+		return m_bOpen;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * 		RS_SUCCESS: found
+	 * 		RE_NOT_EXISTS: not found or expired
+	 * @param  strKey
+	 * @param  strValue
+	 */
+	ResultCode Get (const std::string& strKey, std::string& strValue);
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strKey
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	ResultCode Put (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1));
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strKey
+	 */
+	ResultCode Remove (const std::string& strKey);
+
+
+	/**
+	 * Compact the oldest segment synchronously, normally this is done by the
+	 * background compaction thread.
+	 * @return ResultCode
+	 * 		RS_SUCCESS: a segment was compacted or evicted
+	 * 		RS_NOT_EXISTS: nothing to compact
+	 */
+	ResultCode Compact ();
+
+
+	/**
+	 * @return size_t the bytes of all segment files.
+	 */
+	size_t GetDiskSize ();
+
+
+	/**
+	 * @return size_t the count of keys in the index(including expired but not yet reclaimed ones).
+	 */
+	size_t GetKeyCount ();
+
+
+protected:
+	struct RecordHeader
+	{
+		uint32_t nMagic;
+		uint32_t nKeyLen;
+		uint32_t nValueLen;
+		uint32_t nFlags;
+		int64_t nExpireAt;	//unix time in second, 0 means not limited.
+	};
+
+	struct Segment
+	{
+		size_t nId = 0;
+		std::string strPath;
+		int nFd = -1;
+		char* pData = nullptr;
+		size_t nSize = 0;
+		size_t nWritePos = 0;
+		size_t nLiveBytes = 0;
+	};
+
+	struct Location
+	{
+		size_t nSegmentId;
+		size_t nOffset;
+		uint32_t nKeyLen;
+		uint32_t nValueLen;
+		int64_t nExpireAt;
+	};
+
+	static size_t RecordSize(size_t nKeyLen, size_t nValueLen);
+	static int64_t Now();
+	std::string GetSegmentPath(size_t nId) const;
+
+	ResultCode OpenSegment(size_t nId, bool bCreate);
+	void CloseSegment(Segment& segment, bool bUnlink);
+	ResultCode LockDir();
+	void UnlockDir();
+	void ScanSegment(Segment& segment);
+	ResultCode AppendRecord(const std::string& strKey, const char* pValue, size_t nValueLen,
+			int64_t nExpireAt, uint32_t nFlags, Location& location);
+	void DropLocation(const Location& location);
+	ResultCode CompactOldest();
+	void CompactionThread();
+	bool NeedCompaction() const;
+
+	std::string m_strDirPath;
+	size_t m_nMaxSize = 0;
+	size_t m_nSegmentSize = 0;
+	size_t m_nActiveSegment = 0;
+	int m_nLockFd = -1;
+	bool m_bOpen = false;
+	bool m_bStop = false;
+
+	std::map<size_t, Segment> m_mapSegment;
+	std::unordered_map<std::string, Location> m_mapIndex;
+	std::mutex m_mutex;
+	std::condition_variable m_cvCompaction;
+	std::thread m_threadCompaction;
+
+
+};
+
+#endif // CCACHEDISKSTORE_H
@@ -0,0 +1,406 @@
+#include "CacheShmStore.h"
+#include "Log.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+using namespace Stock;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+		"the atomics in the shared memory must be lock free");
+
+static const uint32_t SHM_MAGIC = 0x4D534343;	//"CCSM"
+static const uint32_t SHM_VERSION = 1;
+static const size_t BLOCK_ALIGN = 64;
+static const uint64_t INDEX_MASK = 0xFFFFFFFFULL;
+
+struct CCacheShmStore::Header
+{
+	uint32_t nMagic;
+	uint32_t nVersion;
+	uint64_t nSlotCount;
+	uint64_t nArenaOffset;
+	uint64_t nArenaSize;
+	std::atomic<uint64_t> nArenaUsed;
+	std::atomic<uint64_t> nClockHand;
+	//(tag << 32) | (block offset / BLOCK_ALIGN), the tag defeats ABA.
+	std::atomic<uint64_t> arrFreeList[CLASS_COUNT];
+	std::atomic<uint32_t> nReady;
+};
+
+struct CCacheShmStore::Slot
+{
+	std::atomic<uint64_t> nKeyHash;	//0 means not claimed
+	std::atomic<uint64_t> nEntry;	//block offset, 0 means no value
+};
+
+struct CCacheShmStore::Block
+{
+	std::atomic<uint32_t> nSeq;	//odd while free or being written
+	uint32_t nClass;
+	std::atomic<uint64_t> nNext;	//free list link
+	int64_t nExpireInMS;
+	uint32_t nKeyLength;
+	uint32_t nValueLength;
+	//followed by key and value
+};
+
+static size_t GetClassSize(size_t nClass)
+{
+	return BLOCK_ALIGN << nClass;
+}
+
+// Constructors/Destructors
+//
+
+CCacheShmStore::CCacheShmStore ()
+{
+}
+
+CCacheShmStore::~CCacheShmStore ()
+{
+	Close();
+}
+
+//
+// Methods
+//
+
+ResultCode CCacheShmStore::Open (const std::string& strName, size_t nMaxSizeInMB, size_t nMaxKeyCount)
+{
+	if(strName.empty() || nMaxSizeInMB == 0 || nMaxKeyCount == 0
+			|| nMaxSizeInMB * 1024 * 1024 / BLOCK_ALIGN > INDEX_MASK)
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	Close();
+	std::string strShmName = GetShmName(strName);
+
+	uint64_t nSlotCount = 1;
+	while(nSlotCount < nMaxKeyCount * 2)
+		nSlotCount <<= 1;
+	uint64_t nArenaOffset = (sizeof(Header) + nSlotCount * sizeof(Slot) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+	uint64_t nArenaSize = uint64_t(nMaxSizeInMB) * 1024 * 1024;
+
+	bool bCreated = true;
+	int fd = shm_open(strShmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0 && errno == EEXIST)
+	{
+		bCreated = false;
+		fd = shm_open(strShmName.c_str(), O_RDWR, 0600);
+	}
+	if(fd < 0)
+	{
+		LogError() << "open shared memory failed:" << strShmName << "," << strerror(errno);
+		LogReturn(RE_ERROR);
+	}
+
+	size_t nMapSize = nArenaOffset + nArenaSize;
+	if(bCreated)
+	{
+		if(ftruncate(fd, nMapSize) != 0)
+		{
+			LogError() << "resize shared memory failed:" << strShmName << "," << strerror(errno);
+			close(fd);
+			shm_unlink(strShmName.c_str());
+			LogReturn(RE_OUT_OF_RESOURCE);
+		}
+	}
+	else
+	{
+		//the creator may be still resizing it.
+		struct stat st;
+		for(int i = 0; i < 100; i++)
+		{
+			if(fstat(fd, &st) == 0 && size_t(st.st_size) > sizeof(Header))
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if(fstat(fd, &st) != 0 || size_t(st.st_size) <= sizeof(Header))
+		{
+			close(fd);
+			LogError() << "shared memory is not initialized:" << strShmName;
+			LogReturn(RE_NOT_INITIALIZE);
+		}
+		nMapSize = st.st_size;
+	}
+
+	void* pBase = mmap(nullptr, nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(pBase == MAP_FAILED)
+	{
+		LogError() << "map shared memory failed:" << strShmName << "," << strerror(errno);
+		if(bCreated)
+			shm_unlink(strShmName.c_str());
+		LogReturn(RE_ERROR);
+	}
+	Header* pHeader = (Header*)pBase;
+	if(bCreated)
+	{
+		//the new segment is zero filled, which is the empty state of the slots and the free lists.
+		pHeader->nMagic = SHM_MAGIC;
+		pHeader->nVersion = SHM_VERSION;
+		pHeader->nSlotCount = nSlotCount;
+		pHeader->nArenaOffset = nArenaOffset;
+		pHeader->nArenaSize = nArenaSize;
+		pHeader->nReady.store(1, std::memory_order_release);
+	}
+	else
+	{
+		for(int i = 0; i < 100 && pHeader->nReady.load(std::memory_order_acquire) == 0; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if(pHeader->nReady.load(std::memory_order_acquire) == 0 || pHeader->nMagic != SHM_MAGIC
+				|| pHeader->nVersion != SHM_VERSION
+				|| pHeader->nArenaOffset + pHeader->nArenaSize > nMapSize)
+		{
+			LogError() << "invalid shared memory:" << strShmName;
+			munmap(pBase, nMapSize);
+			LogReturn(RE_INVALIDATE_DATA);
+		}
+	}
+
+	m_pBase = (char*)pBase;
+	m_nMapSize = nMapSize;
+	m_pHeader = pHeader;
+	m_pSlot = (Slot*)(m_pBase + sizeof(Header));
+	LogDebug() << "shared memory cache opened:" << strShmName << (bCreated ? " created" : " attached");
+	return RS_SUCCESS;
+}
+
+void CCacheShmStore::Close ()
+{
+	if(m_pBase == nullptr)
+		return;
+	munmap(m_pBase, m_nMapSize);
+	m_pBase = nullptr;
+	m_nMapSize = 0;
+	m_pHeader = nullptr;
+	m_pSlot = nullptr;
+}
+
+void CCacheShmStore::Unlink (const std::string& strName)
+{
+	shm_unlink(GetShmName(strName).c_str());
+}
+
+ResultCode CCacheShmStore::Get (const std::string& strKey, std::string& strValue)
+{
+	if(m_pBase == nullptr)
+		return RE_NOT_INITIALIZE;
+	Slot* pSlot = FindSlot(Hash(strKey), false);
+	if(pSlot == nullptr)
+		return RE_NOT_EXISTS;
+	for(int nAttempt = 0; nAttempt < 4; nAttempt++)
+	{
+		uint64_t nOffset = pSlot->nEntry.load(std::memory_order_acquire);
+		if(nOffset == 0)
+			return RE_NOT_EXISTS;
+		Block* pBlock = GetBlock(nOffset);
+		uint32_t nSeq = pBlock->nSeq.load(std::memory_order_acquire);
+		if(nSeq & 1)
+			continue;
+		size_t nClass = pBlock->nClass;
+		size_t nKeyLength = pBlock->nKeyLength;
+		size_t nValueLength = pBlock->nValueLength;
+		int64_t nExpireInMS = pBlock->nExpireInMS;
+		//a torn read is rejected by the sequence check, but it must stay inside the block.
+		if(nClass >= CLASS_COUNT || sizeof(Block) + nKeyLength + nValueLength > GetClassSize(nClass)
+				|| nOffset + GetClassSize(nClass) > m_pHeader->nArenaOffset + m_pHeader->nArenaSize)
+			continue;
+		const char* pData = (const char*)(pBlock + 1);
+		bool bMatch = nKeyLength == strKey.size() && memcmp(pData, strKey.data(), nKeyLength) == 0;
+		if(bMatch)
+			strValue.assign(pData + nKeyLength, nValueLength);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(pBlock->nSeq.load(std::memory_order_relaxed) != nSeq)
+			continue;
+		if(!bMatch)
+			return RE_NOT_EXISTS;	//another key of the same hash
+		if(nExpireInMS >= 0 && nExpireInMS <= NowInMS())
+		{
+			if(pSlot->nEntry.compare_exchange_strong(nOffset, 0))
+				Free(nOffset);
+			return RE_NOT_EXISTS;
+		}
+		return RS_SUCCESS;
+	}
+	return RE_NOT_EXISTS;
+}
+
+ResultCode CCacheShmStore::Put (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	if(m_pBase == nullptr)
+		return RE_NOT_INITIALIZE;
+	size_t nSize = sizeof(Block) + strKey.size() + strValue.size();
+	size_t nClass = 0;
+	while(nClass < CLASS_COUNT && GetClassSize(nClass) < nSize)
+		nClass++;
+	if(nClass == CLASS_COUNT)
+		return RE_OUT_OF_RESOURCE;
+	uint64_t nHash = Hash(strKey);
+	Slot* pSlot = FindSlot(nHash, true);
+	if(pSlot == nullptr)
+		return RE_OUT_OF_RESOURCE;
+	uint64_t nOffset = Allocate(nClass);
+	if(nOffset == 0 && Evict(nClass))
+		nOffset = Allocate(nClass);
+	if(nOffset == 0)
+		return RE_OUT_OF_RESOURCE;
+
+	Block* pBlock = GetBlock(nOffset);
+	uint32_t nSeq = pBlock->nSeq.load(std::memory_order_relaxed);
+	pBlock->nClass = nClass;
+	pBlock->nExpireInMS = nLifeCycleInSecond == size_t(-1) ? -1 : NowInMS() + int64_t(nLifeCycleInSecond) * 1000;
+	pBlock->nKeyLength = strKey.size();
+	pBlock->nValueLength = strValue.size();
+	char* pData = (char*)(pBlock + 1);
+	memcpy(pData, strKey.data(), strKey.size());
+	memcpy(pData + strKey.size(), strValue.data(), strValue.size());
+	pBlock->nSeq.store(nSeq + 1, std::memory_order_release);
+
+	uint64_t nOld = pSlot->nEntry.exchange(nOffset, std::memory_order_acq_rel);
+	if(nOld != 0)
+		Free(nOld);
+	return RS_SUCCESS;
+}
+
+ResultCode CCacheShmStore::Remove (const std::string& strKey)
+{
+	if(m_pBase == nullptr)
+		return RE_NOT_INITIALIZE;
+	Slot* pSlot = FindSlot(Hash(strKey), false);
+	if(pSlot == nullptr)
+		return RE_NOT_EXISTS;
+	uint64_t nOld = pSlot->nEntry.exchange(0, std::memory_order_acq_rel);
+	if(nOld == 0)
+		return RE_NOT_EXISTS;
+	Free(nOld);
+	return RS_SUCCESS;
+}
+
+/*
+ * FNV-1a, the same in every process, 0 is reserved for the unclaimed slot.
+ */
+uint64_t CCacheShmStore::Hash(const std::string& strKey)
+{
+	uint64_t nHash = 14695981039346656037ULL;
+	for(auto c: strKey)
+	{
+		nHash ^= (unsigned char)c;
+		nHash *= 1099511628211ULL;
+	}
+	return nHash == 0 ? 1 : nHash;
+}
+
+std::string CCacheShmStore::GetShmName(const std::string& strName)
+{
+	return strName[0] == '/' ? strName : "/" + strName;
+}
+
+int64_t CCacheShmStore::NowInMS()
+{
+	//CLOCK_MONOTONIC is the same for all the processes of the host.
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CCacheShmStore::Slot* CCacheShmStore::FindSlot(uint64_t nHash, bool bClaim)
+{
+	uint64_t nMask = m_pHeader->nSlotCount - 1;
+	for(size_t i = 0; i < MAX_PROBE && i <= nMask; i++)
+	{
+		Slot* pSlot = m_pSlot + ((nHash + i) & nMask);
+		uint64_t nKeyHash = pSlot->nKeyHash.load(std::memory_order_acquire);
+		if(nKeyHash == 0)
+		{
+			if(!bClaim)
+				return nullptr;
+			if(pSlot->nKeyHash.compare_exchange_strong(nKeyHash, nHash) || nKeyHash == nHash)
+				return pSlot;
+			continue;
+		}
+		if(nKeyHash == nHash)
+			return pSlot;
+	}
+	return nullptr;
+}
+
+CCacheShmStore::Block* CCacheShmStore::GetBlock(uint64_t nOffset) const
+{
+	return (Block*)(m_pBase + nOffset);
+}
+
+uint64_t CCacheShmStore::Allocate(size_t nClass)
+{
+	std::atomic<uint64_t>& freeList = m_pHeader->arrFreeList[nClass];
+	uint64_t nHead = freeList.load(std::memory_order_acquire);
+	while((nHead & INDEX_MASK) != 0)
+	{
+		uint64_t nOffset = (nHead & INDEX_MASK) * BLOCK_ALIGN;
+		uint64_t nNext = GetBlock(nOffset)->nNext.load(std::memory_order_relaxed);
+		uint64_t nNewHead = (((nHead >> 32) + 1) << 32) | nNext;
+		if(freeList.compare_exchange_weak(nHead, nNewHead, std::memory_order_acq_rel))
+			return nOffset;
+	}
+
+	uint64_t nSize = GetClassSize(nClass);
+	uint64_t nUsed = m_pHeader->nArenaUsed.load(std::memory_order_relaxed);
+	do
+	{
+		if(nUsed + nSize > m_pHeader->nArenaSize)
+			return 0;
+	}
+	while(!m_pHeader->nArenaUsed.compare_exchange_weak(nUsed, nUsed + nSize));
+	uint64_t nOffset = m_pHeader->nArenaOffset + nUsed;
+	Block* pBlock = GetBlock(nOffset);
+	pBlock->nSeq.store(1, std::memory_order_relaxed);
+	pBlock->nClass = nClass;
+	return nOffset;
+}
+
+void CCacheShmStore::Free(uint64_t nOffset)
+{
+	Block* pBlock = GetBlock(nOffset);
+	//odd from now on, the readers of the old value retry.
+	pBlock->nSeq.fetch_add(1, std::memory_order_acq_rel);
+	std::atomic<uint64_t>& freeList = m_pHeader->arrFreeList[pBlock->nClass];
+	uint64_t nHead = freeList.load(std::memory_order_acquire);
+	uint64_t nNewHead = 0;
+	do
+	{
+		pBlock->nNext.store(nHead & INDEX_MASK, std::memory_order_relaxed);
+		nNewHead = (((nHead >> 32) + 1) << 32) | (nOffset / BLOCK_ALIGN);
+	}
+	while(!freeList.compare_exchange_weak(nHead, nNewHead, std::memory_order_acq_rel));
+}
+
+/*
+ * Advance the clock hand, evict the first entry of the size class, or any expired entry.
+ */
+bool CCacheShmStore::Evict(size_t nClass)
+{
+	uint64_t nMask = m_pHeader->nSlotCount - 1;
+	int64_t nNow = NowInMS();
+	bool bEvicted = false;
+	for(size_t i = 0; i < MAX_PROBE * 4 && i <= nMask; i++)
+	{
+		Slot* pSlot = m_pSlot + (m_pHeader->nClockHand.fetch_add(1, std::memory_order_relaxed) & nMask);
+		uint64_t nOffset = pSlot->nEntry.load(std::memory_order_acquire);
+		if(nOffset == 0)
+			continue;
+		Block* pBlock = GetBlock(nOffset);
+		bool bExpired = pBlock->nExpireInMS >= 0 && pBlock->nExpireInMS <= nNow;
+		if(pBlock->nClass != nClass && !bExpired)
+			continue;
+		if(pSlot->nEntry.compare_exchange_strong(nOffset, 0))
+		{
+			Free(nOffset);
+			if(pBlock->nClass == nClass)
+				return true;
+			bEvicted = true;
+		}
+	}
+	return bEvicted;
+}
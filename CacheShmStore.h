@@ -0,0 +1,119 @@
+#ifndef CCACHESHMSTORE_H
+#define CCACHESHMSTORE_H
+#include "ResultCode.h"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+/**
+ * class CCacheShmStore
+ * Host local tier for CCacheCluster, a POSIX shared memory segment mapped by all the worker
+ * processes of the host, so a value fetched by one process serves the others.
+ *
+ * The segment is an open-addressing hash index and a slab arena, both accessed lock free:
+ * 		Header | Slot[nSlotCount] | arena of blocks
+ * A slot is claimed by a key hash once and never released, its entry points to the block of
+ * the latest value. A block belongs to a power-of-two size class, freed blocks go to the lock
+ * free list of the class. Readers validate a block by its sequence number (odd while free or
+ * being written), so a block reused during the read is detected and the read is retried.
+ *
+ * When the arena is exhausted, the entries of the same size class are evicted in clock order.
+ * When all the slots are claimed, new keys are not cached. A process killed in the middle
+ * of a Put may leak one block.
+ */
+class CCacheShmStore
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * Empty Constructor
+	 */
+	CCacheShmStore ();
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CCacheShmStore ();
+
+
+	/**
+	 * Map the segment, create it when it doesn't exist. An existing segment keeps the sizes
+	 * of its creator.
+	 * @return ResultCode
+	 * @param  strName the shared memory name, the same name shares the same segment.
+	 * @param  nMaxSizeInMB the arena size.
+	 * @param  nMaxKeyCount the index has twice as many slots.
+	 */
+	ResultCode Open (const std::string& strName, size_t nMaxSizeInMB, size_t nMaxKeyCount);
+
+
+	/**
+	 * Unmap the segment, the content stays for the other processes.
+	 */
+	void Close ();
+
+
+	bool IsOpen () const
+	{
+		return m_pBase != nullptr;
+	}
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: not cached or expired.
+	 * @param  strKey
+	 * @param  strValue [out]
+	 */
+	ResultCode Get (const std::string& strKey, std::string& strValue);
+
+
+	/**
+	 * @return ResultCode
+	 * 		RE_OUT_OF_RESOURCE: the value is too large, or no room for it.
+	 * @param  strKey
+	 * @param  strValue
+	 * @param  nLifeCycleInSecond size_t(-1) means not limited.
+	 */
+	ResultCode Put (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond = size_t(-1));
+
+
+	ResultCode Remove (const std::string& strKey);
+
+
+	/**
+	 * Remove the segment from the system, the mapped processes keep it until they close.
+	 * @param  strName
+	 */
+	static void Unlink (const std::string& strName);
+
+
+protected:
+	static const size_t CLASS_COUNT = 16;	//64 bytes to 2MB
+	static const size_t MAX_PROBE = 64;
+
+	struct Header;
+	struct Slot;
+	struct Block;
+
+	static uint64_t Hash(const std::string& strKey);
+	static std::string GetShmName(const std::string& strName);
+	static int64_t NowInMS();
+	Slot* FindSlot(uint64_t nHash, bool bClaim);
+	Block* GetBlock(uint64_t nOffset) const;
+	uint64_t Allocate(size_t nClass);
+	void Free(uint64_t nOffset);
+	bool Evict(size_t nClass);
+
+	char* m_pBase = nullptr;
+	size_t m_nMapSize = 0;
+	Header* m_pHeader = nullptr;
+	Slot* m_pSlot = nullptr;
+
+
+};
+
+#endif // CCACHESHMSTORE_H
@@ -0,0 +1,154 @@
+#include "HotKeySampler.h"
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+// Constructors/Destructors
+//
+
+CHotKeySampler::CHotKeySampler (size_t nTopK, double dHotRatio, size_t nSampleRate, size_t nWindowSize):
+		m_nTopK(nTopK), m_dHotRatio(dHotRatio), m_nSampleRate(std::max<size_t>(nSampleRate, 1)),
+		m_nWindowSize(std::max<size_t>(nWindowSize, 1))
+{
+	memset(m_sketch, 0, sizeof(m_sketch));
+}
+
+CHotKeySampler::~CHotKeySampler ()
+{
+}
+
+//
+// Methods
+//
+
+void CHotKeySampler::Record (const std::string& strKey)
+{
+	//xorshift, a periodic access pattern would alias with a plain modulo counter.
+	static thread_local uint32_t s_nSeed = 2463534242U ^ uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	s_nSeed ^= s_nSeed << 13;
+	s_nSeed ^= s_nSeed >> 17;
+	s_nSeed ^= s_nSeed << 5;
+	if(s_nSeed % m_nSampleRate != 0)
+		return;
+
+	uint64_t nHash = std::hash<std::string>()(strKey);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint32_t nCount = Increase(nHash);
+	UpdateTopK(strKey, nCount);
+	if(++m_nSampleCount >= m_nWindowSize)
+		Decay();
+}
+
+bool CHotKeySampler::IsHot (const std::string& strKey)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_mapTopK.find(strKey);
+	return it != m_mapTopK.end() && IsHot(it->second);
+}
+
+void CHotKeySampler::GetHotKeys (std::vector<std::pair<std::string, size_t>>& vectHotKey)
+{
+	vectHotKey.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(auto& item: m_mapTopK)
+		{
+			if(IsHot(item.second))
+				vectHotKey.push_back(std::make_pair(item.first, size_t(item.second) * m_nSampleRate));
+		}
+	}
+	std::sort(vectHotKey.begin(), vectHotKey.end(),
+			[](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b)
+			{
+				return a.second > b.second;
+			});
+}
+
+void CHotKeySampler::SetOption (size_t nTopK, double dHotRatio)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nTopK = nTopK;
+	m_dHotRatio = dHotRatio;
+	while(m_vectTopK.size() > m_nTopK)
+	{
+		std::pop_heap(m_vectTopK.begin(), m_vectTopK.end(), HeapCompare);
+		m_mapTopK.erase(m_vectTopK.back().second);
+		m_vectTopK.pop_back();
+	}
+}
+
+void CHotKeySampler::Reset ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	memset(m_sketch, 0, sizeof(m_sketch));
+	m_vectTopK.clear();
+	m_mapTopK.clear();
+	m_nSampleCount = 0;
+}
+
+/*
+ * The count-min estimation: the minimum of the rows, each row uses a different
+ * half of the mixed hash.
+ */
+uint32_t CHotKeySampler::Increase(uint64_t nHash)
+{
+	uint32_t nMin = uint32_t(-1);
+	uint64_t nHash2 = (nHash ^ (nHash >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	for(size_t i = 0; i < SKETCH_DEPTH; i++)
+	{
+		size_t nIndex = (uint32_t(nHash) + i * uint32_t(nHash2 >> 32)) % SKETCH_WIDTH;
+		uint32_t nCount = ++m_sketch[i][nIndex];
+		nMin = std::min(nMin, nCount);
+	}
+	return nMin;
+}
+
+void CHotKeySampler::UpdateTopK(const std::string& strKey, uint32_t nCount)
+{
+	if(m_nTopK == 0)
+		return;
+	auto it = m_mapTopK.find(strKey);
+	if(it != m_mapTopK.end())
+	{
+		it->second = nCount;
+		for(auto& item: m_vectTopK)
+		{
+			if(item.second == strKey)
+			{
+				item.first = nCount;
+				break;
+			}
+		}
+		std::make_heap(m_vectTopK.begin(), m_vectTopK.end(), HeapCompare);
+		return;
+	}
+	if(m_vectTopK.size() >= m_nTopK)
+	{
+		if(m_vectTopK.front().first >= nCount)
+			return;
+		std::pop_heap(m_vectTopK.begin(), m_vectTopK.end(), HeapCompare);
+		m_mapTopK.erase(m_vectTopK.back().second);
+		m_vectTopK.pop_back();
+	}
+	m_vectTopK.push_back(std::make_pair(nCount, strKey));
+	std::push_heap(m_vectTopK.begin(), m_vectTopK.end(), HeapCompare);
+	m_mapTopK[strKey] = nCount;
+}
+
+void CHotKeySampler::Decay()
+{
+	for(size_t i = 0; i < SKETCH_DEPTH; i++)
+		for(size_t j = 0; j < SKETCH_WIDTH; j++)
+			m_sketch[i][j] >>= 1;
+	for(auto& item: m_vectTopK)
+		item.first >>= 1;
+	for(auto& item: m_mapTopK)
+		item.second >>= 1;
+	m_nSampleCount = 0;
+}
+
+bool CHotKeySampler::IsHot(uint32_t nCount) const
+{
+	return nCount >= 4 && nCount >= m_dHotRatio * m_nWindowSize;
+}
@@ -0,0 +1,94 @@
+
+#ifndef CHOTKEYSAMPLER_H
+#define CHOTKEYSAMPLER_H
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * class CHotKeySampler
+ * Find the hot keys of the recent accesses.
+ *
+ * About one of every nSampleRate accesses is counted into a count-min sketch, the keys
+ * with the top K estimations are tracked in a min-heap. All counters are halved
+ * every nWindowSize samples, so the result reflects the recent accesses only.
+ */
+class CHotKeySampler
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * @param  nTopK count of the tracked candidates.
+	 * @param  dHotRatio a candidate is hot when it takes at least this share of the samples.
+	 * @param  nSampleRate count one of every nSampleRate accesses.
+	 * @param  nWindowSize decay all counters after so many samples.
+	 */
+	CHotKeySampler (size_t nTopK = 16, double dHotRatio = 0.01, size_t nSampleRate = 8,
+			size_t nWindowSize = 4096);
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CHotKeySampler ();
+
+
+	/**
+	 * Count an access, lock free unless the access is sampled.
+	 * @param  strKey
+	 */
+	void Record (const std::string& strKey);
+
+
+	/**
+	 * @return bool whether the key is hot according to the current statistics.
+	 * @param  strKey
+	 */
+	bool IsHot (const std::string& strKey);
+
+
+	/**
+	 * @param  vectHotKey [out] (key, estimated accesses in the current window) ordered by accesses desc.
+	 */
+	void GetHotKeys (std::vector<std::pair<std::string, size_t>>& vectHotKey);
+
+
+	void SetOption (size_t nTopK, double dHotRatio);
+
+
+	void Reset ();
+
+
+protected:
+	static const size_t SKETCH_DEPTH = 4;
+	static const size_t SKETCH_WIDTH = 2048;
+
+	uint32_t Increase(uint64_t nHash);
+	void UpdateTopK(const std::string& strKey, uint32_t nCount);
+	void Decay();
+	bool IsHot(uint32_t nCount) const;
+	static bool HeapCompare(const std::pair<uint32_t, std::string>& a, const std::pair<uint32_t, std::string>& b)
+	{
+		return a.first > b.first;
+	}
+
+	size_t m_nTopK;
+	double m_dHotRatio;
+	size_t m_nSampleRate;
+	size_t m_nWindowSize;
+	size_t m_nSampleCount = 0;
+
+	uint32_t m_sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+	//min-heap of (count, key), m_mapTopK is the membership of the heap.
+	std::vector<std::pair<uint32_t, std::string>> m_vectTopK;
+	std::unordered_map<std::string, uint32_t> m_mapTopK;
+	std::mutex m_mutex;
+
+
+};
+
+#endif // CHOTKEYSAMPLER_H
@@ -1,9 +1,14 @@
 #include "JobCluster.h"
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <iterator>
 #include "Log.h"
 #include "Stock.h"
 #include "CacheCluster.h"
+#define RETRY_COUNT 1
+
+const std::string CJobCluster::PAYLOAD_MAGIC = "\x1bTaskPayload:";
 
 
 
@@ -18,6 +23,7 @@ CJobCluster::CJobCluster ()
 CJobCluster::~CJobCluster ()
 {
 	DisconnectFromCluster();
+	StopPrefetch();
 }
 
 
@@ -59,6 +65,8 @@ ResultCode CJobCluster::ConnectToCluster (const std::vector<ServerAddress>& vect
 	if(strHost.empty())
 		return RE_INVALIDATE_PARAMETER;
 
+	m_setKnownDir.clear();
+	m_setPayloadLost.clear();
 	this->m_serverHandle = zookeeper_init(strHost.c_str(),
             CJobCluster::OnStatusChanged, nRecvTimeout, nullptr, (void*)this, 0);
 	if(m_serverHandle == nullptr)
@@ -88,7 +96,8 @@ ResultCode CJobCluster::ConnectToCluster (const std::vector<ServerAddress>& vect
 		LogReturn(rc);
 	}
 
-
+	ResetClaimStatistics();
+	StartTaskIndex();
 	return RS_SUCCESS;
 
 }
@@ -106,7 +115,12 @@ ResultCode CJobCluster::DisconnectFromCluster ()
 	if(m_serverHandle == nullptr)
 		LogReturn(RE_NOT_INITIALIZE);
 
+	//cancel the bulk deletes, claims and task uploads running without m_mutex and wait for them to return.
+	m_bCancelUnlockedWork = true;
+	m_cvUnlockedWork.wait(lock, [this]{return m_nBulkDeleteRunning == 0 && m_nClaimRunning == 0 && m_nAddTasksRunning == 0;});
+	m_bCancelUnlockedWork = false;
 	LogDebug() << "closing server handle";
+	StopTaskIndex();
 	zookeeper_close(this->m_serverHandle);
 	LogDebug() << "server handle closed";
 	this->m_serverHandle = nullptr;
@@ -168,11 +182,13 @@ ResultCode CJobCluster::UnregisterWorker ()
 		LogError() << "worker not exists:" << m_strWorkerName;
 		return RE_NOT_EXISTS;
 	}
-	if(!m_strWorkingTask.empty())
-	{
-		std::string strWorkingTaskPath = this->GetTaskWorkingPath(m_strWorkingJob, m_strWorkingTask);
-		int nResult = zoo_delete(this->m_serverHandle, strWorkingTaskPath.c_str(), -1);
-	}
+	for(auto& task: m_setWorkingTask)
+		ReleaseClaim(task.first, task.second);
+	m_setWorkingTask.clear();
+	//the prefetched tasks are not started, other workers could take them at once.
+	for(auto& task: m_deqPrefetched)
+		ReleaseClaim(task.strJobName, task.strTaskName);
+	m_deqPrefetched.clear();
 	std::string strWorkerPath = this->GetWorkerPath(m_strWorkerName);
 	int nResult = zoo_delete(this->m_serverHandle, strWorkerPath.c_str(), -1);
 	if(nResult == ZNONODE)
@@ -208,18 +224,28 @@ size_t CJobCluster::GetWorkerCount ()
  * @param  strTaskData
  */
 ResultCode CJobCluster::AddTask (const std::string& strJobName, const std::string& strTaskData,
-		std::string& strTaskName)
+		std::string& strTaskName, EnumTaskPriority ePriority)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
 	if(m_serverHandle == nullptr)
 		LogReturn(RE_NOT_INITIALIZE);
+	if(NeedOffload(strTaskData))
+	{
+		//the reference and its marker are created together in one zoo_multi.
+		std::vector<std::string> vectTaskName;
+		ResultCode rc = CreateTasks(strJobName, std::vector<std::string>(1, strTaskData), vectTaskName, 1, ePriority);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		strTaskName = vectTaskName[0];
+		return RS_SUCCESS;
+	}
 	char pathResult[1024];
 
 	//ZOOAPI int zoo_create(zhandle_t * zh, const char *path,
 //    const char *value, int valuelen,
 //    const struct ACL_vector *acl, int flags,
 //    char *path_buffer, int path_buffer_len);
-	strTaskName = this->GetTaskOrderPath(strJobName, "Task");
+	strTaskName = this->GetTaskOrderPath(strJobName, GetTaskPrefix(ePriority));
 	std::vector<std::string> vectPathNode;
 	int result = zoo_create(this->m_serverHandle, strTaskName.c_str(), strTaskData.c_str(),
 			strTaskData.size(), &ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE, pathResult, 1024);
@@ -240,6 +266,262 @@ ResultCode CJobCluster::AddTask (const std::string& strJobName, const std::strin
 }
 
 
+std::future<CJobCluster::AsyncResult> CJobCluster::AddTaskAsync (const std::string& strJobName,
+		const std::string& strTaskData, EnumTaskPriority ePriority)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto pPromise = std::make_shared<std::promise<AsyncResult>>();
+	if(m_serverHandle == nullptr || strJobName.empty())
+	{
+		pPromise->set_value(AsyncResult{m_serverHandle == nullptr ? RE_NOT_INITIALIZE : RE_INVALIDATE_PARAMETER, ""});
+		return pPromise->get_future();
+	}
+	if(NeedOffload(strTaskData))
+	{
+		//the payload upload dominates, the task is created synchronously.
+		std::vector<std::string> vectTaskName;
+		ResultCode rc = CreateTasks(strJobName, std::vector<std::string>(1, strTaskData), vectTaskName, 1, ePriority);
+		pPromise->set_value(AsyncResult{rc, RC_SUCCEEDED(rc) ? vectTaskName[0] : ""});
+		return pPromise->get_future();
+	}
+	ZooCreateAsync(this->GetTaskOrderPath(strJobName, GetTaskPrefix(ePriority)), strTaskData, ZOO_SEQUENCE,
+			[pPromise, strJobName](const ZooResult& result)
+	{
+		if(result.nResult != ZOK)
+		{
+			LogError() << "create task failed:" << strJobName;
+			pPromise->set_value(AsyncResult{RE_ERROR, ""});
+			return;
+		}
+		pPromise->set_value(AsyncResult{RS_SUCCESS, result.strValue.substr(result.strValue.rfind('/') + 1)});
+	});
+	return pPromise->get_future();
+}
+
+ResultCode CJobCluster::AddTasks (const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+		std::vector<std::string>& vectTaskName, size_t nBatchSize, EnumTaskPriority ePriority)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_serverHandle == nullptr)
+		LogReturn(RE_NOT_INITIALIZE);
+	if(strJobName.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	return CreateTasks(strJobName, vectTaskData, vectTaskName, nBatchSize, ePriority);
+}
+
+/*
+ * Called with m_mutex locked, create the tasks with one zoo_multi per batch.
+ */
+ResultCode CJobCluster::CreateTasks (const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+		std::vector<std::string>& vectTaskName, size_t nBatchSize, EnumTaskPriority ePriority)
+{
+	vectTaskName.clear();
+	std::vector<TaskBatch> vectBatch;
+	SplitTaskBatches(vectTaskData, nBatchSize, vectBatch);
+	for(auto& batch: vectBatch)
+	{
+		ResultCode rc = InitTaskBatch(strJobName, vectTaskData, ePriority, batch);
+		if(RC_FAILED(rc))
+			LogReturn(rc);
+		int nResult = zoo_multi(this->m_serverHandle, (int)batch.vectOp.size(), batch.vectOp.data(), batch.vectResult.data());
+		if(nResult != ZOK)
+		{
+			LogError() << "create tasks failed:" << strJobName << ",errorcode:" << nResult;
+			RemovePayloads(strJobName, batch.vectPayloadId);
+			return RE_ERROR;
+		}
+		CollectTaskNames(batch, vectTaskName);
+	}
+	LogDebug() << "tasks created succeeded:" << strJobName << "," << vectTaskName.size();
+	return RS_SUCCESS;
+}
+
+/*
+ * m_mutex is held only to prepare each batch, the batches are submitted and waited for without
+ * it, counted in m_nAddTasksRunning so DisconnectFromCluster keeps the handle until they return.
+ */
+ResultCode CJobCluster::AddTasksAsync (const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+		std::vector<std::string>& vectTaskName, size_t nBatchSize, size_t nMaxInFlight, EnumTaskPriority ePriority)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_serverHandle == nullptr)
+		LogReturn(RE_NOT_INITIALIZE);
+	if(strJobName.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	if(nMaxInFlight == 0)
+		nMaxInFlight = 1;
+	zhandle_t* pServerHandle = m_serverHandle;
+	m_nAddTasksRunning++;
+	lock.unlock();
+	vectTaskName.clear();
+	std::vector<TaskBatch> vectBatch;
+	SplitTaskBatches(vectTaskData, nBatchSize, vectBatch);
+
+	//the batches are not moved after submitted, the completions point to them.
+	AsyncBatchContext context;
+	for(auto& batch: vectBatch)
+	{
+		{
+			std::unique_lock<std::mutex> lockContext(context.mutex);
+			context.cv.wait(lockContext, [&]{return context.nInFlight < nMaxInFlight;});
+			if(context.bFailed || m_bCancelUnlockedWork)
+				break;
+			context.nInFlight++;
+		}
+		batch.pContext = &context;
+		batch.bSubmitted = true;
+		lock.lock();
+		ResultCode rc = InitTaskBatch(strJobName, vectTaskData, ePriority, batch);
+		lock.unlock();
+		if(RC_FAILED(rc))
+		{
+			std::lock_guard<std::mutex> lockContext(context.mutex);
+			batch.nResult = ZSYSTEMERROR;
+			context.nInFlight--;
+			break;
+		}
+		int nResult = zoo_amulti(pServerHandle, (int)batch.vectOp.size(), batch.vectOp.data(),
+				batch.vectResult.data(), CJobCluster::OnTaskBatchCreated, &batch);
+		if(nResult != ZOK)
+		{
+			std::lock_guard<std::mutex> lockContext(context.mutex);
+			batch.nResult = nResult;
+			context.nInFlight--;
+			break;
+		}
+	}
+	{
+		std::unique_lock<std::mutex> lockContext(context.mutex);
+		context.cv.wait(lockContext, [&]{return context.nInFlight == 0;});
+	}
+	lock.lock();
+	m_nAddTasksRunning--;
+	lock.unlock();
+	m_cvUnlockedWork.notify_all();
+
+	ResultCode rc = RS_SUCCESS;
+	for(auto& batch: vectBatch)
+	{
+		if(!batch.bSubmitted)
+			continue;
+		if(batch.nResult != ZOK)
+		{
+			LogError() << "create tasks failed:" << strJobName << ",errorcode:" << batch.nResult;
+			RemovePayloads(strJobName, batch.vectPayloadId);
+			rc = RE_ERROR;
+			continue;
+		}
+		CollectTaskNames(batch, vectTaskName);
+	}
+	if(RC_SUCCEEDED(rc) && vectTaskName.size() != vectTaskData.size())
+		rc = RE_ERROR;
+	LogDebug() << "tasks created:" << strJobName << "," << vectTaskName.size();
+	return rc;
+}
+
+void CJobCluster::SplitTaskBatches(const std::vector<std::string>& vectTaskData, size_t nBatchSize,
+		std::vector<TaskBatch>& vectBatch)
+{
+	if(nBatchSize == 0)
+		nBatchSize = 1;
+	size_t nDataSize = 0;
+	for(size_t i = 0; i < vectTaskData.size(); i++)
+	{
+		if(vectBatch.empty() || vectBatch.back().nCount >= nBatchSize
+				|| (nDataSize + vectTaskData[i].size() > MAX_BATCH_DATA_SIZE && vectBatch.back().nCount > 0))
+		{
+			vectBatch.push_back(TaskBatch());
+			vectBatch.back().nFirst = i;
+			nDataSize = 0;
+		}
+		vectBatch.back().nCount++;
+		nDataSize += vectTaskData[i].size();
+	}
+}
+
+/*
+ * Called with m_mutex locked, the large task data is uploaded to the cache cluster first, the
+ * ops write the references and create the markers after the tasks. The uploaded payloads are
+ * removed when it fails.
+ */
+ResultCode CJobCluster::InitTaskBatch(const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+		EnumTaskPriority ePriority, TaskBatch& batch)
+{
+	batch.vectReference.assign(batch.nCount, std::string());
+	batch.vectPayloadId.clear();
+	batch.vectPayloadPath.clear();
+	for(size_t i = 0; i < batch.nCount; i++)
+	{
+		const std::string& strTaskData = vectTaskData[batch.nFirst + i];
+		if(!NeedOffload(strTaskData))
+			continue;
+		std::string strPayloadId;
+		ResultCode rc = OffloadPayload(strJobName, strTaskData, strPayloadId);
+		if(RC_FAILED(rc))
+		{
+			RemovePayloads(strJobName, batch.vectPayloadId);
+			batch.vectPayloadId.clear();
+			LogReturn(rc);
+		}
+		batch.vectReference[i] = PAYLOAD_MAGIC + strPayloadId;
+		batch.vectPayloadId.push_back(strPayloadId);
+		batch.vectPayloadPath.push_back(this->GetTaskPayloadPath(strJobName, strPayloadId));
+	}
+	if(!batch.vectPayloadId.empty())
+	{
+		//the jobs created before the offload have no payload directory.
+		ResultCode rc = ZooCreateDirChain(this->GetTaskPayloadPath(strJobName, ""));
+		if(RC_FAILED(rc))
+		{
+			RemovePayloads(strJobName, batch.vectPayloadId);
+			batch.vectPayloadId.clear();
+			LogReturn(rc);
+		}
+	}
+
+	std::string strTaskPath = this->GetTaskOrderPath(strJobName, GetTaskPrefix(ePriority));
+	size_t nOpCount = batch.nCount + batch.vectPayloadPath.size();
+	batch.vectOp.resize(nOpCount);
+	batch.vectResult.resize(nOpCount);
+	batch.vectPathBuffer.assign(batch.nCount, std::vector<char>(strTaskPath.size() + 16));
+	for(auto& strPayloadPath: batch.vectPayloadPath)
+		batch.vectPathBuffer.push_back(std::vector<char>(strPayloadPath.size() + 1));
+	for(size_t i = 0; i < batch.nCount; i++)
+	{
+		const std::string& strTaskData = batch.vectReference[i].empty() ? vectTaskData[batch.nFirst + i]
+				: batch.vectReference[i];
+		zoo_create_op_init(&batch.vectOp[i], strTaskPath.c_str(), strTaskData.c_str(), (int)strTaskData.size(),
+				&ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE, batch.vectPathBuffer[i].data(), (int)batch.vectPathBuffer[i].size());
+	}
+	for(size_t i = batch.nCount; i < nOpCount; i++)
+	{
+		zoo_create_op_init(&batch.vectOp[i], batch.vectPayloadPath[i - batch.nCount].c_str(), "", 0,
+				&ZOO_OPEN_ACL_UNSAFE, 0, batch.vectPathBuffer[i].data(), (int)batch.vectPathBuffer[i].size());
+	}
+	return RS_SUCCESS;
+}
+
+void CJobCluster::CollectTaskNames(const TaskBatch& batch, std::vector<std::string>& vectTaskName)
+{
+	//the markers follow the tasks.
+	for(size_t i = 0; i < batch.nCount; i++)
+	{
+		std::string strPath = batch.vectPathBuffer[i].data();
+		vectTaskName.push_back(strPath.substr(strPath.rfind('/') + 1));
+	}
+}
+
+void CJobCluster::OnTaskBatchCreated(int rc, const void* data)
+{
+	TaskBatch* pBatch = (TaskBatch*)data;
+	std::lock_guard<std::mutex> lock(pBatch->pContext->mutex);
+	pBatch->nResult = rc;
+	pBatch->pContext->bFailed = pBatch->pContext->bFailed || rc != ZOK;
+	pBatch->pContext->nInFlight--;
+	pBatch->pContext->cv.notify_all();
+}
+
+
 /**
  * @return int
  * @param  strJobName
@@ -248,54 +530,371 @@ ResultCode CJobCluster::AddTask (const std::string& strJobName, const std::strin
  */
 ResultCode CJobCluster::TakeTask (std::string& strJobName, std::string& strTaskName, std::string& strTaskData)
 {
-	std::lock_guard<std::mutex> lock(m_mutex);
+	std::unique_lock<std::mutex> lock(m_mutex);
 	if(this->m_strWorkerName.empty())
 		LogReturn(RE_NOT_INITIALIZE);
 	if(m_serverHandle == nullptr)
 		LogReturn(RE_NOT_INITIALIZE);
-	char pathResult[1024];
 
+	std::vector<TakenTask> vectTask;
+	ResultCode rc = TakePrefetchedTasks(strJobName, 1, vectTask);
+	if(vectTask.empty())
+		rc = ClaimTasks(lock, strJobName, 1, vectTask);
+	if(vectTask.empty())
+		LogReturn(rc);
 
-	while(true)
-	{
-		std::string strCurrentJob = strJobName;
-		if(strCurrentJob.empty())
-			strCurrentJob = SelectWaitingJob();
-		if(strCurrentJob.empty())
-			LogReturn(RE_NOT_EXISTS);
+	strJobName = vectTask[0].strJobName;
+	strTaskName = vectTask[0].strTaskName;
+	strTaskData.swap(vectTask[0].strTaskData);
+	m_setWorkingTask.insert(std::make_pair(strJobName, strTaskName));
+	return RS_SUCCESS;
+}
 
-		strTaskName = SelectWaitingTask(strCurrentJob);
-		if(strTaskName.empty())
-			LogReturn(RE_NOT_EXISTS);
+ResultCode CJobCluster::TakeTasks (const std::string& strJobName, size_t nMaxCount, std::vector<TakenTask>& vectTask)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(this->m_strWorkerName.empty())
+		LogReturn(RE_NOT_INITIALIZE);
+	if(m_serverHandle == nullptr)
+		LogReturn(RE_NOT_INITIALIZE);
+	vectTask.clear();
+	if(nMaxCount == 0)
+		LogReturn(RE_INVALIDATE_PARAMETER);
 
-		std::string strTaskWorkingPath = this->GetTaskWorkingPath(strCurrentJob, strTaskName);
-		if(strTaskWorkingPath.empty())
-			LogReturn(RE_UNEXPECT);
+	ResultCode rc = TakePrefetchedTasks(strJobName, nMaxCount, vectTask);
+	if(vectTask.size() < nMaxCount)
+		rc = ClaimTasks(lock, strJobName, nMaxCount, vectTask);
+	if(vectTask.empty())
+		LogReturn(rc);
+	for(auto& task: vectTask)
+		m_setWorkingTask.insert(std::make_pair(task.strJobName, task.strTaskName));
+	return RS_SUCCESS;
+}
 
-		int nResult = zoo_create(this->m_serverHandle, strTaskWorkingPath.c_str(), strTaskData.c_str(),
-				0, &ZOO_OPEN_ACL_UNSAFE, ZOO_EPHEMERAL, pathResult, 1024);
-		if(nResult != ZOK)
+void CJobCluster::SetPrefetchCount (size_t nCount, const std::string& strJobName)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_nPrefetchCount = nCount;
+		m_strPrefetchJob = strJobName;
+		//the buffered tasks of other jobs or more than nCount are not needed any more.
+		for(auto it = m_deqPrefetched.begin(); it != m_deqPrefetched.end();)
 		{
-			LogDebug() << "take task failed:" << strTaskWorkingPath << ", try another task...";
-			continue;
+			if(!strJobName.empty() && it->strJobName != strJobName)
+			{
+				ReleaseClaim(it->strJobName, it->strTaskName);
+				it = m_deqPrefetched.erase(it);
+			}
+			else
+				++it;
+		}
+		while(m_deqPrefetched.size() > nCount)
+		{
+			ReleaseClaim(m_deqPrefetched.back().strJobName, m_deqPrefetched.back().strTaskName);
+			m_deqPrefetched.pop_back();
 		}
+		if(nCount > 0 && !m_threadPrefetch.joinable())
+		{
+			m_bStopPrefetch = false;
+			m_threadPrefetch = std::thread(&CJobCluster::PrefetchThread, this);
+		}
+	}
+	m_cvTaskChanged.notify_all();
+}
 
+size_t CJobCluster::GetPrefetchedTaskCount ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_deqPrefetched.size();
+}
 
-		std::string strTaskOrderPath = this->GetTaskOrderPath(strCurrentJob, strTaskName);
-		ResultCode rc = ZooGetFileData(strTaskOrderPath, strTaskData);
-		if(RC_SUCCEEDED(rc))
+/*
+ * Called with m_mutex locked, move up to nMaxCount buffered tasks of the job to vectTask.
+ */
+ResultCode CJobCluster::TakePrefetchedTasks (const std::string& strJobName, size_t nMaxCount,
+		std::vector<TakenTask>& vectTask)
+{
+	for(auto it = m_deqPrefetched.begin(); it != m_deqPrefetched.end() && vectTask.size() < nMaxCount;)
+	{
+		if(!strJobName.empty() && it->strJobName != strJobName)
+		{
+			++it;
+			continue;
+		}
+		vectTask.push_back(TakenTask());
+		vectTask.back().strJobName.swap(it->strJobName);
+		vectTask.back().strTaskName.swap(it->strTaskName);
+		vectTask.back().strTaskData.swap(it->strTaskData);
+		it = m_deqPrefetched.erase(it);
+	}
+	if(!vectTask.empty())
+		m_cvTaskChanged.notify_all();	//wake up the prefetch thread to fill the buffer again.
+	return vectTask.empty() ? RE_NOT_EXISTS : RS_SUCCESS;
+}
+
+/*
+ * Called with m_mutex locked by lock. Claim waiting tasks until vectTask has nMaxCount tasks or there
+ * is no waiting task. The candidates of a pass come from the waiting index or from one listing of
+ * the directories, so the claims of a pass don't read the directories again. m_mutex is released
+ * for the claims, the staleness check and the listing of the job, and during the backoff after a
+ * lost pass, it is held only to pick the candidates and to book the results.
+ * A task which could not be claimed is not tried again in the same call.
+ * @return RE_NOT_EXISTS when nothing is claimed, RE_COMMUNICATION when a claim failed for other
+ * reasons than another worker took the task first.
+ */
+ResultCode CJobCluster::ClaimTasks (std::unique_lock<std::mutex>& lock, const std::string& strJobName, size_t nMaxCount,
+		std::vector<TakenTask>& vectTask)
+{
+	int nConflicts = 0;
+	ResultCode rc = RE_NOT_EXISTS;
+	std::set<std::pair<std::string, std::string>> setSkipped;
+	auto IsSkipped = [&](const std::string& strCurrentJob, const std::string& strTaskName)
+	{
+		auto task = std::make_pair(strCurrentJob, strTaskName);
+		return setSkipped.count(task) != 0 || m_setPayloadLost.count(task) != 0;
+	};
+	while(vectTask.size() < nMaxCount)
+	{
+		//checked after each release of m_mutex, DisconnectFromCluster may have closed the handle.
+		if(m_serverHandle == nullptr || m_strWorkerName.empty() || m_bCancelUnlockedWork)
+			return vectTask.empty() ? RE_NOT_INITIALIZE : RS_SUCCESS;
+		std::string strWorkerName = m_strWorkerName;
+		size_t nWanted = nMaxCount - vectTask.size();
+		std::vector<std::pair<std::string, std::string>> vectCandidate;
+		bool bIndexed = true;
+		while(vectCandidate.size() < nWanted)
+		{
+			std::string strCurrentJob = strJobName, strTaskName;
+			EnumIndexState eState = SelectIndexedTask(strCurrentJob, strTaskName);
+			if(eState == INDEX_HIT && IsSkipped(strCurrentJob, strTaskName))
+				continue;	//the index has not seen the removal yet.
+			if(eState == INDEX_HIT)
+			{
+				//charged at once, so the next pick sees the job served.
+				ChargeJob(strCurrentJob, 1);
+				vectCandidate.push_back(std::make_pair(strCurrentJob, strTaskName));
+				continue;
+			}
+			if(vectCandidate.empty() && eState == INDEX_NOT_READY)
+				bIndexed = false;
+			else if(vectCandidate.empty())
+			{
+				BeginUnlockedClaim(lock);
+				bIndexed = !IsIndexStale(strJobName);
+				EndUnlockedClaim(lock);
+			}
+			break;
+		}
+		if(!bIndexed)
 		{
-			strJobName = strCurrentJob;
+			std::string strCurrentJob = strJobName.empty() ? SelectWaitingJob() : strJobName;
+			std::vector<std::string> vectWaiting;
+			if(!strCurrentJob.empty())
+			{
+				BeginUnlockedClaim(lock);
+				ListWaitingTasks(strCurrentJob, vectWaiting);
+				EndUnlockedClaim(lock);
+			}
+			vectWaiting.erase(std::remove_if(vectWaiting.begin(), vectWaiting.end(), [&](const std::string& strTaskName)
+			{
+				return IsSkipped(strCurrentJob, strTaskName);
+			}), vectWaiting.end());
+			if(!vectWaiting.empty())
+			{
+				//the selected one goes first, the others stay in the order they are taken.
+				size_t nFirst = SelectCandidate(CountTopPriority(vectWaiting.begin(), vectWaiting.end(), m_nSelectionRange));
+				std::rotate(vectWaiting.begin(), vectWaiting.begin() + nFirst, vectWaiting.begin() + nFirst + 1);
+			}
+			for(size_t i = 0; i < vectWaiting.size() && vectCandidate.size() < nWanted; i++)
+			{
+				ChargeJob(strCurrentJob, 1);
+				vectCandidate.push_back(std::make_pair(strCurrentJob, vectWaiting[i]));
+			}
+		}
+		if(vectCandidate.empty())
 			break;
+
+		//claimed without m_mutex, a claim failed for other reasons ends the pass.
+		std::vector<TakenTask> vectClaim(vectCandidate.size());
+		std::vector<std::string> vectPayloadId(vectCandidate.size());
+		std::vector<int> vectResult;
+		BeginUnlockedClaim(lock);
+		for(size_t i = 0; i < vectCandidate.size(); i++)
+		{
+			vectClaim[i].strJobName = vectCandidate[i].first;
+			vectClaim[i].strTaskName = vectCandidate[i].second;
+			int nResult = ClaimTask(strWorkerName, vectClaim[i].strJobName, vectClaim[i].strTaskName,
+					vectClaim[i].strTaskData, vectPayloadId[i]);
+			vectResult.push_back(nResult);
+			if(nResult != ZOK && nResult != ZNODEEXISTS && nResult != ZNONODE && nResult != CLAIM_BAD_PAYLOAD)
+				break;
+		}
+		EndUnlockedClaim(lock);
+
+		size_t nClaimed = vectTask.size();
+		for(size_t i = 0; i < vectResult.size(); i++)
+		{
+			TakenTask& task = vectClaim[i];
+			int nResult = vectResult[i];
+			if(nResult == ZOK)
+			{
+				m_nClaimed++;
+				if(!vectPayloadId[i].empty())
+					m_mapTaskPayload[std::make_pair(task.strJobName, task.strTaskName)] = vectPayloadId[i];
+				vectTask.push_back(task);
+				continue;
+			}
+			if(nResult == ZNODEEXISTS || nResult == ZNONODE || nResult == CLAIM_BAD_PAYLOAD)
+			{
+				//taken by another worker, finished before it was indexed, or its payload is lost.
+				m_nClaimConflicted += nResult == ZNODEEXISTS ? 1 : 0;
+				m_nClaimDropped += nResult == CLAIM_BAD_PAYLOAD ? 1 : 0;
+				ChargeJob(task.strJobName, -1);
+				setSkipped.insert(vectCandidate[i]);
+				if(nResult == CLAIM_BAD_PAYLOAD)
+					m_setPayloadLost.insert(vectCandidate[i]);
+				continue;
+			}
+			LogDebug() << "take task failed:" << task.strJobName << "/" << task.strTaskName << ",errorcode:" << nResult;
+			m_nClaimFailed++;
+			//not taken by another worker, keep them for the next take.
+			for(; i < vectCandidate.size(); i++)
+			{
+				ChargeJob(vectCandidate[i].first, -1);
+				if(bIndexed)
+					RestoreIndexedTask(vectCandidate[i].first, vectCandidate[i].second);
+			}
+			return vectTask.empty() ? RE_COMMUNICATION : RS_SUCCESS;
 		}
+		if(vectTask.size() == nClaimed)
+			BackoffAfterConflict(++nConflicts, lock);
+	}
+	if(!vectTask.empty())
+		rc = RS_SUCCESS;
+	return rc;
+}
+
+/*
+ * Called without m_mutex between BeginUnlockedClaim and EndUnlockedClaim, create the working node of
+ * the task and read its data. strPayloadId is set for an offloaded task.
+ * @return the zookeeper error code, ZNONODE if the order was removed, CLAIM_BAD_PAYLOAD if the
+ * payload of the task is lost, the order is left for the submitter.
+ */
+int CJobCluster::ClaimTask (const std::string& strWorkerName, const std::string& strJobName,
+		const std::string& strTaskName, std::string& strTaskData, std::string& strPayloadId)
+{
+	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
+	char pathResult[1024];
+	int nResult = zoo_create(this->m_serverHandle, strTaskWorkingPath.c_str(), strWorkerName.c_str(),
+			strWorkerName.size(), &ZOO_OPEN_ACL_UNSAFE, ZOO_EPHEMERAL, pathResult, 1024);
+	if(nResult != ZOK)
+		return nResult;
+
+	std::string strTaskOrderPath = this->GetTaskOrderPath(strJobName, strTaskName);
+	ResultCode rc = ZooGetFileData(strTaskOrderPath, strTaskData);
+	if(RC_FAILED(rc))
+	{
+		//the order was removed after it was listed, or could not be read now, release the claim.
+		zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
+		return rc == RE_NOT_EXISTS ? ZNONODE : ZSYSTEMERROR;
 	}
+	if(!IsPayloadReference(strTaskData))
+		return ZOK;
 
-	this->m_strWorkingJob = strJobName;
-	this->m_strWorkingTask = strTaskName;
+	strPayloadId = strTaskData.substr(PAYLOAD_MAGIC.size());
+	auto pCacheCluster = Stock::CStock::Instance().GetCacheCluster();
+	rc = pCacheCluster == nullptr ? RE_NOT_INITIALIZE
+			: pCacheCluster->GetItemValue(GetPayloadOwner(strJobName), strPayloadId, strTaskData);
+	if(rc == RE_NOT_INITIALIZE || rc == RE_COMMUNICATION || rc == RE_TIME_OUT || rc == RE_ERROR)
+	{
+		//the cache cluster is not avail now, another take may read the payload.
+		LogError() << "get task payload failed:" << strTaskOrderPath << "," << strPayloadId << ",errorcode:" << rc;
+		zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
+		strPayloadId.clear();
+		return ZSYSTEMERROR;
+	}
+	if(RC_FAILED(rc))
+	{
+		//the payload expired or can't be decoded, no worker could run the task. The order is kept,
+		//a cache cluster restored or shared by mistake should not cost the submitter its tasks.
+		LogError() << "task skipped, payload lost:" << strTaskOrderPath << "," << strPayloadId << ",errorcode:" << rc;
+		zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
+		strPayloadId.clear();
+		return CLAIM_BAD_PAYLOAD;
+	}
+	return ZOK;
+}
 
+/*
+ * Called with m_mutex locked by lock, release it for the zookeeper round trips of a claim.
+ * DisconnectFromCluster doesn't close the handle until EndUnlockedClaim is called.
+ */
+void CJobCluster::BeginUnlockedClaim(std::unique_lock<std::mutex>& lock)
+{
+	m_nClaimRunning++;
+	lock.unlock();
+}
 
-	return RS_SUCCESS;
+void CJobCluster::EndUnlockedClaim(std::unique_lock<std::mutex>& lock)
+{
+	lock.lock();
+	m_nClaimRunning--;
+	m_cvUnlockedWork.notify_all();
+}
+
+/*
+ * Called with m_mutex locked, delete the working node so the task is waiting again.
+ */
+void CJobCluster::ReleaseClaim (const std::string& strJobName, const std::string& strTaskName)
+{
+	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
+	m_mapTaskPayload.erase(std::make_pair(strJobName, strTaskName));
+	if(m_serverHandle == nullptr)
+		return;	//the ephemeral working node went with the session.
+	int nResult = zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
+	if(nResult != ZOK && nResult != ZNONODE)
+		LogError() << "release task failed:" << strTaskWorkingPath << ",errorcode:" << nResult;
+}
+
+/*
+ * Keep m_nPrefetchCount tasks claimed in m_deqPrefetched while the taken tasks run.
+ */
+void CJobCluster::PrefetchThread ()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_bStopPrefetch)
+	{
+		if(m_serverHandle == nullptr || m_strWorkerName.empty() || m_deqPrefetched.size() >= m_nPrefetchCount)
+		{
+			m_cvTaskChanged.wait_for(lock, std::chrono::milliseconds(1000));
+			continue;
+		}
+		std::vector<TakenTask> vectTask;
+		std::string strPrefetchJob = m_strPrefetchJob;
+		ClaimTasks(lock, strPrefetchJob, m_nPrefetchCount - m_deqPrefetched.size(), vectTask);
+		//the buffer may be taken, resized or stopped while m_mutex was released.
+		for(auto& task: vectTask)
+		{
+			if(m_bStopPrefetch || m_deqPrefetched.size() >= m_nPrefetchCount
+					|| (!m_strPrefetchJob.empty() && task.strJobName != m_strPrefetchJob))
+				ReleaseClaim(task.strJobName, task.strTaskName);
+			else
+				m_deqPrefetched.push_back(task);
+		}
+		if(vectTask.empty() && !m_bStopPrefetch)
+			m_cvTaskChanged.wait_for(lock, std::chrono::milliseconds(1000));
+	}
+}
 
+void CJobCluster::StopPrefetch ()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStopPrefetch = true;
+	}
+	m_cvTaskChanged.notify_all();
+	if(m_threadPrefetch.joinable())
+		m_threadPrefetch.join();
 }
 
 ResultCode CJobCluster::WaitForNewTask(const std::string& strJobName, int nTimeoutInMS)
@@ -310,7 +909,17 @@ ResultCode CJobCluster::WaitForNewTask(const std::string& strJobName, int nTimeo
 	if(m_serverHandle == nullptr)
 		LogReturn(RE_NOT_INITIALIZE);
 	ResultCode rc = RS_SUCCESS;
-	if(!this->SelectWaitingTask(strJobName).empty())
+	for(auto& task: m_deqPrefetched)
+	{
+		if(strJobName.empty() || task.strJobName == strJobName)
+			return RS_ALREADY_EXISTS;
+	}
+	std::string strIndexedJob = strJobName, strIndexedTask;
+	EnumIndexState eState = SelectIndexedTask(strIndexedJob, strIndexedTask, false);
+	if(eState == INDEX_EMPTY && IsIndexStale(strJobName))
+		eState = INDEX_NOT_READY;
+	if(eState == INDEX_HIT
+			|| (eState == INDEX_NOT_READY && !this->SelectWaitingTask(strJobName).empty()))
 		return RS_ALREADY_EXISTS;
 
 	//no waiting tasks.
@@ -349,33 +958,80 @@ ResultCode CJobCluster::FinishTask (const std::string& strJobName, const std::st
 
 
 
-	std::string strTaskOrderPath = this->GetTaskOrderPath(strJobName, strTaskName);
+	rc = SubmitFinishTask(strJobName, strTaskName).get();
+	return rc;
+}
 
-	int nResult = zoo_delete(this->m_serverHandle, strTaskOrderPath.c_str(), -1);
-	if(nResult != ZOK)
+std::future<ResultCode> CJobCluster::FinishTaskAsync (const std::string& strJobName, const std::string& strTaskName)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::promise<ResultCode> promise;
+	if(this->m_strWorkerName.empty() || m_serverHandle == nullptr)
+		promise.set_value(RE_NOT_INITIALIZE);
+	else if(strJobName.empty() || strTaskName.empty())
+		promise.set_value(RE_INVALIDATE_PARAMETER);
+	else
+		return SubmitFinishTask(strJobName, strTaskName);
+	return promise.get_future();
+}
+
+/*
+ * Called with m_mutex locked, the order and the working node are deleted concurrently. The payload
+ * of an offloaded task is removed by the completion of the order delete, so the cache round trip
+ * is not made under m_mutex, and a payload whose order could not be deleted is kept.
+ */
+std::future<ResultCode> CJobCluster::SubmitFinishTask(const std::string& strJobName, const std::string& strTaskName)
+{
+	struct FinishState
+	{
+		std::promise<ResultCode> promise;
+		std::mutex mutex;
+		int nPending = 2;
+		ResultCode rc = RS_SUCCESS;
+	};
+	auto pState = std::make_shared<FinishState>();
+	std::future<ResultCode> future = pState->promise.get_future();
+	std::string strTaskOrderPath = this->GetTaskOrderPath(strJobName, strTaskName);
+	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
+	m_setWorkingTask.erase(std::make_pair(strJobName, strTaskName));
+	std::vector<std::string> vectPayloadId;
+	auto itPayload = m_mapTaskPayload.find(std::make_pair(strJobName, strTaskName));
+	if(itPayload != m_mapTaskPayload.end())
 	{
-		LogError() << "delete failed:" << strTaskOrderPath;
+		std::string strPayloadPath = this->GetTaskPayloadPath(strJobName, itPayload->second);
+		vectPayloadId.push_back(itPayload->second);
+		m_mapTaskPayload.erase(itPayload);
+		//a marker left behind is removed by TerminateJob.
+		ZooDeleteAsync(strPayloadPath, [strPayloadPath](const ZooResult& result)
+		{
+			if(result.nResult != ZOK && result.nResult != ZNONODE)
+				LogError() << "delete failed:" << strPayloadPath;
+		});
 	}
 
-
-	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
-	if(strTaskWorkingPath.empty())
-		LogReturn(RE_UNEXPECT);
-
-
-	nResult = zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
-	if(nResult != ZOK)
-	{
-		LogError() << "delete failed:" << strTaskWorkingPath;
-		rc = RE_ERROR;
-	}
-
-	this->m_strWorkingJob.clear();
-	this->m_strWorkingTask.clear();
-
-
-	return rc;
-}
+	ZooDeleteAsync(strTaskOrderPath, [pState, strTaskOrderPath, strJobName, vectPayloadId](const ZooResult& result)
+	{
+		if(result.nResult != ZOK)
+			LogError() << "delete failed:" << strTaskOrderPath;
+		else if(!vectPayloadId.empty())
+			RemovePayloads(strJobName, vectPayloadId);
+		std::lock_guard<std::mutex> lock(pState->mutex);
+		if(--pState->nPending == 0)
+			pState->promise.set_value(pState->rc);
+	});
+	ZooDeleteAsync(strTaskWorkingPath, [pState, strTaskWorkingPath](const ZooResult& result)
+	{
+		std::lock_guard<std::mutex> lock(pState->mutex);
+		if(result.nResult != ZOK)
+		{
+			LogError() << "delete failed:" << strTaskWorkingPath;
+			pState->rc = RE_ERROR;
+		}
+		if(--pState->nPending == 0)
+			pState->promise.set_value(pState->rc);
+	});
+	return future;
+}
 
 
 /**
@@ -397,23 +1053,40 @@ ResultCode CJobCluster::ReleaseTask (const std::string& strJobName, const std::s
 	}
 
 
-	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
-	if(strTaskWorkingPath.empty())
-		LogReturn(RE_UNEXPECT);
+	rc = SubmitReleaseTask(strJobName, strTaskName).get();
+	return rc;
+}
 
+std::future<ResultCode> CJobCluster::ReleaseTaskAsync (const std::string& strJobName, const std::string& strTaskName)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::promise<ResultCode> promise;
+	if(this->m_strWorkerName.empty() || m_serverHandle == nullptr)
+		promise.set_value(RE_NOT_INITIALIZE);
+	else if(strJobName.empty() || strTaskName.empty())
+		promise.set_value(RE_INVALIDATE_PARAMETER);
+	else
+		return SubmitReleaseTask(strJobName, strTaskName);
+	return promise.get_future();
+}
 
-	int nResult = zoo_delete(this->m_serverHandle, strTaskWorkingPath.c_str(), -1);
-	if(nResult != ZOK)
+/*
+ * Called with m_mutex locked.
+ */
+std::future<ResultCode> CJobCluster::SubmitReleaseTask(const std::string& strJobName, const std::string& strTaskName)
+{
+	auto pPromise = std::make_shared<std::promise<ResultCode>>();
+	std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, strTaskName);
+	m_setWorkingTask.erase(std::make_pair(strJobName, strTaskName));
+	//the payload is kept for the next worker.
+	m_mapTaskPayload.erase(std::make_pair(strJobName, strTaskName));
+	ZooDeleteAsync(strTaskWorkingPath, [pPromise, strTaskWorkingPath](const ZooResult& result)
 	{
-		LogError() << "delete failed:" << strTaskWorkingPath;
-		rc = RE_ERROR;
-	}
-
-	this->m_strWorkingJob.clear();
-	this->m_strWorkingTask.clear();
-
-
-	return rc;
+		if(result.nResult != ZOK)
+			LogError() << "delete failed:" << strTaskWorkingPath;
+		pPromise->set_value(result.nResult == ZOK ? RS_SUCCESS : RE_ERROR);
+	});
+	return pPromise->get_future();
 }
 
 ResultCode CJobCluster::GetTaskStatus(const std::string& strJobName,
@@ -465,7 +1138,7 @@ ResultCode CJobCluster::GetTaskStatus(const std::string& strJobName,
  * @return ResultCode
  * @param  strJobName
  */
-ResultCode CJobCluster::TerminateJob (const std::string& strJobName)
+ResultCode CJobCluster::TerminateJob (const std::string& strJobName, const DeleteProgressCallback& onProgress)
 {
 
 	LogTrace() << "Job Terminate/Finished:" << strJobName;
@@ -474,6 +1147,8 @@ ResultCode CJobCluster::TerminateJob (const std::string& strJobName)
 	if(strJobName.empty())
 		LogReturn(RE_INVALIDATE_PARAMETER);
 	ResultCode rc = RS_SUCCESS;
+	std::vector<std::string> vectRoot;
+	size_t nBatchSize = 0, nMaxInFlight = 0;
 
 
 	if(RC_FAILED(this->TryLockJob(strJobName, 60*1000)))
@@ -504,25 +1179,39 @@ ResultCode CJobCluster::TerminateJob (const std::string& strJobName)
 		std::string strTaskConfigPath = this->GetJobConfigPath(strJobName);
 		 rc = this->ZooForceDelete(strTaskConfigPath);
 		LogErrorCode(rc) << strTaskConfigPath;
-		std::string strTaskOrderPath = this->GetTaskOrderPath(strJobName, "");
-
-		rc = this->ZooForceDelete(strTaskOrderPath);
-		LogErrorCode(rc);
-
-
-		std::string strTaskWorkingPath = this->GetTaskWorkingPath(strJobName, "");
-		rc = this->ZooForceDelete(strTaskWorkingPath);
-		LogErrorCode(rc);
-
-		std::string strTaskResultPath = this->GetTaskResultPath(strJobName, "");
-		rc = this->ZooForceDelete(strTaskResultPath);
-		LogErrorCode(rc);
+		if(m_serverHandle == nullptr)
+		{
+			rc = RE_NOT_INITIALIZE;
+			goto Out;
+		}
+		vectRoot.push_back(this->GetTaskOrderPath(strJobName, ""));
+		vectRoot.push_back(this->GetTaskWorkingPath(strJobName, ""));
+		vectRoot.push_back(this->GetTaskResultPath(strJobName, ""));
+		vectRoot.push_back(this->GetJobCounterPath(strJobName, ""));
+		vectRoot.push_back(this->GetTaskPayloadPath(strJobName, ""));
+		nBatchSize = m_nDeleteBatchSize;
+		nMaxInFlight = m_nDeleteMaxInFlight;
+		m_nBulkDeleteRunning++;
+	}
 
-		std::string strJobCounterPath = this->GetJobCounterPath(strJobName, "");
-		rc = this->ZooForceDelete(strJobCounterPath);
-		LogErrorCode(rc);
-		rc = RS_SUCCESS;
+	//the tasks and results are removed without m_mutex, DisconnectFromCluster waits for it.
+	{
+		//the markers list the payloads of the tasks not finished.
+		auto pPromise = std::make_shared<std::promise<ZooResult>>();
+		std::future<ZooResult> future = pPromise->get_future();
+		ZooReadDirAsync(this->GetTaskPayloadPath(strJobName, ""), ToPromise(pPromise), false);
+		ZooResult result = future.get();
+		if(result.nResult == ZOK)
+			RemovePayloads(strJobName, result.vectChildren);
+	}
+	rc = ZooBulkDelete(vectRoot, nBatchSize, nMaxInFlight, onProgress);
+	LogErrorCode(rc);
+	rc = RS_SUCCESS;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_nBulkDeleteRunning--;
 	}
+	m_cvUnlockedWork.notify_all();
 
 Out:
 
@@ -549,7 +1238,8 @@ ResultCode CJobCluster::AddTaskResult_ (const std::string& strJobName, const std
 		LogReturn(RE_NOT_INITIALIZE);
 	if(strJobName.empty() || strResultName.empty())
 		LogReturn(RE_INVALIDATE_PARAMETER);
-	if(strJobName != this->m_strWorkingJob)
+	auto itWorking = m_setWorkingTask.lower_bound(std::make_pair(strJobName, std::string()));
+	if(itWorking == m_setWorkingTask.end() || itWorking->first != strJobName)
 		LogReturn(RE_INVALIDATE_PARAMETER);
 	std::string strResultPath = this->GetTaskResultPath(strJobName, strResultName);
 //	ZOOAPI int zoo_create(zhandle_t *zh, const char *path, const char *value,
@@ -686,6 +1376,22 @@ ResultCode CJobCluster::GetJobConfig (const std::string& strJobName, std::string
 	return ZooGetFileData(strJobConfigPath, strJobConfigData);
 }
 
+std::future<CJobCluster::AsyncResult> CJobCluster::GetJobConfigAsync (const std::string& strJobName)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto pPromise = std::make_shared<std::promise<AsyncResult>>();
+	if(m_serverHandle == nullptr || strJobName.empty())
+	{
+		pPromise->set_value(AsyncResult{m_serverHandle == nullptr ? RE_NOT_INITIALIZE : RE_INVALIDATE_PARAMETER, ""});
+		return pPromise->get_future();
+	}
+	ZooGetFileDataAsync(this->GetJobConfigPath(strJobName), [pPromise](const ZooResult& result)
+	{
+		pPromise->set_value(AsyncResult{result.nResult == ZOK ? RS_SUCCESS : ZooReadError(result.nResult), result.strValue});
+	});
+	return pPromise->get_future();
+}
+
 void CJobCluster::Split(const std::string& strValue, const std::string& strDelim,
 		std::vector<std::string>& vectResult)
 {
@@ -714,6 +1420,7 @@ std::string CJobCluster::SelectWaitingJob()
 		return "";
 	}
 
+	OrderJobsBySchedule(vectJobName);
 	for(auto strJobName: vectJobName)
 	{
 		if(!SelectWaitingTask(strJobName).empty())
@@ -743,65 +1450,561 @@ std::string CJobCluster::SelectWaitingTask(const std::string& strJobName)
 
 	for(auto strJobName: vectJobName)
 	{
-		std::string strJobOrderPath = this->GetTaskOrderPath(strJobName, "");
-		std::string strJobWorkingPath = this->GetTaskWorkingPath(strJobName, "");
-		std::vector<std::string> vectOrder, vectWorking, vectWaiting;
-		rc = this->ZooReadDir(strJobOrderPath, vectOrder);
-		if(RC_FAILED(rc))
-			continue;
-		rc = this->ZooReadDir(strJobWorkingPath, vectWorking);
+		std::vector<std::string> vectWaiting;
+		rc = ListWaitingTasks(strJobName, vectWaiting);
 		if(RC_FAILED(rc))
 			continue;
-		std::sort(vectOrder.begin(), vectOrder.end());
-		std::sort(vectWorking.begin(), vectWorking.end());
-		std::set_difference(vectOrder.begin(), vectOrder.end(), vectWorking.begin(), vectWorking.end(), std::back_inserter(vectWaiting));
 		if(!vectWaiting.empty())
-			return vectWaiting[0];//return random so that servers will not always competing on the same task
+			return vectWaiting[SelectCandidate(CountTopPriority(vectWaiting.begin(), vectWaiting.end(), m_nSelectionRange))];//so that servers will not always competing on the same task
 	}
 
 	return "";
 }
 
-//ResultCode CServerCordinator::EnumJobName(std::vector<std::string>& vectJobName) const
-//{
-//}
+/*
+ * The waiting tasks of the job in order, the ordering tasks which have no working node.
+ */
+ResultCode CJobCluster::ListWaitingTasks(const std::string& strJobName, std::vector<std::string>& vectWaiting)
+{
+	std::string strJobOrderPath = this->GetTaskOrderPath(strJobName, "");
+	std::string strJobWorkingPath = this->GetTaskWorkingPath(strJobName, "");
+	//both directories are read concurrently.
+	std::future<ZooResult> futureOrder = ZooReadDirAsync(strJobOrderPath);
+	std::future<ZooResult> futureWorking = ZooReadDirAsync(strJobWorkingPath);
+	ZooResult resultOrder = futureOrder.get(), resultWorking = futureWorking.get();
+	if(resultOrder.nResult != ZOK || resultWorking.nResult != ZOK)
+	{
+		LogTrace() << "zoo_get_children failed on :" << strJobOrderPath << " or " << strJobWorkingPath;
+		return RE_ERROR;
+	}
+	std::vector<std::string>& vectOrder = resultOrder.vectChildren;
+	std::vector<std::string>& vectWorking = resultWorking.vectChildren;
+	std::sort(vectOrder.begin(), vectOrder.end());
+	std::sort(vectWorking.begin(), vectWorking.end());
+	vectWaiting.clear();
+	std::set_difference(vectOrder.begin(), vectOrder.end(), vectWorking.begin(), vectWorking.end(), std::back_inserter(vectWaiting));
+	std::sort(vectWaiting.begin(), vectWaiting.end(), TaskOrderLess());
+	return RS_SUCCESS;
+}
 
-ResultCode CJobCluster::ZooGetFileData(const std::string& strFilePath, std::string& strData)
+void CJobCluster::SetTaskSelection(EnumTaskSelection eSelection, size_t nRange)
 {
-	Stat stat;
-	if(strFilePath.empty())
-		LogReturn(RE_INVALIDATE_PARAMETER);
-	int nResult = zoo_exists(this->m_serverHandle, strFilePath.c_str(), 0, &stat);
-	if(nResult != ZOK)
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_eTaskSelection = eSelection;
+	m_nSelectionRange = nRange == 0 ? 1 : nRange;
+}
+
+void CJobCluster::SetClaimBackoff(int nBaseInMS, int nMaxInMS)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nBackoffBaseInMS = nBaseInMS < 0 ? 0 : nBaseInMS;
+	m_nBackoffMaxInMS = nMaxInMS < m_nBackoffBaseInMS ? m_nBackoffBaseInMS : nMaxInMS;
+}
+
+CJobCluster::ClaimStatistics CJobCluster::GetClaimStatistics() const
+{
+	ClaimStatistics statistics;
+	statistics.nClaimed = m_nClaimed;
+	statistics.nConflicted = m_nClaimConflicted;
+	statistics.nFailed = m_nClaimFailed;
+	statistics.nDropped = m_nClaimDropped;
+	return statistics;
+}
+
+void CJobCluster::ResetClaimStatistics()
+{
+	m_nClaimed = 0;
+	m_nClaimConflicted = 0;
+	m_nClaimFailed = 0;
+	m_nClaimDropped = 0;
+}
+
+CJobCluster::EnumTaskPriority CJobCluster::GetTaskPriority(const std::string& strTaskName)
+{
+	if(strTaskName.size() > 4 && strTaskName[4] == 'H')
+		return TASK_PRIORITY_HIGH;
+	if(strTaskName.size() > 4 && strTaskName[4] == 'L')
+		return TASK_PRIORITY_LOW;
+	return TASK_PRIORITY_NORMAL;
+}
+
+/*
+ * The normal tasks keep the name they always had, the sequence number follows the prefix.
+ */
+std::string CJobCluster::GetTaskPrefix(EnumTaskPriority ePriority)
+{
+	switch(ePriority)
+	{
+	case TASK_PRIORITY_HIGH:
+		return "TaskH";
+	case TASK_PRIORITY_LOW:
+		return "TaskL";
+	default:
+		return "Task";
+	}
+}
+
+bool CJobCluster::TaskOrderLess::operator()(const std::string& strLeft, const std::string& strRight) const
+{
+	//the tasks of a class have the same prefix, so the names are in the sequence order.
+	EnumTaskPriority eLeft = GetTaskPriority(strLeft), eRight = GetTaskPriority(strRight);
+	if(eLeft != eRight)
+		return eLeft < eRight;
+	return strLeft < strRight;
+}
+
+/*
+ * The leading tasks of the first task's class in the ordered waiting tasks, at most nMaxCount,
+ * the candidates of SelectCandidate are not taken from a lower class.
+ */
+template<typename Iterator>
+size_t CJobCluster::CountTopPriority(Iterator itBegin, Iterator itEnd, size_t nMaxCount)
+{
+	size_t nCount = 0;
+	if(itBegin == itEnd)
+		return 0;
+	EnumTaskPriority eTop = GetTaskPriority(*itBegin);
+	for(Iterator it = itBegin; it != itEnd && nCount < nMaxCount && GetTaskPriority(*it) == eTop; ++it)
+		nCount++;
+	return nCount;
+}
+
+void CJobCluster::SetJobWeight(const std::string& strJobName, size_t nWeight)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	JobSchedule& schedule = m_mapJobSchedule[strJobName];
+	schedule.nWeight = nWeight == 0 ? 1 : nWeight;
+}
+
+void CJobCluster::GetJobShares(std::map<std::string, JobShare>& mapShare)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	mapShare.clear();
+	size_t nTotalServed = 0, nTotalWeight = 0;
+	for(auto& item: m_mapJobSchedule)
+	{
+		nTotalServed += item.second.nServed;
+		nTotalWeight += item.second.nServed == 0 ? 0 : item.second.nWeight;
+	}
+	for(auto& item: m_mapJobSchedule)
+	{
+		JobShare& share = mapShare[item.first];
+		share.nWeight = item.second.nWeight;
+		share.nServed = item.second.nServed;
+		share.dShare = nTotalServed == 0 ? 0 : (double)item.second.nServed / nTotalServed;
+		share.dWeightShare = item.second.nServed == 0 ? 0 : (double)item.second.nWeight / nTotalWeight;
+	}
+}
+
+void CJobCluster::ResetJobShares()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(auto& item: m_mapJobSchedule)
+	{
+		item.second.nServed = 0;
+		item.second.dPass = 0;
+	}
+	m_dVirtualPass = 0;
+}
+
+/*
+ * Called with m_mutex locked, a job idle or not served yet is not behind the job served last.
+ */
+double CJobCluster::GetJobPass(const std::string& strJobName) const
+{
+	auto it = m_mapJobSchedule.find(strJobName);
+	if(it == m_mapJobSchedule.end())
+		return m_dVirtualPass;
+	return std::max(it->second.dPass, m_dVirtualPass);
+}
+
+void CJobCluster::ChargeJob(const std::string& strJobName, int nCount)
+{
+	JobSchedule& schedule = m_mapJobSchedule[strJobName];
+	if(nCount > 0)
 	{
-		LogDebug() << "GetTaskResult failed:" << strFilePath ;
-		LogReturn(RE_NOT_EXISTS);
+		schedule.dPass = std::max(schedule.dPass, m_dVirtualPass);
+		m_dVirtualPass = schedule.dPass;
 	}
+	schedule.dPass += (double)nCount / schedule.nWeight;
+	schedule.nServed = nCount < 0 && schedule.nServed < size_t(-nCount) ? 0 : schedule.nServed + nCount;
+}
 
+void CJobCluster::OrderJobsBySchedule(std::vector<std::string>& vectJobName) const
+{
+	std::stable_sort(vectJobName.begin(), vectJobName.end(), [this](const std::string& strLeft, const std::string& strRight)
+	{
+		return GetJobPass(strLeft) < GetJobPass(strRight);
+	});
+}
 
-	int nBufferSize = stat.dataLength + 1;
-	char* pBuffer = new char[nBufferSize];
-	if(pBuffer == nullptr)
+/*
+ * Called with m_mutex locked, the position of the task to take in the sorted waiting tasks.
+ */
+size_t CJobCluster::SelectCandidate(size_t nWaitingCount)
+{
+	size_t nRange = std::min(nWaitingCount, m_nSelectionRange);
+	if(nRange <= 1)
+		return 0;
+	std::uniform_int_distribution<size_t> distribution(0, nRange - 1);
+	switch(m_eTaskSelection)
 	{
-		delete []pBuffer;
-		LogDebug() << "GetTaskResult failed:" << strFilePath ; ", out of resource!";
-		LogReturn(RE_OUT_OF_RESOURCE);
+	case SELECT_RANDOM:
+		return distribution(m_randomEngine);
+	case SELECT_WORKER_HASH:
+		return std::hash<std::string>()(m_strWorkerName) % nRange;
+	case SELECT_TWO_CHOICES:
+		return std::min(distribution(m_randomEngine), distribution(m_randomEngine));
+	default:
+		return 0;
 	}
+}
+
+/*
+ * Called with m_mutex locked by lock, full jitter so the losers of a claim don't retry together.
+ * m_mutex is released while waiting, a task change ends the wait early.
+ */
+void CJobCluster::BackoffAfterConflict(int nConflicts, std::unique_lock<std::mutex>& lock)
+{
+	if(m_nBackoffBaseInMS <= 0 || nConflicts <= 0)
+		return;
+	long long nLimit = (long long)m_nBackoffBaseInMS << std::min(nConflicts - 1, 20);
+	if(nLimit > m_nBackoffMaxInMS)
+		nLimit = m_nBackoffMaxInMS;
+	std::uniform_int_distribution<long long> distribution(0, nLimit);
+	m_cvTaskChanged.wait_for(lock, std::chrono::milliseconds(distribution(m_randomEngine)));
+}
+
+void CJobCluster::StartTaskIndex()
+{
+	std::lock_guard<std::mutex> lock(m_mutexIndex);
+	m_pIndexHandle = m_serverHandle;
+	m_mapTaskIndex.clear();
+	m_bJobListLoaded = false;
+	m_bJobListPending = false;
+	m_nJobListCVersion = -1;
+	LoadIndexDir("", false);
+}
 
-//		ZOOAPI int zoo_get(zhandle_t *zh, const char *path, int watch, char *buffer,
-//		                   int* buffer_len, struct Stat *stat);
+/*
+ * Called before the handle is closed, the completions delivered by zookeeper_close are ignored.
+ */
+void CJobCluster::StopTaskIndex()
+{
+	std::lock_guard<std::mutex> lock(m_mutexIndex);
+	m_pIndexHandle = nullptr;
+	m_mapTaskIndex.clear();
+	m_bJobListLoaded = false;
+	m_bJobListPending = false;
+}
 
+/*
+ * Called with m_mutexIndex locked, list the directory and set the child watch again,
+ * an empty job name is the job list.
+ */
+void CJobCluster::LoadIndexDir(const std::string& strJobName, bool bWorking)
+{
+	if(m_pIndexHandle == nullptr)
+		return;
+	std::string strDirPath;
+	bool* pPending = nullptr;
+	if(strJobName.empty())
+	{
+		strDirPath = GetJobConfigPath("");
+		pPending = &m_bJobListPending;
+	}
+	else
+	{
+		auto it = m_mapTaskIndex.find(strJobName);
+		if(it == m_mapTaskIndex.end())
+			return;
+		strDirPath = bWorking ? GetTaskWorkingPath(strJobName, "") : GetTaskOrderPath(strJobName, "");
+		pPending = bWorking ? &it->second.bWorkingPending : &it->second.bOrderPending;
+	}
+	if(*pPending)
+		return;
 
-	nResult = zoo_get(this->m_serverHandle, strFilePath.c_str(), 0, pBuffer, &nBufferSize, nullptr);
+	IndexRequest* pRequest = new IndexRequest{this, m_pIndexHandle, strJobName, bWorking};
+	int nResult = zoo_awget_children2(m_pIndexHandle, strDirPath.c_str(), CJobCluster::OnIndexDirChanged, this,
+			CJobCluster::OnIndexDirLoaded, pRequest);
 	if(nResult != ZOK)
 	{
-		delete []pBuffer;
-		LogDebug() << "GetTaskResult failed:" << strFilePath ;
-		LogReturn(RE_INVALIDATE_DATA);
+		LogDebug() << "watch directory failed:" << strDirPath << ",errorcode:" << nResult;
+		delete pRequest;
+		return;
+	}
+	*pPending = true;
+}
+
+void CJobCluster::OnIndexDirChanged(zhandle_t* zh, int type, int state, const char* path, void* watcherCtx)
+{
+	CJobCluster* pThis = (CJobCluster*)watcherCtx;
+	if(pThis == nullptr || type == ZOO_SESSION_EVENT || path == nullptr)
+		return;
+	std::string strPath = path;
+	std::string strOrderRoot = pThis->GetTaskOrderPath("", "") + "/";
+	std::string strWorkingRoot = pThis->GetTaskWorkingPath("", "") + "/";
+	{
+		std::lock_guard<std::mutex> lock(pThis->m_mutexIndex);
+		if(zh != pThis->m_pIndexHandle)
+			return;
+		if(strPath == pThis->GetJobConfigPath(""))
+			pThis->LoadIndexDir("", false);
+		else if(strPath.compare(0, strOrderRoot.size(), strOrderRoot) == 0)
+			pThis->LoadIndexDir(strPath.substr(strOrderRoot.size()), false);
+		else if(strPath.compare(0, strWorkingRoot.size(), strWorkingRoot) == 0)
+			pThis->LoadIndexDir(strPath.substr(strWorkingRoot.size()), true);
+	}
+	pThis->m_cvTaskChanged.notify_all();
+}
+
+void CJobCluster::OnIndexDirLoaded(int rc, const struct String_vector* strings, const struct Stat* stat, const void* data)
+{
+	IndexRequest* pRequest = (IndexRequest*)data;
+	CJobCluster* pThis = pRequest->pThis;
+	{
+		std::lock_guard<std::mutex> lock(pThis->m_mutexIndex);
+		if(pRequest->pHandle == pThis->m_pIndexHandle)
+		{
+			if(pRequest->strJobName.empty())
+			{
+				pThis->m_bJobListPending = false;
+				if(rc == ZOK)
+				{
+					pThis->UpdateJobList(strings);
+					pThis->m_nJobListCVersion = stat->cversion;
+				}
+			}
+			else
+			{
+				auto it = pThis->m_mapTaskIndex.find(pRequest->strJobName);
+				if(it != pThis->m_mapTaskIndex.end())
+				{
+					TaskIndex& index = it->second;
+					(pRequest->bWorking ? index.bWorkingPending : index.bOrderPending) = false;
+					if(rc == ZOK)
+					{
+						pThis->UpdateTaskDir(index, pRequest->bWorking, strings);
+						(pRequest->bWorking ? index.nWorkingCVersion : index.nOrderCVersion) = stat->cversion;
+					}
+					else	//not created yet or removed, TakeTask loads it again.
+						(pRequest->bWorking ? index.bWorkingLoaded : index.bOrderLoaded) = false;
+				}
+			}
+		}
+	}
+	delete pRequest;
+	pThis->m_cvTaskChanged.notify_all();
+}
+
+/*
+ * Called with m_mutexIndex locked.
+ */
+void CJobCluster::UpdateJobList(const struct String_vector* strings)
+{
+	std::set<std::string> setJob;
+	for(int i = 0; strings != nullptr && i < strings->count; i++)
+		setJob.insert(strings->data[i]);
+	for(auto it = m_mapTaskIndex.begin(); it != m_mapTaskIndex.end();)
+	{
+		if(setJob.count(it->first) == 0)
+			it = m_mapTaskIndex.erase(it);
+		else
+			++it;
+	}
+	for(auto& strJobName: setJob)
+	{
+		if(m_mapTaskIndex.count(strJobName) != 0)
+			continue;
+		m_mapTaskIndex[strJobName];
+		LoadIndexDir(strJobName, false);
+		LoadIndexDir(strJobName, true);
+	}
+	m_bJobListLoaded = true;
+}
+
+/*
+ * Called with m_mutexIndex locked, apply the difference from the last listing to the waiting set.
+ */
+void CJobCluster::UpdateTaskDir(TaskIndex& index, bool bWorking, const struct String_vector* strings)
+{
+	std::set<std::string> setChildren;
+	for(int i = 0; strings != nullptr && i < strings->count; i++)
+		setChildren.insert(strings->data[i]);
+	std::set<std::string>& setOld = bWorking ? index.setWorking : index.setOrder;
+	std::vector<std::string> vectAdded, vectRemoved;
+	std::set_difference(setChildren.begin(), setChildren.end(), setOld.begin(), setOld.end(), std::back_inserter(vectAdded));
+	std::set_difference(setOld.begin(), setOld.end(), setChildren.begin(), setChildren.end(), std::back_inserter(vectRemoved));
+	if(bWorking)
+	{
+		for(auto& strTask: vectAdded)
+			index.setWaiting.erase(strTask);
+		for(auto& strTask: vectRemoved)
+			if(index.setOrder.count(strTask) != 0)
+				index.setWaiting.insert(strTask);
+		index.bWorkingLoaded = true;
+	}
+	else
+	{
+		for(auto& strTask: vectRemoved)
+			index.setWaiting.erase(strTask);
+		for(auto& strTask: vectAdded)
+			if(index.setWorking.count(strTask) == 0)
+				index.setWaiting.insert(strTask);
+		index.bOrderLoaded = true;
 	}
+	setOld.swap(setChildren);
+}
 
-	strData.assign(pBuffer, nBufferSize);
-	delete []pBuffer;
+/*
+ * Pick a waiting task of the job, or of any job if strJobName is empty. A taken task is removed
+ * from the index at once, so the threads of this process don't compete on it.
+ */
+CJobCluster::EnumIndexState CJobCluster::SelectIndexedTask(std::string& strJobName, std::string& strTaskName, bool bTake)
+{
+	std::lock_guard<std::mutex> lock(m_mutexIndex);
+	if(m_pIndexHandle == nullptr || !m_bJobListLoaded)
+		return INDEX_NOT_READY;
+	bool bNotReady = false;
+	//the job of the highest class waiting, then of the smallest pass.
+	std::map<std::string, TaskIndex>::iterator itSelected = m_mapTaskIndex.end();
+	EnumTaskPriority eSelected = TASK_PRIORITY_LOW;
+	double dSelectedPass = 0;
+	for(auto it = strJobName.empty() ? m_mapTaskIndex.begin() : m_mapTaskIndex.find(strJobName);
+			it != m_mapTaskIndex.end(); ++it)
+	{
+		TaskIndex& index = it->second;
+		if(!index.bOrderLoaded || !index.bWorkingLoaded)
+		{
+			LoadIndexDir(it->first, false);
+			LoadIndexDir(it->first, true);
+			bNotReady = true;
+		}
+		else if(!index.setWaiting.empty())
+		{
+			EnumTaskPriority ePriority = GetTaskPriority(*index.setWaiting.begin());
+			double dPass = GetJobPass(it->first);
+			if(itSelected == m_mapTaskIndex.end() || ePriority < eSelected
+					|| (ePriority == eSelected && dPass < dSelectedPass))
+			{
+				itSelected = it;
+				eSelected = ePriority;
+				dSelectedPass = dPass;
+			}
+		}
+		if(!strJobName.empty())
+			break;
+	}
+	if(itSelected != m_mapTaskIndex.end())
+	{
+		std::set<std::string, TaskOrderLess>& setWaiting = itSelected->second.setWaiting;
+		size_t nRange = CountTopPriority(setWaiting.begin(), setWaiting.end(), m_nSelectionRange);
+		auto itTask = std::next(setWaiting.begin(), SelectCandidate(nRange));
+		strJobName = itSelected->first;
+		strTaskName = *itTask;
+		if(bTake)
+			setWaiting.erase(itTask);
+		return INDEX_HIT;
+	}
+	//a job not in the list yet is not ready either.
+	if(!strJobName.empty() && m_mapTaskIndex.count(strJobName) == 0)
+		bNotReady = true;
+	return bNotReady ? INDEX_NOT_READY : INDEX_EMPTY;
+}
+
+void CJobCluster::RestoreIndexedTask(const std::string& strJobName, const std::string& strTaskName)
+{
+	std::lock_guard<std::mutex> lock(m_mutexIndex);
+	auto it = m_mapTaskIndex.find(strJobName);
+	if(it != m_mapTaskIndex.end() && it->second.setOrder.count(strTaskName) != 0
+			&& it->second.setWorking.count(strTaskName) == 0)
+		it->second.setWaiting.insert(strTaskName);
+}
+
+/*
+ * The watch notification may not be delivered yet when another client has just added a task,
+ * compare the child versions of the indexed directories with the server before the index is
+ * taken as empty, so a take right after an add still finds the task. Only the directories of
+ * strJobName are compared when it is given.
+ */
+bool CJobCluster::IsIndexStale(const std::string& strJobName)
+{
+	std::vector<std::pair<std::string, int>> vectDir;
+	{
+		std::lock_guard<std::mutex> lock(m_mutexIndex);
+		if(strJobName.empty())
+			vectDir.push_back(std::make_pair(GetJobConfigPath(""), m_nJobListCVersion));
+		for(auto it = strJobName.empty() ? m_mapTaskIndex.begin() : m_mapTaskIndex.find(strJobName);
+				it != m_mapTaskIndex.end(); ++it)
+		{
+			vectDir.push_back(std::make_pair(GetTaskOrderPath(it->first, ""), it->second.nOrderCVersion));
+			vectDir.push_back(std::make_pair(GetTaskWorkingPath(it->first, ""), it->second.nWorkingCVersion));
+			if(!strJobName.empty())
+				break;
+		}
+	}
+	//one round trip for all the directories, the exists are submitted before any is waited for.
+	std::vector<std::future<ZooResult>> vectFuture;
+	for(auto& dir: vectDir)
+		vectFuture.push_back(ZooExistsAsync(dir.first));
+	for(size_t i = 0; i < vectDir.size(); i++)
+	{
+		ZooResult result = vectFuture[i].get();
+		if(result.nResult != ZOK || result.stat.cversion != vectDir[i].second)
+			return true;
+	}
+	return false;
+}
+
+//ResultCode CServerCordinator::EnumJobName(std::vector<std::string>& vectJobName) const
+//{
+//}
+
+ResultCode CJobCluster::ZooGetFileData(const std::string& strFilePath, std::string& strData)
+{
+	if(strFilePath.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	std::string strBuffer = m_bufferPool.Acquire(0);
+	for(int retry = 0; ; retry++)
+	{
+		Stat stat;
+		int nBufferSize = (int)strBuffer.size();
+		int nResult = zoo_get(this->m_serverHandle, strFilePath.c_str(), 0, &strBuffer[0], &nBufferSize, &stat);
+		if(nResult != ZOK)
+		{
+			m_bufferPool.Release(std::move(strBuffer));
+			LogDebug() << "GetFileData failed:" << strFilePath << ",errorcode:" << nResult;
+			ResultCode rc = ZooReadError(nResult);
+			LogReturn(rc);
+		}
+		if(stat.dataLength <= (int)strBuffer.size())
+		{
+			strData.assign(strBuffer.data(), nBufferSize < 0 ? 0 : nBufferSize);	//-1 for a node without data
+			break;
+		}
+		//truncated, read again with a buffer of the full size.
+		m_bufferPool.Release(std::move(strBuffer));
+		if(retry >= RETRY_COUNT)
+		{
+			LogDebug() << "GetFileData failed:" << strFilePath << ", the data keeps changing";
+			LogReturn(RE_INVALIDATE_DATA);
+		}
+		strBuffer = m_bufferPool.Acquire(stat.dataLength);
+	}
+	m_bufferPool.Release(std::move(strBuffer));
+	return RS_SUCCESS;
+}
+
+/*
+ * The result of a failed read, the synchronous and the asynchronous reads report the same.
+ */
+ResultCode CJobCluster::ZooReadError(int nResult)
+{
+	if(nResult == ZNONODE)
+		return RE_NOT_EXISTS;
+	if(nResult == ZCONNECTIONLOSS || nResult == ZOPERATIONTIMEOUT || nResult == ZSESSIONEXPIRED || nResult == ZCLOSING)
+		return RE_COMMUNICATION;
+	return RE_INVALIDATE_DATA;
 }
 
 ResultCode CJobCluster::ZooReadDir(const std::string& strDirPath, std::vector<std::string>& vectChildren)
@@ -825,41 +2028,72 @@ ResultCode CJobCluster::ZooReadDir(const std::string& strDirPath, std::vector<st
 	return RS_SUCCESS;
 }
 
+/*
+ * Called with m_mutex locked. The directory itself is created optimistically, an existing one
+ * counts as created, so the usual case is one round trip. When its parent is missing, the
+ * missing part below the deepest ancestor known to exist is created in one zoo_multi, and only
+ * if that fails, node by node from the root down.
+ * Only the ancestors are remembered in m_setKnownDir, a job directory itself may be deleted by
+ * TerminateJob of any client.
+ */
 ResultCode CJobCluster::ZooCreateDirChain(const std::string& strDirPath)
 {
-	Stat stat;
-	std::string strPath;
-	std::vector<std::string> vectNode;
-	char buffer[1024];
-	int nResult = 0;
 	if(strDirPath.empty())
 		LogReturn(RE_INVALIDATE_PARAMETER);
-
+	std::vector<std::string> vectNode, vectPath;
 	this->Split(strDirPath, "/", vectNode);
-
-
-	for(auto strNode:vectNode)
+	for(auto& strNode: vectNode)
 	{
-		if(strNode.empty()) continue;
-		strPath += "/" + strNode;
-		nResult = zoo_exists(this->m_serverHandle, strPath.c_str(), 0, &stat);
-		if(nResult == ZOK)
-			continue;
-//		int nResult = zoo_create(this->m_serverHandle, strJobConfigPath.c_str(), strJobConfigData.c_str(),
-//					strJobConfigData.size(), &ZOO_OPEN_ACL_UNSAFE, 0, pathResult, 1024);
-		nResult = zoo_create(this->m_serverHandle, strPath.c_str(), strPath.c_str(),
-				0, &ZOO_OPEN_ACL_UNSAFE, 0, buffer, 1024);
+		if(!strNode.empty())
+			vectPath.push_back((vectPath.empty() ? "" : vectPath.back()) + "/" + strNode);
+	}
+	if(vectPath.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
 
-		if(nResult != ZOK)
+	char buffer[1024];
+	int nLast = (int)vectPath.size() - 1;
+	m_nDirCreateRoundTrips++;
+	int nResult = zoo_create(this->m_serverHandle, vectPath[nLast].c_str(), "", 0,
+			&ZOO_OPEN_ACL_UNSAFE, 0, buffer, sizeof(buffer));
+	if(nResult == ZNODEEXISTS)
+		nResult = ZOK;
+	else if(nResult == ZNONODE)
+	{
+		int nKnown = nLast - 1;
+		while(nKnown >= 0 && m_setKnownDir.count(vectPath[nKnown]) == 0)
+			nKnown--;
+		std::vector<zoo_op_t> vectOp(nLast - nKnown);
+		std::vector<zoo_op_result_t> vectResult(vectOp.size());
+		for(size_t i = 0; i < vectOp.size(); i++)
 		{
-			LogErrorCode(RE_ERROR) << strPath;
-			return RE_ERROR;
+			zoo_create_op_init(&vectOp[i], vectPath[nKnown + 1 + i].c_str(), "", 0,
+					&ZOO_OPEN_ACL_UNSAFE, 0, nullptr, 0);
+		}
+		m_nDirCreateRoundTrips++;
+		nResult = zoo_multi(this->m_serverHandle, (int)vectOp.size(), vectOp.data(), vectResult.data());
+		if(nResult == ZNONODE || nResult == ZNODEEXISTS)
+		{
+			//created by another client in between, or a known ancestor was removed.
+			for(auto& strPath: vectPath)
+				m_setKnownDir.erase(strPath);
+			for(auto& strPath: vectPath)
+			{
+				m_nDirCreateRoundTrips++;
+				nResult = zoo_create(this->m_serverHandle, strPath.c_str(), "", 0,
+						&ZOO_OPEN_ACL_UNSAFE, 0, buffer, sizeof(buffer));
+				if(nResult != ZOK && nResult != ZNODEEXISTS)
+					break;
+			}
 		}
-
 	}
-
+	if(nResult != ZOK && nResult != ZNODEEXISTS)
+	{
+		LogErrorCode(RE_ERROR) << vectPath[nLast] << ",errorcode:" << nResult;
+		return RE_ERROR;
+	}
+	for(int i = 0; i < nLast; i++)
+		m_setKnownDir.insert(vectPath[i]);
 	return RS_SUCCESS;
-
 }
 
 bool CJobCluster::ZooFileExists(const std::string& strFilePath)
@@ -879,27 +2113,365 @@ ResultCode CJobCluster::ZooForceDelete(const std::string& strDirPath)
 {
 	if(strDirPath.empty())
 		LogReturn(RE_INVALIDATE_PARAMETER);
-	ResultCode rc = RS_SUCCESS;
-	std::vector<std::string> vectChildren;
-	int nResult;
-	rc = this->ZooReadDir(strDirPath, vectChildren);
-	//LogErrorCode(rc);
-	LogDebug() << "ReadDir: child count:" << vectChildren.size();
-	for(auto& child:vectChildren)
+	ZooBulkDelete(std::vector<std::string>(1, strDirPath), m_nDeleteBatchSize, m_nDeleteMaxInFlight, nullptr);
+	return RS_SUCCESS;
+}
+
+ResultCode CJobCluster::ZooBulkDelete(const std::vector<std::string>& vectRoot, size_t nBatchSize, size_t nMaxInFlight,
+		const DeleteProgressCallback& onProgress)
+{
+	struct DeleteBatch
+	{
+		std::vector<std::string> vectPath;
+		std::vector<zoo_op_t> vectOp;
+		std::vector<zoo_op_result_t> vectResult;
+	};
+	struct BulkDeleteState
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t nInFlight = 0;
+		std::deque<std::pair<std::string, size_t>> deqToList;	//path and depth
+		std::vector<std::vector<std::string>> vectLevel;	//paths by depth
+		std::deque<DeleteBatch> deqBatch;	//batches of the current level, not moved once submitted
+		std::vector<std::string> vectRetry;	//paths of the failed batches
+		DeleteProgress progress{0, 0, 0};
+	};
+	if(nBatchSize == 0)
+		nBatchSize = 1;
+	if(nMaxInFlight == 0)
+		nMaxInFlight = 1;
+	BulkDeleteState state;
+	state.vectLevel.push_back(vectRoot);
+	for(auto& strRoot: vectRoot)
+		state.deqToList.push_back(std::make_pair(strRoot, 0));
+	state.progress.nListed = vectRoot.size();
+
+	//report on the calling thread, without the state locked.
+	DeleteProgress lastReported{size_t(-1), 0, 0};
+	auto report = [&](std::unique_lock<std::mutex>& lock)
 	{
-		if(child.empty()) continue;
-		rc = ZooForceDelete(strDirPath + "/" + child);
-		LogErrorCode(rc) << strDirPath + "/" + child;
+		if(!onProgress || (state.progress.nListed == lastReported.nListed
+				&& state.progress.nDeleted == lastReported.nDeleted && state.progress.nFailed == lastReported.nFailed))
+			return;
+		lastReported = state.progress;
+		lock.unlock();
+		onProgress(lastReported);
+		lock.lock();
+	};
+
+	//walk the trees breadth first.
+	std::unique_lock<std::mutex> lock(state.mutex);
+	while(!state.deqToList.empty() || state.nInFlight > 0)
+	{
+		while(!state.deqToList.empty() && state.nInFlight < nMaxInFlight && !m_bCancelUnlockedWork)
+		{
+			std::pair<std::string, size_t> node = state.deqToList.front();
+			state.deqToList.pop_front();
+			state.nInFlight++;
+			lock.unlock();
+			ZooReadDirAsync(node.first, [&state, node](const ZooResult& result)
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.nInFlight--;
+				if(!result.vectChildren.empty() && state.vectLevel.size() <= node.second + 1)
+					state.vectLevel.resize(node.second + 2);
+				for(auto& child: result.vectChildren)
+				{
+					if(child.empty())
+						continue;
+					std::string strPath = node.first + "/" + child;
+					state.vectLevel[node.second + 1].push_back(strPath);
+					state.deqToList.push_back(std::make_pair(strPath, node.second + 1));
+					state.progress.nListed++;
+				}
+				state.cv.notify_all();
+			}, false);
+			lock.lock();
+		}
+		if(m_bCancelUnlockedWork)
+			state.deqToList.clear();
+		if(state.nInFlight > 0)
+			state.cv.wait(lock);
+		report(lock);
 	}
 
-	nResult = zoo_delete(this->m_serverHandle, strDirPath.c_str(), -1);
-	if(nResult != ZOK)
+	//delete from the deepest level up, a level is done before its parents.
+	for(size_t nLevel = state.vectLevel.size(); nLevel-- > 0 && !m_bCancelUnlockedWork;)
 	{
-		LogDebug() << RE_ERROR << ":" << strDirPath;
+		std::vector<std::string>& vectPath = state.vectLevel[nLevel];
+		state.deqBatch.clear();
+		for(size_t i = 0; i < vectPath.size(); i += nBatchSize)
+		{
+			state.deqBatch.push_back(DeleteBatch());
+			state.deqBatch.back().vectPath.assign(vectPath.begin() + i, vectPath.begin() + std::min(i + nBatchSize, vectPath.size()));
+		}
+		size_t nNextBatch = 0;
+		while(nNextBatch < state.deqBatch.size() || !state.vectRetry.empty() || state.nInFlight > 0)
+		{
+			while(!state.vectRetry.empty() && state.nInFlight < nMaxInFlight && !m_bCancelUnlockedWork)
+			{
+				std::string strPath = state.vectRetry.back();
+				state.vectRetry.pop_back();
+				state.nInFlight++;
+				lock.unlock();
+				ZooDeleteAsync(strPath, [&state, strPath](const ZooResult& result)
+				{
+					std::lock_guard<std::mutex> lock(state.mutex);
+					state.nInFlight--;
+					if(result.nResult == ZOK || result.nResult == ZNONODE)
+						state.progress.nDeleted++;
+					else
+					{
+						LogDebug() << RE_ERROR << ":" << strPath << ",errorcode:" << result.nResult;
+						state.progress.nFailed++;
+					}
+					state.cv.notify_all();
+				});
+				lock.lock();
+			}
+			while(nNextBatch < state.deqBatch.size() && state.nInFlight < nMaxInFlight && !m_bCancelUnlockedWork)
+			{
+				DeleteBatch& batch = state.deqBatch[nNextBatch++];
+				batch.vectOp.resize(batch.vectPath.size());
+				batch.vectResult.resize(batch.vectPath.size());
+				for(size_t i = 0; i < batch.vectPath.size(); i++)
+					zoo_delete_op_init(&batch.vectOp[i], batch.vectPath[i].c_str(), -1);
+				state.nInFlight++;
+				lock.unlock();
+				auto pCallback = new ZooCallback([&state, &batch](const ZooResult& result)
+				{
+					std::lock_guard<std::mutex> lock(state.mutex);
+					state.nInFlight--;
+					if(result.nResult == ZOK)
+						state.progress.nDeleted += batch.vectPath.size();
+					else	//some node is gone or not empty, delete them one by one.
+						state.vectRetry.insert(state.vectRetry.end(), batch.vectPath.begin(), batch.vectPath.end());
+					state.cv.notify_all();
+				});
+				int nResult = zoo_amulti(this->m_serverHandle, (int)batch.vectOp.size(), batch.vectOp.data(),
+						batch.vectResult.data(), CJobCluster::OnZooVoidCompleted, pCallback);
+				if(nResult != ZOK)
+					OnZooVoidCompleted(nResult, pCallback);
+				lock.lock();
+			}
+			if(m_bCancelUnlockedWork)
+			{
+				nNextBatch = state.deqBatch.size();
+				state.vectRetry.clear();
+			}
+			if(state.nInFlight > 0)
+				state.cv.wait(lock);
+			report(lock);
+		}
 	}
+	report(lock);
+	if(m_bCancelUnlockedWork)
+	{
+		LogDebug() << "bulk delete cancelled, deleted:" << state.progress.nDeleted << "/" << state.progress.nListed;
+		LogReturn(RE_ERROR);
+	}
+	return state.progress.nFailed == 0 ? RS_SUCCESS : RE_ERROR;
+}
+
+void CJobCluster::ZooGetFileDataAsync(const std::string& strFilePath, const ZooCallback& callback)
+{
+	ZooCallback* pCallback = new ZooCallback(callback);
+	int nResult = zoo_aget(this->m_serverHandle, strFilePath.c_str(), 0, CJobCluster::OnZooDataCompleted, pCallback);
+	if(nResult != ZOK)
+		OnZooVoidCompleted(nResult, pCallback);
+}
+
+void CJobCluster::ZooReadDirAsync(const std::string& strDirPath, const ZooCallback& callback, bool bWatch)
+{
+	ZooCallback* pCallback = new ZooCallback(callback);
+	//watch as ZooReadDir by default, so that WaitForNewTask is notified when the dir changed.
+	int nResult = zoo_aget_children(this->m_serverHandle, strDirPath.c_str(), bWatch ? 1 : 0,
+			CJobCluster::OnZooStringsCompleted, pCallback);
+	if(nResult != ZOK)
+		OnZooVoidCompleted(nResult, pCallback);
+}
+
+void CJobCluster::ZooCreateAsync(const std::string& strPath, const std::string& strData, int nFlags,
+		const ZooCallback& callback)
+{
+	ZooCallback* pCallback = new ZooCallback(callback);
+	int nResult = zoo_acreate(this->m_serverHandle, strPath.c_str(), strData.data(), (int)strData.size(),
+			&ZOO_OPEN_ACL_UNSAFE, nFlags, CJobCluster::OnZooStringCompleted, pCallback);
+	if(nResult != ZOK)
+		OnZooVoidCompleted(nResult, pCallback);
+}
+
+void CJobCluster::ZooDeleteAsync(const std::string& strPath, const ZooCallback& callback)
+{
+	ZooCallback* pCallback = new ZooCallback(callback);
+	int nResult = zoo_adelete(this->m_serverHandle, strPath.c_str(), -1, CJobCluster::OnZooVoidCompleted, pCallback);
+	if(nResult != ZOK)
+		OnZooVoidCompleted(nResult, pCallback);
+}
+
+void CJobCluster::ZooExistsAsync(const std::string& strPath, const ZooCallback& callback)
+{
+	ZooCallback* pCallback = new ZooCallback(callback);
+	int nResult = zoo_aexists(this->m_serverHandle, strPath.c_str(), 0, CJobCluster::OnZooStatCompleted, pCallback);
+	if(nResult != ZOK)
+		OnZooVoidCompleted(nResult, pCallback);
+}
+
+std::future<CJobCluster::ZooResult> CJobCluster::ZooGetFileDataAsync(const std::string& strFilePath)
+{
+	auto pPromise = std::make_shared<std::promise<ZooResult>>();
+	ZooGetFileDataAsync(strFilePath, ToPromise(pPromise));
+	return pPromise->get_future();
+}
+
+std::future<CJobCluster::ZooResult> CJobCluster::ZooReadDirAsync(const std::string& strDirPath)
+{
+	auto pPromise = std::make_shared<std::promise<ZooResult>>();
+	ZooReadDirAsync(strDirPath, ToPromise(pPromise));
+	return pPromise->get_future();
+}
+
+std::future<CJobCluster::ZooResult> CJobCluster::ZooCreateAsync(const std::string& strPath, const std::string& strData,
+		int nFlags)
+{
+	auto pPromise = std::make_shared<std::promise<ZooResult>>();
+	ZooCreateAsync(strPath, strData, nFlags, ToPromise(pPromise));
+	return pPromise->get_future();
+}
+
+std::future<CJobCluster::ZooResult> CJobCluster::ZooDeleteAsync(const std::string& strPath)
+{
+	auto pPromise = std::make_shared<std::promise<ZooResult>>();
+	ZooDeleteAsync(strPath, ToPromise(pPromise));
+	return pPromise->get_future();
+}
+
+std::future<CJobCluster::ZooResult> CJobCluster::ZooExistsAsync(const std::string& strPath)
+{
+	auto pPromise = std::make_shared<std::promise<ZooResult>>();
+	ZooExistsAsync(strPath, ToPromise(pPromise));
+	return pPromise->get_future();
+}
+
+CJobCluster::ZooCallback CJobCluster::ToPromise(const std::shared_ptr<std::promise<ZooResult>>& pPromise)
+{
+	return [pPromise](const ZooResult& result){pPromise->set_value(result);};
+}
+
+void CJobCluster::OnZooStringCompleted(int rc, const char* value, const void* data)
+{
+	ZooResult result;
+	result.nResult = rc;
+	if(rc == ZOK && value != nullptr)
+		result.strValue = value;
+	CompleteZooRequest(data, result);
+}
+
+void CJobCluster::OnZooDataCompleted(int rc, const char* value, int value_len, const struct Stat* stat, const void* data)
+{
+	ZooResult result;
+	result.nResult = rc;
+	if(rc == ZOK && value != nullptr && value_len > 0)
+		result.strValue.assign(value, value_len);
+	if(rc == ZOK && stat != nullptr)
+		result.stat = *stat;
+	CompleteZooRequest(data, result);
+}
+
+void CJobCluster::OnZooStringsCompleted(int rc, const struct String_vector* strings, const void* data)
+{
+	ZooResult result;
+	result.nResult = rc;
+	for(int i = 0; rc == ZOK && strings != nullptr && i < strings->count; i++)
+		result.vectChildren.push_back(strings->data[i]);
+	CompleteZooRequest(data, result);
+}
+
+void CJobCluster::OnZooStatCompleted(int rc, const struct Stat* stat, const void* data)
+{
+	ZooResult result;
+	result.nResult = rc;
+	if(rc == ZOK && stat != nullptr)
+		result.stat = *stat;
+	CompleteZooRequest(data, result);
+}
+
+void CJobCluster::OnZooVoidCompleted(int rc, const void* data)
+{
+	ZooResult result;
+	result.nResult = rc;
+	CompleteZooRequest(data, result);
+}
+
+void CJobCluster::CompleteZooRequest(const void* data, ZooResult& result)
+{
+	ZooCallback* pCallback = (ZooCallback*)data;
+	(*pCallback)(result);
+	delete pCallback;
+}
+
+void CJobCluster::SetBulkDeleteOption (size_t nBatchSize, size_t nMaxInFlight)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nDeleteBatchSize = nBatchSize == 0 ? 1 : nBatchSize;
+	m_nDeleteMaxInFlight = nMaxInFlight == 0 ? 1 : nMaxInFlight;
+}
+
+void CJobCluster::SetPayloadOffload (size_t nThreshold, size_t nLifeCycleInSecond)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nPayloadThreshold = nThreshold;
+	m_nPayloadLifeCycle = nLifeCycleInSecond;
+}
+
+bool CJobCluster::IsPayloadReference(const std::string& strTaskData)
+{
+	return strTaskData.compare(0, PAYLOAD_MAGIC.size(), PAYLOAD_MAGIC) == 0;
+}
+
+bool CJobCluster::NeedOffload(const std::string& strTaskData) const
+{
+	//kept inline it would be taken for a reference, OffloadPayload fails without a cache cluster.
+	if(IsPayloadReference(strTaskData))
+		return true;
+	return strTaskData.size() > m_nPayloadThreshold && Stock::CStock::Instance().GetCacheCluster() != nullptr;
+}
+
+/*
+ * Called with m_mutex locked, the payload id is unique without a round trip.
+ */
+ResultCode CJobCluster::OffloadPayload(const std::string& strJobName, const std::string& strTaskData,
+		std::string& strPayloadId)
+{
+	auto pCacheCluster = Stock::CStock::Instance().GetCacheCluster();
+	if(pCacheCluster == nullptr)
+		LogReturn(RE_NOT_INITIALIZE);
+	std::ostringstream os;
+	os << std::hex << std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count()
+			<< "-" << m_randomEngine() << m_randomEngine();
+	strPayloadId = os.str();
+	ResultCode rc = pCacheCluster->SetItemValue(GetPayloadOwner(strJobName), strPayloadId, strTaskData,
+			m_nPayloadLifeCycle);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
 	return RS_SUCCESS;
 }
 
+void CJobCluster::RemovePayloads(const std::string& strJobName, const std::vector<std::string>& vectPayloadId)
+{
+	auto pCacheCluster = Stock::CStock::Instance().GetCacheCluster();
+	if(pCacheCluster == nullptr)
+		return;
+	for(auto& strPayloadId: vectPayloadId)
+	{
+		ResultCode rc = pCacheCluster->RemoveItemValue(GetPayloadOwner(strJobName), strPayloadId);
+		if(RC_FAILED(rc) && rc != RE_NOT_EXISTS)
+			LogError() << "remove task payload failed:" << strJobName << "," << strPayloadId << ",errorcode:" << rc;
+	}
+}
+
 ResultCode CJobCluster::TryLockJob(const std::string& strJobName, int nTimeOutInMS)
 {
 	auto pCacheCluster = Stock::CStock::Instance().GetCacheCluster();
@@ -9,7 +9,15 @@
 #include <mutex>
 #include <condition_variable>
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <random>
 #include "ResultCode.h"
+#include "BufferPool.h"
 using namespace Stock;
 
 /**
@@ -97,12 +105,53 @@ public:
 	size_t GetWorkerCount ();
 
 
+	/*
+	 * The priority class of a task, the waiting tasks of a higher class are taken first, the
+	 * tasks of a class are taken in the order they were added. The class is kept in the task
+	 * name, so the waiting tasks are ordered without reading their data.
+	 */
+	enum EnumTaskPriority{
+		TASK_PRIORITY_HIGH = 0,
+		TASK_PRIORITY_NORMAL = 1,
+		TASK_PRIORITY_LOW = 2
+	};
+	static EnumTaskPriority GetTaskPriority(const std::string& strTaskName);
+
+
 	/**
 	 * @return ResultCode
 	 * @param  strJobName
 	 * @param  strTaskData
+	 * @param  ePriority
+	 */
+	ResultCode AddTask (const std::string& strJobName, const std::string& strTaskData, std::string& strTaskName,
+			EnumTaskPriority ePriority = TASK_PRIORITY_NORMAL);
+
+
+	/**
+	 * Add the tasks in zoo_multi transactions of at most nBatchSize creates, a batch is also cut
+	 * before its data reaches MAX_BATCH_DATA_SIZE so the request fits the server's jute.maxbuffer.
+	 * @return ResultCode
+	 * @param  strJobName
+	 * @param  vectTaskData
+	 * @param  vectTaskName
+	 * 		[out]:the names of the created tasks in the order of vectTaskData. Each batch is created
+	 * 			all or nothing, when failed, it has the names of the batches created before.
+	 * @param  nBatchSize
+	 */
+	ResultCode AddTasks (const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+			std::vector<std::string>& vectTaskName, size_t nBatchSize = 256,
+			EnumTaskPriority ePriority = TASK_PRIORITY_NORMAL);
+
+
+	/**
+	 * Same as AddTasks, but keeps up to nMaxInFlight batches submitted with zoo_amulti instead of
+	 * waiting for each round trip, returns when all batches are completed.
+	 * 		[out]vectTaskName: when failed, it has the names of all the batches which were created.
 	 */
-	ResultCode AddTask (const std::string& strJobName, const std::string& strTaskData, std::string& strTaskName);
+	ResultCode AddTasksAsync (const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+			std::vector<std::string>& vectTaskName, size_t nBatchSize = 256, size_t nMaxInFlight = 8,
+			EnumTaskPriority ePriority = TASK_PRIORITY_NORMAL);
 
 
 	/**
@@ -117,6 +166,118 @@ public:
 	 * 		[out]:the task's data
 	 */
 	ResultCode TakeTask (std::string& strJobName, std::string& strTaskName, std::string& strTaskData);
+
+
+	/*
+	 * How TakeTask picks among the waiting tasks of a job. The candidates are the nRange oldest
+	 * waiting tasks, so the tasks are still taken roughly in order while the idle workers don't
+	 * all compete on the same one.
+	 * 		SELECT_FIRST: the oldest task.
+	 * 		SELECT_RANDOM: a random one of the candidates.
+	 * 		SELECT_WORKER_HASH: the candidate at an offset hashed from the worker name, the workers
+	 * 			start on different tasks without any randomness.
+	 * 		SELECT_TWO_CHOICES: the older one of two random candidates.
+	 */
+	enum EnumTaskSelection{
+		SELECT_FIRST,
+		SELECT_RANDOM,
+		SELECT_WORKER_HASH,
+		SELECT_TWO_CHOICES
+	};
+	void SetTaskSelection(EnumTaskSelection eSelection, size_t nRange = 16);
+
+
+	/*
+	 * After a claim conflict, TakeTask waits a random time up to nBaseInMS * 2^(conflicts - 1),
+	 * at most nMaxInMS, before picking again. The other calls are not blocked meanwhile, and a
+	 * task change ends the wait. nBaseInMS = 0 disables the backoff.
+	 */
+	void SetClaimBackoff(int nBaseInMS, int nMaxInMS);
+
+
+	/*
+	 * When TakeTask takes a task of any job, the jobs with a waiting task of the highest priority
+	 * class are served by stride scheduling: each job advances its pass by 1/weight per task
+	 * taken and the job of the smallest pass is served, so the jobs get the tasks of this worker
+	 * in proportion to their weights. A job coming back from idle starts at the current pass
+	 * instead of the credit it would have saved. The weights and the service are local to this
+	 * worker, the workers of a cluster set the same weights.
+	 * @param  nWeight: 1 by default, 0 is taken as 1.
+	 */
+	void SetJobWeight(const std::string& strJobName, size_t nWeight);
+
+	/*
+	 * The tasks served to a job by this worker since created or ResetJobShares.
+	 * nWeight: the weight of the job.
+	 * nServed: the tasks taken, the prefetched tasks included.
+	 * dShare: nServed of the tasks taken of all jobs.
+	 * dWeightShare: nWeight of the weights of all the jobs served, the share due when all of
+	 * 		them are always waiting.
+	 */
+	struct JobShare
+	{
+		size_t nWeight;
+		size_t nServed;
+		double dShare;
+		double dWeightShare;
+	};
+	void GetJobShares(std::map<std::string, JobShare>& mapShare);
+	void ResetJobShares();
+
+
+	/*
+	 * Counters of the task claims of this client since connected or reset.
+	 * nClaimed: the tasks taken.
+	 * nConflicted: the claims lost to another worker which created the working node first.
+	 * nFailed: the claims failed for other reasons.
+	 * nDropped: the claims given up because the offloaded payload of the task was lost, the task
+	 * is left waiting and skipped by this client until it connects again.
+	 */
+	struct ClaimStatistics
+	{
+		size_t nClaimed;
+		size_t nConflicted;
+		size_t nFailed;
+		size_t nDropped;
+	};
+	ClaimStatistics GetClaimStatistics() const;
+	void ResetClaimStatistics();
+
+	struct TakenTask
+	{
+		std::string strJobName;
+		std::string strTaskName;
+		std::string strTaskData;
+	};
+	/**
+	 * Take up to nMaxCount tasks in one pass, the prefetched tasks are returned first. Each taken
+	 * task is finished or released separately.
+	 * @return ResultCode
+	 * 		RE_NOT_EXISTS: no waiting task.
+	 * @param  strJobName: the job of the tasks, any job if empty.
+	 * @param  nMaxCount
+	 * @param  vectTask
+	 * 		[out]:the tasks taken, may be less than nMaxCount.
+	 */
+	ResultCode TakeTasks (const std::string& strJobName, size_t nMaxCount, std::vector<TakenTask>& vectTask);
+
+
+	/**
+	 * Keep up to nCount tasks claimed ahead by a background thread while the taken tasks run,
+	 * TakeTask and TakeTasks return them without a round trip. The prefetched tasks are released
+	 * when the worker is unregistered or disconnected, and when they no longer fit the setting.
+	 * @param  nCount: 0 disables the prefetch.
+	 * @param  strJobName: prefetch the tasks of this job only, any job if empty.
+	 */
+	void SetPrefetchCount (size_t nCount, const std::string& strJobName = "");
+
+
+	/**
+	 * @return the tasks claimed ahead and not taken yet.
+	 */
+	size_t GetPrefetchedTaskCount ();
+
+
 	enum EnumTaskStatus{
 		TASK_STATUS_WAITING = 0X01,
 		TASK_STATUS_RUNNING = 0X02,
@@ -148,11 +309,47 @@ public:
 	ResultCode ReleaseTask (const std::string& strJobName, const std::string& strTaskName);
 
 
+	/*
+	 * Progress of a bulk delete, nListed grows while the tree is walked, so it is the total
+	 * only when the walk is done.
+	 */
+	struct DeleteProgress
+	{
+		size_t nListed;
+		size_t nDeleted;
+		size_t nFailed;
+	};
+	typedef std::function<void(const DeleteProgress&)> DeleteProgressCallback;
+
+
 	/**
+	 * Delete the job and all its tasks and results. The tree is removed by the bulk delete engine
+	 * without m_mutex held, so the other calls of this client go on while a large job is removed.
 	 * @return ResultCode
 	 * @param  strJobName
+	 * @param  onProgress: called on the calling thread while the tree is removed.
+	 */
+	ResultCode TerminateJob (const std::string& strJobName,
+			const DeleteProgressCallback& onProgress = DeleteProgressCallback());
+
+
+	/**
+	 * @param  nBatchSize deletes in one zoo_multi.
+	 * @param  nMaxInFlight requests of a bulk delete kept submitted.
 	 */
-	ResultCode TerminateJob (const std::string& strJobName);
+	void SetBulkDeleteOption (size_t nBatchSize, size_t nMaxInFlight);
+
+
+	/**
+	 * Task data larger than nThreshold is kept in the cache cluster and zookeeper holds only a
+	 * reference to it, the data is resolved when the task is taken and removed when the task is
+	 * finished or the job is terminated. The data is kept inline when there is no cache cluster.
+	 * Off by default, the payload lives only as long as the cache cluster keeps it, a task whose
+	 * payload is lost stays waiting for the submitter to remove or add it again.
+	 * @param  nThreshold: size_t(-1) keeps all the task data in zookeeper, the default.
+	 * @param  nLifeCycleInSecond: the payloads expire in case they are never removed.
+	 */
+	void SetPayloadOffload (size_t nThreshold, size_t nLifeCycleInSecond = 7*24*3600);
 
 
 	/**
@@ -205,6 +402,24 @@ public:
 	 */
 	ResultCode GetJobConfig (const std::string& strJobName, std::string& strJobConfigData);
 
+
+	/*
+	 * Asynchronous versions of AddTask, GetJobConfig, FinishTask and ReleaseTask. The requests are
+	 * submitted before return and the futures are ready when the server replied, so the callers
+	 * can keep many requests in flight. A request not replied before DisconnectFromCluster gets
+	 * an error. Don't wait on the futures in a zookeeper watcher or completion.
+	 */
+	struct AsyncResult
+	{
+		ResultCode rc;
+		std::string strValue;	//the task name of AddTaskAsync, the config data of GetJobConfigAsync
+	};
+	std::future<AsyncResult> AddTaskAsync (const std::string& strJobName, const std::string& strTaskData,
+			EnumTaskPriority ePriority = TASK_PRIORITY_NORMAL);
+	std::future<AsyncResult> GetJobConfigAsync (const std::string& strJobName);
+	std::future<ResultCode> FinishTaskAsync (const std::string& strJobName, const std::string& strTaskName);
+	std::future<ResultCode> ReleaseTaskAsync (const std::string& strJobName, const std::string& strTaskName);
+
 protected:
 
 	static void OnStatusChanged(zhandle_t* zh, int type, int state,
@@ -225,12 +440,88 @@ protected:
 	}
 	//ResultCode EnumJobName(std::vector<std::string>& vectJobName) const ;
 	static void Split(const std::string& strValue, const std::string& strDelim, std::vector<std::string>& vectItem) ;
+	/*
+	 * Read the data with one zoo_get into a pooled buffer, copied into strData, so the buffer goes
+	 * back to m_bufferPool and strData keeps its own capacity for the next read.
+	 */
 	ResultCode ZooGetFileData(const std::string& strFilePath, std::string& strData);
+	static ResultCode ZooReadError(int nResult);
+	CBufferPool m_bufferPool;
 	ResultCode ZooReadDir(const std::string& strDirPath, std::vector<std::string>& vectChildren);
 	ResultCode ZooCreateDirChain(const std::string& strDirPath);
+	std::set<std::string> m_setKnownDir;	//ancestors of the created directories, guarded by m_mutex
+	size_t m_nDirCreateRoundTrips = 0;	//zoo_create/zoo_multi calls of ZooCreateDirChain, guarded by m_mutex
 	bool ZooFileExists(const std::string& strFilePath);
 	ResultCode ZooForceDelete(const std::string& strDirPath);
 
+	/*
+	 * Remove the trees, may be called without m_mutex when m_nBulkDeleteRunning is counted.
+	 * The trees are walked breadth first with up to nMaxInFlight children reads submitted, then
+	 * deleted from the deepest level up in zoo_multi batches, up to nMaxInFlight batches submitted.
+	 * A failed batch is deleted node by node. DisconnectFromCluster cancels it.
+	 */
+	ResultCode ZooBulkDelete(const std::vector<std::string>& vectRoot, size_t nBatchSize, size_t nMaxInFlight,
+			const DeleteProgressCallback& onProgress);
+	size_t m_nDeleteBatchSize = 500;
+	size_t m_nDeleteMaxInFlight = 16;
+	int m_nBulkDeleteRunning = 0;	//guarded by m_mutex
+	int m_nAddTasksRunning = 0;	//AddTasksAsync waiting for its batches without m_mutex, guarded by m_mutex
+	std::atomic<bool> m_bCancelUnlockedWork{false};
+	std::condition_variable m_cvUnlockedWork;
+
+	/*
+	 * The asynchronous zookeeper calls, the callback runs on the zookeeper thread when the server
+	 * replied, or at once with the error when the request could not be submitted. The overloads
+	 * without a callback return a future of the result.
+	 */
+	struct ZooResult
+	{
+		int nResult = ZOK;
+		std::string strValue;	//the data of get, the created path of create
+		std::vector<std::string> vectChildren;
+		Stat stat;
+	};
+	typedef std::function<void(const ZooResult&)> ZooCallback;
+	void ZooGetFileDataAsync(const std::string& strFilePath, const ZooCallback& callback);
+	void ZooReadDirAsync(const std::string& strDirPath, const ZooCallback& callback, bool bWatch = true);
+	void ZooCreateAsync(const std::string& strPath, const std::string& strData, int nFlags, const ZooCallback& callback);
+	void ZooDeleteAsync(const std::string& strPath, const ZooCallback& callback);
+	void ZooExistsAsync(const std::string& strPath, const ZooCallback& callback);
+	std::future<ZooResult> ZooGetFileDataAsync(const std::string& strFilePath);
+	std::future<ZooResult> ZooReadDirAsync(const std::string& strDirPath);
+	std::future<ZooResult> ZooCreateAsync(const std::string& strPath, const std::string& strData, int nFlags);
+	std::future<ZooResult> ZooDeleteAsync(const std::string& strPath);
+	std::future<ZooResult> ZooExistsAsync(const std::string& strPath);
+	static ZooCallback ToPromise(const std::shared_ptr<std::promise<ZooResult>>& pPromise);
+	static void OnZooStringCompleted(int rc, const char* value, const void* data);
+	static void OnZooDataCompleted(int rc, const char* value, int value_len, const struct Stat* stat, const void* data);
+	static void OnZooStringsCompleted(int rc, const struct String_vector* strings, const void* data);
+	static void OnZooStatCompleted(int rc, const struct Stat* stat, const void* data);
+	static void OnZooVoidCompleted(int rc, const void* data);
+	static void CompleteZooRequest(const void* data, ZooResult& result);
+
+	std::future<ResultCode> SubmitFinishTask(const std::string& strJobName, const std::string& strTaskName);
+	std::future<ResultCode> SubmitReleaseTask(const std::string& strJobName, const std::string& strTaskName);
+
+	/*
+	 * The offloaded task data, the order node holds PAYLOAD_MAGIC and the payload id, the payload
+	 * is the item id of the owner "TaskPayload:<job>" in the cache cluster, and the marker node
+	 * <payload root>/<job>/<id> is created with the task so TerminateJob finds the payloads.
+	 * Data starting with PAYLOAD_MAGIC is always offloaded, so it is never taken for a reference.
+	 */
+	static const std::string PAYLOAD_MAGIC;
+	static bool IsPayloadReference(const std::string& strTaskData);
+	static std::string GetPayloadOwner(const std::string& strJobName) {return "TaskPayload:" + strJobName;}
+	bool NeedOffload(const std::string& strTaskData) const;
+	ResultCode OffloadPayload(const std::string& strJobName, const std::string& strTaskData, std::string& strPayloadId);
+	static void RemovePayloads(const std::string& strJobName, const std::vector<std::string>& vectPayloadId);
+	size_t m_nPayloadThreshold = size_t(-1);
+	size_t m_nPayloadLifeCycle = 7*24*3600;
+	//payload id of the offloaded tasks taken or prefetched by this worker, guarded by m_mutex
+	std::map<std::pair<std::string, std::string>, std::string> m_mapTaskPayload;
+	//tasks whose payload was lost, not claimed again until reconnected, guarded by m_mutex
+	std::set<std::pair<std::string, std::string>> m_setPayloadLost;
+
 
 	//  
 
@@ -239,7 +530,7 @@ protected:
 
 	std::string m_strWorkerName;
 	zhandle_t *m_serverHandle = nullptr;
-	std::string m_strWorkingJob, m_strWorkingTask;
+	std::set<std::pair<std::string, std::string>> m_setWorkingTask;	//job and task taken by this worker
 
 	size_t m_nLastChangeTimestamp = 1;
 	std::mutex m_mutex;
@@ -285,11 +576,161 @@ protected:
 	{
 		return m_strResultRoot + ToPath(strJob) + ToPath(strResultName);
 	}
+	const std::string m_strPayloadRoot = "/stock_analyzer/payload";
+	std::string GetTaskPayloadPath(const std::string& strJob, const std::string& strPayloadId) const
+	{
+		return m_strPayloadRoot + ToPath(strJob) + ToPath(strPayloadId);
+	}
 	//clientid_t* m_pClientID = nullptr;
 
 
+	static const size_t MAX_BATCH_DATA_SIZE = 512 * 1024;
+	struct TaskBatch;
+	struct AsyncBatchContext
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t nInFlight = 0;
+		bool bFailed = false;
+	};
+	struct TaskBatch
+	{
+		size_t nFirst = 0;	//the first task in vectTaskData
+		size_t nCount = 0;
+		std::vector<zoo_op_t> vectOp;
+		std::vector<zoo_op_result_t> vectResult;
+		std::vector<std::vector<char>> vectPathBuffer;
+		std::vector<std::string> vectReference;	//the data written for the offloaded tasks
+		std::vector<std::string> vectPayloadId;
+		std::vector<std::string> vectPayloadPath;	//the markers, created after the tasks
+		bool bSubmitted = false;
+		int nResult = ZOK;
+		AsyncBatchContext* pContext = nullptr;
+	};
+	static void SplitTaskBatches(const std::vector<std::string>& vectTaskData, size_t nBatchSize,
+			std::vector<TaskBatch>& vectBatch);
+	ResultCode InitTaskBatch(const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+			EnumTaskPriority ePriority, TaskBatch& batch);
+	ResultCode CreateTasks(const std::string& strJobName, const std::vector<std::string>& vectTaskData,
+			std::vector<std::string>& vectTaskName, size_t nBatchSize, EnumTaskPriority ePriority);
+	static void CollectTaskNames(const TaskBatch& batch, std::vector<std::string>& vectTaskName);
+	static void OnTaskBatchCreated(int rc, const void* data);
+
+	ResultCode TakePrefetchedTasks(const std::string& strJobName, size_t nMaxCount, std::vector<TakenTask>& vectTask);
+	ResultCode ClaimTasks(std::unique_lock<std::mutex>& lock, const std::string& strJobName, size_t nMaxCount,
+			std::vector<TakenTask>& vectTask);
+	int ClaimTask(const std::string& strWorkerName, const std::string& strJobName, const std::string& strTaskName,
+			std::string& strTaskData, std::string& strPayloadId);
+	static const int CLAIM_BAD_PAYLOAD = 1;	//not a zookeeper error code, they are never positive
+	void ReleaseClaim(const std::string& strJobName, const std::string& strTaskName);
+	void BeginUnlockedClaim(std::unique_lock<std::mutex>& lock);
+	void EndUnlockedClaim(std::unique_lock<std::mutex>& lock);
+	int m_nClaimRunning = 0;	//the claims running without m_mutex, guarded by m_mutex
+	void PrefetchThread();
+	void StopPrefetch();
+
+	//guarded by m_mutex
+	std::deque<TakenTask> m_deqPrefetched;
+	size_t m_nPrefetchCount = 0;
+	std::string m_strPrefetchJob;
+	bool m_bStopPrefetch = false;
+	std::thread m_threadPrefetch;
+
 	std::string SelectWaitingJob();
 	std::string SelectWaitingTask(const std::string& strJobName);
+	ResultCode ListWaitingTasks(const std::string& strJobName, std::vector<std::string>& vectWaiting);
+	size_t SelectCandidate(size_t nWaitingCount);
+	void BackoffAfterConflict(int nConflicts, std::unique_lock<std::mutex>& lock);
+	static std::string GetTaskPrefix(EnumTaskPriority ePriority);
+	template<typename Iterator>
+	static size_t CountTopPriority(Iterator itBegin, Iterator itEnd, size_t nMaxCount);
+
+	/*
+	 * The stride schedule of the jobs, guarded by m_mutex. ChargeJob advances the pass of the job
+	 * when a task is selected, a negative count refunds a task which was not taken.
+	 */
+	struct JobSchedule
+	{
+		size_t nWeight = 1;
+		size_t nServed = 0;
+		double dPass = 0;
+	};
+	std::map<std::string, JobSchedule> m_mapJobSchedule;
+	double m_dVirtualPass = 0;	//the pass of the job served last
+	double GetJobPass(const std::string& strJobName) const;
+	void ChargeJob(const std::string& strJobName, int nCount);
+	void OrderJobsBySchedule(std::vector<std::string>& vectJobName) const;
+
+	//guarded by m_mutex
+	EnumTaskSelection m_eTaskSelection = SELECT_RANDOM;
+	size_t m_nSelectionRange = 16;
+	int m_nBackoffBaseInMS = 1;
+	int m_nBackoffMaxInMS = 64;
+	std::mt19937 m_randomEngine{std::random_device()()};
+
+	std::atomic<size_t> m_nClaimed{0};
+	std::atomic<size_t> m_nClaimConflicted{0};
+	std::atomic<size_t> m_nClaimFailed{0};
+	std::atomic<size_t> m_nClaimDropped{0};
+
+
+	/*
+	 * The order the waiting tasks are taken, the higher priority class first, then the sequence
+	 * number zookeeper appended to the name.
+	 */
+	struct TaskOrderLess
+	{
+		bool operator()(const std::string& strLeft, const std::string& strRight) const;
+	};
+
+	/*
+	 * Index of the waiting tasks, kept by the child watches on the job list and on the
+	 * ordering/working directories of each job, so TakeTask picks a candidate without
+	 * reading the directories. The watches and their completions run on the zookeeper
+	 * thread and only take m_mutexIndex, which is never held during a synchronous call.
+	 */
+	struct TaskIndex
+	{
+		std::set<std::string> setOrder;
+		std::set<std::string> setWorking;
+		std::set<std::string, TaskOrderLess> setWaiting;	//setOrder - setWorking
+		bool bOrderLoaded = false;
+		bool bWorkingLoaded = false;
+		bool bOrderPending = false;
+		bool bWorkingPending = false;
+		int nOrderCVersion = -1;	//child version of the loaded listing
+		int nWorkingCVersion = -1;
+	};
+	struct IndexRequest
+	{
+		CJobCluster* pThis;
+		zhandle_t* pHandle;
+		std::string strJobName;	//empty for the job list
+		bool bWorking;
+	};
+	enum EnumIndexState{
+		INDEX_HIT,
+		INDEX_EMPTY,	//no waiting task
+		INDEX_NOT_READY	//not loaded yet, scan the directories instead
+	};
+	static void OnIndexDirChanged(zhandle_t* zh, int type, int state, const char* path, void* watcherCtx);
+	static void OnIndexDirLoaded(int rc, const struct String_vector* strings, const struct Stat* stat, const void* data);
+	void StartTaskIndex();
+	void StopTaskIndex();
+	void LoadIndexDir(const std::string& strJobName, bool bWorking);
+	void UpdateJobList(const struct String_vector* strings);
+	void UpdateTaskDir(TaskIndex& index, bool bWorking, const struct String_vector* strings);
+	EnumIndexState SelectIndexedTask(std::string& strJobName, std::string& strTaskName, bool bTake = true);
+	void RestoreIndexedTask(const std::string& strJobName, const std::string& strTaskName);
+	bool IsIndexStale(const std::string& strJobName);
+
+	//guarded by m_mutexIndex
+	zhandle_t* m_pIndexHandle = nullptr;
+	std::map<std::string, TaskIndex> m_mapTaskIndex;
+	bool m_bJobListLoaded = false;
+	bool m_bJobListPending = false;
+	int m_nJobListCVersion = -1;
+	std::mutex m_mutexIndex;
 
 
 private:
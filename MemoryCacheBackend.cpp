@@ -0,0 +1,215 @@
+#include "MemoryCacheBackend.h"
+#include "Log.h"
+#include <chrono>
+#include <functional>
+using namespace Stock;
+
+// Constructors/Destructors
+//
+
+CMemoryCacheBackend::CMemoryCacheBackend ():m_vectShard(SHARD_COUNT)
+{
+	for(auto& shard: m_vectShard)
+		shard.vectWheel.resize(WHEEL_SIZE);
+}
+
+CMemoryCacheBackend::~CMemoryCacheBackend ()
+{
+}
+
+//
+// Methods
+//
+
+ResultCode CMemoryCacheBackend::Get (const std::string& strKey, std::string& strValue)
+{
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	Entry* pEntry = Find(shard, strKey, NowInMS());
+	if(pEntry == nullptr)
+		return RE_NOT_EXISTS;
+	strValue = pEntry->strValue;
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::GetWithLifeCycle (const std::string& strKey, std::string& strValue,
+		long long& nLifeCycleInMS)
+{
+	long long nNow = NowInMS();
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	Entry* pEntry = Find(shard, strKey, nNow);
+	if(pEntry == nullptr)
+		return RE_NOT_EXISTS;
+	strValue = pEntry->strValue;
+	nLifeCycleInMS = pEntry->nExpireInMS < 0 ? -1 : pEntry->nExpireInMS - nNow;
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::Set (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	long long nNow = NowInMS();
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	Sweep(shard, nNow);
+	Entry& entry = shard.mapEntry[strKey];
+	entry.strValue = strValue;
+	entry.nExpireInMS = GetExpireTime(nNow, nLifeCycleInSecond);
+	Schedule(shard, strKey, entry);
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::Delete (const std::string& strKey)
+{
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if(Find(shard, strKey, NowInMS()) == nullptr)
+		return RE_NOT_EXISTS;
+	//the wheel slot is left to the sweep.
+	shard.mapEntry.erase(strKey);
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::Exists (const std::string& strKey, bool& bExists)
+{
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	bExists = Find(shard, strKey, NowInMS()) != nullptr;
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::SetNX (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	long long nNow = NowInMS();
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if(Find(shard, strKey, nNow) != nullptr)
+		return RE_BUSY;
+	Entry& entry = shard.mapEntry[strKey];
+	entry.strValue = strValue;
+	entry.nExpireInMS = GetExpireTime(nNow, nLifeCycleInSecond);
+	Schedule(shard, strKey, entry);
+	return RS_SUCCESS;
+}
+
+ResultCode CMemoryCacheBackend::Expire (const std::string& strKey, size_t nLifeCycleInSecond)
+{
+	long long nNow = NowInMS();
+	Shard& shard = GetShard(strKey);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	Entry* pEntry = Find(shard, strKey, nNow);
+	if(pEntry == nullptr)
+		return RE_NOT_EXISTS;
+	pEntry->nExpireInMS = GetExpireTime(nNow, nLifeCycleInSecond);
+	Schedule(shard, strKey, *pEntry);
+	return RS_SUCCESS;
+}
+
+size_t CMemoryCacheBackend::GetKeyCount ()
+{
+	long long nNow = NowInMS();
+	size_t nCount = 0;
+	for(auto& shard: m_vectShard)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		Sweep(shard, nNow);
+		nCount += shard.mapEntry.size();
+	}
+	return nCount;
+}
+
+void CMemoryCacheBackend::Clear ()
+{
+	for(auto& shard: m_vectShard)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.mapEntry.clear();
+		for(auto& vectKey: shard.vectWheel)
+			vectKey.clear();
+	}
+}
+
+long long CMemoryCacheBackend::NowInMS()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long CMemoryCacheBackend::GetExpireTime(long long nNowInMS, size_t nLifeCycleInSecond)
+{
+	return nLifeCycleInSecond == size_t(-1) ? -1 : nNowInMS + (long long)nLifeCycleInSecond * 1000;
+}
+
+CMemoryCacheBackend::Shard& CMemoryCacheBackend::GetShard(const std::string& strKey)
+{
+	return m_vectShard[std::hash<std::string>()(strKey) % SHARD_COUNT];
+}
+
+/*
+ * Called with the shard locked, the slot of the first tick not earlier than the expire time,
+ * so the key is expired when its slot is swept.
+ */
+void CMemoryCacheBackend::Schedule(Shard& shard, const std::string& strKey, Entry& entry)
+{
+	if(entry.nExpireInMS < 0)
+	{
+		entry.nTick = -1;
+		return;
+	}
+	long long nTick = (entry.nExpireInMS + TICK_IN_MS - 1) / TICK_IN_MS;
+	if(nTick == entry.nTick)
+		return;
+	entry.nTick = nTick;
+	shard.vectWheel[nTick % WHEEL_SIZE].push_back(strKey);
+}
+
+/*
+ * Called with the shard locked, sweep the slots of the ticks passed since the last sweep.
+ * A slot keeps the keys expiring in a later round of the wheel, and drops the ones which
+ * were removed or rescheduled to another slot.
+ */
+void CMemoryCacheBackend::Sweep(Shard& shard, long long nNowInMS)
+{
+	long long nTick = nNowInMS / TICK_IN_MS;
+	if(shard.nSweptTick < 0 || nTick - shard.nSweptTick > (long long)WHEEL_SIZE)
+		shard.nSweptTick = nTick - WHEEL_SIZE;
+	for(; shard.nSweptTick < nTick; )
+	{
+		size_t nSlot = ++shard.nSweptTick % WHEEL_SIZE;
+		std::vector<std::string>& vectKey = shard.vectWheel[nSlot];
+		size_t nKept = 0;
+		for(size_t i = 0; i < vectKey.size(); i++)
+		{
+			auto it = shard.mapEntry.find(vectKey[i]);
+			if(it == shard.mapEntry.end() || it->second.nExpireInMS < 0)
+				continue;
+			long long nExpireInMS = it->second.nExpireInMS;
+			if(nExpireInMS <= nNowInMS)
+				shard.mapEntry.erase(it);
+			else if(size_t(it->second.nTick % WHEEL_SIZE) == nSlot)
+			{
+				if(nKept != i)
+					vectKey[nKept].swap(vectKey[i]);
+				nKept++;
+			}
+		}
+		vectKey.resize(nKept);
+	}
+}
+
+/*
+ * Called with the shard locked, an expired key is removed and not returned.
+ */
+CMemoryCacheBackend::Entry* CMemoryCacheBackend::Find(Shard& shard, const std::string& strKey, long long nNowInMS)
+{
+	Sweep(shard, nNowInMS);
+	auto it = shard.mapEntry.find(strKey);
+	if(it == shard.mapEntry.end())
+		return nullptr;
+	if(it->second.nExpireInMS >= 0 && it->second.nExpireInMS <= nNowInMS)
+	{
+		shard.mapEntry.erase(it);
+		return nullptr;
+	}
+	return &it->second;
+}
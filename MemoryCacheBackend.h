@@ -0,0 +1,93 @@
+#ifndef CMEMORYCACHEBACKEND_H
+#define CMEMORYCACHEBACKEND_H
+#include "CacheBackend.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+/**
+ * class CMemoryCacheBackend
+ * ICacheBackend in the process memory, no network at all, for the single box runs, the tests
+ * and as the zero latency baseline of the benchmarks.
+ *
+ * The keys are spread over SHARD_COUNT shards by hash, each shard has its own mutex, hash map
+ * and TTL wheel. A key with a life cycle is put in the wheel slot of its expire tick, the slots
+ * passed by the clock are swept by the next operation on the shard, so the expired keys are
+ * released without a background thread. An expired key which is not swept yet is never returned.
+ */
+class CMemoryCacheBackend: public ICacheBackend
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * Empty Constructor
+	 */
+	CMemoryCacheBackend ();
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CMemoryCacheBackend ();
+
+
+	virtual ResultCode Get (const std::string& strKey, std::string& strValue);
+	virtual ResultCode GetWithLifeCycle (const std::string& strKey, std::string& strValue,
+			long long& nLifeCycleInMS);
+	virtual ResultCode Set (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1));
+	virtual ResultCode Delete (const std::string& strKey);
+	virtual ResultCode Exists (const std::string& strKey, bool& bExists);
+	virtual ResultCode SetNX (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1));
+	virtual ResultCode Expire (const std::string& strKey, size_t nLifeCycleInSecond);
+
+
+	/**
+	 * @return the keys held, the expired keys are swept first.
+	 */
+	size_t GetKeyCount ();
+
+
+	/**
+	 * Remove all the keys.
+	 */
+	void Clear ();
+
+
+protected:
+	static const size_t SHARD_COUNT = 64;
+	static const size_t WHEEL_SIZE = 512;
+	static const long long TICK_IN_MS = 100;
+
+	struct Entry
+	{
+		std::string strValue;
+		long long nExpireInMS;	//-1 means not limited
+		long long nTick = -1;	//the wheel tick scheduled
+	};
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, Entry> mapEntry;
+		std::vector<std::vector<std::string>> vectWheel;	//keys by expire tick % WHEEL_SIZE
+		long long nSweptTick = -1;
+	};
+
+	static long long NowInMS();
+	static long long GetExpireTime(long long nNowInMS, size_t nLifeCycleInSecond);
+	Shard& GetShard(const std::string& strKey);
+	void Schedule(Shard& shard, const std::string& strKey, Entry& entry);
+	void Sweep(Shard& shard, long long nNowInMS);
+	Entry* Find(Shard& shard, const std::string& strKey, long long nNowInMS);
+
+	std::vector<Shard> m_vectShard;
+
+
+};
+
+#endif // CMEMORYCACHEBACKEND_H
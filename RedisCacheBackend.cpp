@@ -0,0 +1,337 @@
+#include "RedisCacheBackend.h"
+#include "Log.h"
+using namespace Stock;
+#define RETRY_COUNT 1
+
+// Constructors/Destructors
+//
+
+CRedisCacheBackend::CRedisCacheBackend ():m_pConnection(new CRedisConnection())
+{
+}
+
+CRedisCacheBackend::CRedisCacheBackend (const boost::shared_ptr<CRedisConnection>& pConnection)
+		:m_pConnection(pConnection)
+{
+}
+
+CRedisCacheBackend::~CRedisCacheBackend ()
+{
+}
+
+//
+// Methods
+//
+
+ResultCode CRedisCacheBackend::Connect (const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+{
+	if(strServerAddr.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	m_nTimeOutInMS = nTimeOutInMS;
+	ResultCode rc = m_pConnection->Connect(strServerAddr, nPort, nTimeOutInMS);
+	if(RC_FAILED(rc))
+		LogReturn(rc);
+	return RS_SUCCESS;
+}
+
+ResultCode CRedisCacheBackend::Get (const std::string& strKey, std::string& strValue)
+{
+	redisReply* reply = nullptr;
+	ResultCode rc = Command({"GET", strKey}, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	if(reply->type == REDIS_REPLY_STRING)
+		strValue.assign(reply->str, reply->len);
+	else if(reply->type == REDIS_REPLY_NIL)
+		rc = RE_NOT_EXISTS;
+	else
+	{
+		LogError() << "get key failed for " << strKey << ":" << (reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+		rc = RE_UNEXPECT;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+/*
+ * GET and PTTL in the same round trip, a key expired between them is not exists.
+ */
+ResultCode CRedisCacheBackend::GetWithLifeCycle (const std::string& strKey, std::string& strValue,
+		long long& nLifeCycleInMS)
+{
+	std::vector<std::string> vectValue;
+	std::vector<long long> vectLifeCycleInMS;
+	ResultCode rc = MultiGet({strKey}, vectValue, vectLifeCycleInMS);
+	if(RC_FAILED(rc))
+		return rc;
+	if(vectLifeCycleInMS[0] == -2)
+		return RE_NOT_EXISTS;
+	strValue.swap(vectValue[0]);
+	nLifeCycleInMS = vectLifeCycleInMS[0];
+	return RS_SUCCESS;
+}
+
+ResultCode CRedisCacheBackend::Set (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	redisReply* reply = nullptr;
+	ResultCode rc = nLifeCycleInSecond == size_t(-1)
+			? Command({"SET", strKey, strValue}, true, reply)
+			: Command({"SETEX", strKey, std::to_string(nLifeCycleInSecond), strValue}, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	if(reply->type == REDIS_REPLY_ERROR)
+	{
+		LogError() << "set key failed for " << strKey << ":" << reply->str;
+		rc = RE_ERROR;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::Delete (const std::string& strKey)
+{
+	redisReply* reply = nullptr;
+	ResultCode rc = Command({"DEL", strKey}, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	rc = RE_UNEXPECT;
+	if(reply->type == REDIS_REPLY_INTEGER)
+		rc = reply->integer == 0 ? RE_NOT_EXISTS : RS_SUCCESS;
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::Exists (const std::string& strKey, bool& bExists)
+{
+	redisReply* reply = nullptr;
+	ResultCode rc = Command({"EXISTS", strKey}, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	rc = RE_UNEXPECT;
+	if(reply->type == REDIS_REPLY_INTEGER)
+	{
+		bExists = reply->integer != 0;
+		rc = RS_SUCCESS;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::SetNX (const std::string& strKey, const std::string& strValue, size_t nLifeCycleInSecond)
+{
+	//not retried, the lost reply may belong to a taken key.
+	redisReply* reply = nullptr;
+	ResultCode rc = nLifeCycleInSecond == size_t(-1)
+			? Command({"SET", strKey, strValue, "NX"}, false, reply)
+			: Command({"SET", strKey, strValue, "EX", std::to_string(nLifeCycleInSecond), "NX"}, false, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	if(reply->type == REDIS_REPLY_NIL)
+		rc = RE_BUSY;
+	else if(reply->type == REDIS_REPLY_ERROR)
+	{
+		LogError() << "set key failed for " << strKey << ":" << reply->str;
+		rc = RE_ERROR;
+	}
+	freeReplyObject(reply);
+	if(rc != RE_BUSY || nLifeCycleInSecond == size_t(-1) || RC_FAILED(Command({"TTL", strKey}, false, reply)))
+		return rc;
+	//a lock of the old clients, which set the life cycle by a separate EXPIRE, may have lost it.
+	if(reply->type == REDIS_REPLY_INTEGER && reply->integer == -1)
+	{
+		LogException() << "Lock without expire, reset expire:" << strKey;
+		Expire(strKey, nLifeCycleInSecond);
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::Expire (const std::string& strKey, size_t nLifeCycleInSecond)
+{
+	redisReply* reply = nullptr;
+	ResultCode rc = Command({"EXPIRE", strKey, std::to_string(nLifeCycleInSecond)}, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	rc = RE_UNEXPECT;
+	if(reply->type == REDIS_REPLY_INTEGER)
+		rc = reply->integer == 0 ? RE_NOT_EXISTS : RS_SUCCESS;
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::MultiGet (const std::vector<std::string>& vectKey, std::vector<std::string>& vectValue,
+		std::vector<long long>& vectLifeCycleInMS)
+{
+	vectValue.assign(vectKey.size(), std::string());
+	vectLifeCycleInMS.assign(vectKey.size(), -2);
+	std::vector<std::vector<std::string>> vectCommand;
+	for(auto& strKey: vectKey)
+	{
+		vectCommand.push_back({"GET", strKey});
+		vectCommand.push_back({"PTTL", strKey});
+	}
+	std::vector<redisReply*> vectReply;
+	ResultCode rc = Pipeline(vectCommand, vectReply);
+	if(RC_FAILED(rc))
+		return rc;
+	for(size_t i = 0; i < vectKey.size(); i++)
+	{
+		redisReply* reply = vectReply[2*i];
+		redisReply* replyTTL = vectReply[2*i + 1];
+		if(reply->type == REDIS_REPLY_NIL
+				|| (replyTTL->type == REDIS_REPLY_INTEGER && replyTTL->integer == -2))
+			continue;
+		if(reply->type != REDIS_REPLY_STRING || replyTTL->type != REDIS_REPLY_INTEGER)
+		{
+			LogError() << "get key failed for " << vectKey[i] << ":" << (reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+			rc = RE_UNEXPECT;
+			break;
+		}
+		vectValue[i].assign(reply->str, reply->len);
+		vectLifeCycleInMS[i] = replyTTL->integer;
+	}
+	FreeReplies(vectReply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::MultiExists (const std::vector<std::string>& vectKey, std::vector<bool>& vectExists)
+{
+	vectExists.assign(vectKey.size(), false);
+	std::vector<std::vector<std::string>> vectCommand;
+	for(auto& strKey: vectKey)
+		vectCommand.push_back({"EXISTS", strKey});
+	std::vector<redisReply*> vectReply;
+	ResultCode rc = Pipeline(vectCommand, vectReply);
+	if(RC_FAILED(rc))
+		return rc;
+	for(size_t i = 0; i < vectReply.size() && RC_SUCCEEDED(rc); i++)
+	{
+		if(vectReply[i]->type == REDIS_REPLY_INTEGER)
+			vectExists[i] = vectReply[i]->integer != 0;
+		else
+			rc = RE_UNEXPECT;
+	}
+	FreeReplies(vectReply);
+	return rc;
+}
+
+/*
+ * KEYS: the lock keys, ARGV[1]: the value of the caller, ARGV[2]: life cycle in second, 0 means not limited.
+ * Return 0 when all are set, otherwise the 1-based index of the first key held by others.
+ * A key holding the caller's value is taken as its own, so a retried request is harmless.
+ */
+static const char* MULTI_SETNX_SCRIPT =
+		"for i = 1, #KEYS do\n"
+		"  local v = redis.call('GET', KEYS[i])\n"
+		"  if v and v ~= ARGV[1] then return i end\n"
+		"end\n"
+		"local ttl = tonumber(ARGV[2])\n"
+		"for i = 1, #KEYS do\n"
+		"  if ttl > 0 then redis.call('SET', KEYS[i], ARGV[1], 'EX', ttl) else redis.call('SET', KEYS[i], ARGV[1]) end\n"
+		"end\n"
+		"return 0\n";
+
+ResultCode CRedisCacheBackend::MultiSetNX (const std::vector<std::string>& vectKey, const std::string& strValue,
+		size_t nLifeCycleInSecond, size_t& nBlocking)
+{
+	if(vectKey.empty())
+		return RS_SUCCESS;
+	std::vector<std::string> vectArg = {"EVAL", MULTI_SETNX_SCRIPT, std::to_string(vectKey.size())};
+	vectArg.insert(vectArg.end(), vectKey.begin(), vectKey.end());
+	vectArg.push_back(strValue);
+	vectArg.push_back(nLifeCycleInSecond == size_t(-1) ? "0" : std::to_string(nLifeCycleInSecond));
+	redisReply* reply = nullptr;
+	ResultCode rc = Command(vectArg, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	if(reply->type != REDIS_REPLY_INTEGER || reply->integer < 0 || size_t(reply->integer) > vectKey.size())
+	{
+		LogError() << "Lock failed:" << (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		rc = RE_UNEXPECT;
+	}
+	else if(reply->integer > 0)
+	{
+		nBlocking = size_t(reply->integer - 1);
+		rc = RE_BUSY;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+ResultCode CRedisCacheBackend::MultiDelete (const std::vector<std::string>& vectKey, size_t& nDeleted)
+{
+	nDeleted = 0;
+	if(vectKey.empty())
+		return RS_SUCCESS;
+	std::vector<std::string> vectArg = {"DEL"};
+	vectArg.insert(vectArg.end(), vectKey.begin(), vectKey.end());
+	redisReply* reply = nullptr;
+	ResultCode rc = Command(vectArg, true, reply);
+	if(RC_FAILED(rc))
+		return rc;
+	rc = RE_UNEXPECT;
+	if(reply->type == REDIS_REPLY_INTEGER)
+	{
+		nDeleted = size_t(reply->integer);
+		rc = RS_SUCCESS;
+	}
+	freeReplyObject(reply);
+	return rc;
+}
+
+/*
+ * reply is set only on success, the caller frees it.
+ */
+ResultCode CRedisCacheBackend::Command (const std::vector<std::string>& vectArg, bool bRetry, redisReply*& reply)
+{
+	CCacheDeadline scope(m_nTimeOutInMS);
+	reply = nullptr;
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pConnection->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	for(int retry = 0; retry <= (bRetry ? RETRY_COUNT : 0); retry++)
+	{
+		if(!m_pConnection->IsConnected() && RC_FAILED(m_pConnection->Reconnect()))
+			LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+		reply = m_pConnection->CommandArgv(vectArg);
+		if(reply != nullptr)
+			return RS_SUCCESS;
+		LogError() << "Failed to execute command:" << vectArg[0] << " " << vectArg[1];
+		//the unread reply leaves the connection unusable, a command refused before it was sent keeps it.
+		m_pConnection->Reconnect();
+	}
+	LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+}
+
+/*
+ * Only for the commands safe to resend, vectReply is set only on success, the caller frees it.
+ */
+ResultCode CRedisCacheBackend::Pipeline (const std::vector<std::vector<std::string>>& vectCommand,
+		std::vector<redisReply*>& vectReply)
+{
+	vectReply.clear();
+	if(vectCommand.empty())
+		return RS_SUCCESS;
+	CCacheDeadline scope(m_nTimeOutInMS);
+	std::unique_lock<std::timed_mutex> lock;
+	if(!m_pConnection->LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	for(int retry = 0; retry <= RETRY_COUNT; retry++)
+	{
+		if(!m_pConnection->IsConnected() && RC_FAILED(m_pConnection->Reconnect()))
+			LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+		if(m_pConnection->Pipeline(vectCommand, vectReply))
+			return RS_SUCCESS;
+		LogError() << "Failed to execute pipeline of " << vectCommand.size() << " commands:"
+				<< vectCommand[0][0] << " " << vectCommand[0][1];
+		m_pConnection->Reconnect();
+	}
+	LogReturn(CCacheDeadline::TimeOutOr(RE_COMMUNICATION));
+}
+
+void CRedisCacheBackend::FreeReplies (std::vector<redisReply*>& vectReply)
+{
+	for(auto reply: vectReply)
+		freeReplyObject(reply);
+	vectReply.clear();
+}
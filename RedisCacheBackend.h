@@ -0,0 +1,81 @@
+#ifndef CREDISCACHEBACKEND_H
+#define CREDISCACHEBACKEND_H
+#include "CacheBackend.h"
+#include "RedisConnection.h"
+#include <hiredis/hiredis.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * class CRedisCacheBackend
+ * ICacheBackend on a Redis server, the default backend of CCacheCluster. The commands run on a
+ * CRedisConnection, so they are bounded by the CCacheDeadline of the caller, a command lost on a
+ * broken connection reconnects and is sent again once, except SetNX. The Multi operations are
+ * single round trips, MultiSetNX is one atomic server side step.
+ */
+class CRedisCacheBackend: public ICacheBackend
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * Empty Constructor, the backend has its own connection, see Connect.
+	 */
+	CRedisCacheBackend ();
+
+	/**
+	 * Share the connection of its owner, which connects it.
+	 * @param  pConnection
+	 */
+	explicit CRedisCacheBackend (const boost::shared_ptr<CRedisConnection>& pConnection);
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CRedisCacheBackend ();
+
+
+	/**
+	 * @return ResultCode
+	 * @param  strServerAddr
+	 * @param  nPort
+	 * @param  nTimeOutInMS connect time out, and the budget of each command, an enclosing
+	 * 		CCacheDeadline can only shorten it.
+	 */
+	ResultCode Connect (const std::string& strServerAddr, int nPort, int nTimeOutInMS = 1000);
+
+
+	virtual ResultCode Get (const std::string& strKey, std::string& strValue);
+	virtual ResultCode GetWithLifeCycle (const std::string& strKey, std::string& strValue,
+			long long& nLifeCycleInMS);
+	virtual ResultCode Set (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1));
+	virtual ResultCode Delete (const std::string& strKey);
+	virtual ResultCode Exists (const std::string& strKey, bool& bExists);
+	virtual ResultCode SetNX (const std::string& strKey, const std::string& strValue,
+			size_t nLifeCycleInSecond = size_t(-1));
+	virtual ResultCode Expire (const std::string& strKey, size_t nLifeCycleInSecond);
+	virtual ResultCode MultiGet (const std::vector<std::string>& vectKey, std::vector<std::string>& vectValue,
+			std::vector<long long>& vectLifeCycleInMS);
+	virtual ResultCode MultiExists (const std::vector<std::string>& vectKey, std::vector<bool>& vectExists);
+	virtual ResultCode MultiSetNX (const std::vector<std::string>& vectKey, const std::string& strValue,
+			size_t nLifeCycleInSecond, size_t& nBlocking);
+	virtual ResultCode MultiDelete (const std::vector<std::string>& vectKey, size_t& nDeleted);
+
+
+protected:
+	ResultCode Command (const std::vector<std::string>& vectArg, bool bRetry, redisReply*& reply);
+	ResultCode Pipeline (const std::vector<std::vector<std::string>>& vectCommand, std::vector<redisReply*>& vectReply);
+	static void FreeReplies (std::vector<redisReply*>& vectReply);
+
+	boost::shared_ptr<CRedisConnection> m_pConnection;
+	std::atomic<int> m_nTimeOutInMS{-1};	//set by Connect
+
+
+};
+
+#endif // CREDISCACHEBACKEND_H
@@ -0,0 +1,398 @@
+#include "RedisConnection.h"
+#include "Log.h"
+#include <string.h>
+#include <stdarg.h>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+using namespace Stock;
+
+// Constructors/Destructors
+//
+
+static std::atomic<unsigned long long> s_nInstanceCount(0);
+
+CRedisConnection::CRedisConnection ():m_nInstanceId(++s_nInstanceCount)
+{
+}
+
+CRedisConnection::~CRedisConnection ()
+{
+	ReleaseThreadConnections();
+}
+
+//
+// Methods
+//
+
+ResultCode CRedisConnection::Connect (const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+{
+	if(strServerAddr.empty())
+		return RE_INVALIDATE_PARAMETER;
+	std::unique_lock<std::timed_mutex> lock;
+	if(!LockServer(lock))
+		LogReturn(RE_TIME_OUT);
+	{
+		std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+		m_strServerAddress = strServerAddr;
+		m_nServerPort = nPort;
+		m_nConnectTimeOutInMS = nTimeOutInMS;
+		//the thread connections of the old configuration reconnect on their next use.
+		m_nConfigVersion++;
+	}
+	return Reconnect();
+}
+
+void CRedisConnection::SetServer (const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+{
+	std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+	if(m_strServerAddress == strServerAddr && m_nServerPort == nPort && m_nConnectTimeOutInMS == nTimeOutInMS)
+		return;
+	m_strServerAddress = strServerAddr;
+	m_nServerPort = nPort;
+	m_nConnectTimeOutInMS = nTimeOutInMS;
+	m_nConfigVersion++;
+}
+
+void CRedisConnection::GetServer (std::string& strServerAddr, int& nPort, int& nTimeOutInMS)
+{
+	std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+	strServerAddr = m_strServerAddress;
+	nPort = m_nServerPort;
+	nTimeOutInMS = m_nConnectTimeOutInMS;
+}
+
+int CRedisConnection::GetConnectTimeOut ()
+{
+	std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+	return m_nConnectTimeOutInMS;
+}
+
+void CRedisConnection::EnableThreadConnection (bool bEnable)
+{
+	m_bThreadConnection = bEnable;
+}
+
+ResultCode CRedisConnection::EnableMultiplexedConnection (bool bEnable, size_t nMaxBatchSize)
+{
+	if(!bEnable)
+	{
+		m_pMultiplexer.reset();
+		return RS_SUCCESS;
+	}
+	m_pMultiplexer.reset(new CRedisMultiplexer(nMaxBatchSize));
+	{
+		std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+		if(m_strServerAddress.empty())
+			return RS_SUCCESS;
+	}
+	//already connected, switch now.
+	return Reconnect();
+}
+
+/*
+ * nReadTimeOutInMS bounds each reply of the background connections, 0 leaves the reads blocking.
+ */
+redisContext* CRedisConnection::OpenContext (const std::string& strServerAddr, int nPort, int nTimeOutInMS,
+		int nReadTimeOutInMS)
+{
+	timeval tv;
+	tv.tv_sec = nTimeOutInMS/1000;
+	tv.tv_usec = nTimeOutInMS%1000*1000;
+
+	redisContext* pServer = redisConnectWithTimeout(strServerAddr.c_str(), nPort, tv);
+	if(pServer == nullptr || pServer->err)
+	{
+		LogError() << "Connect to Redis server " << strServerAddr << ":" << nPort << " Failed:"
+				<< (pServer ? pServer->errstr : "out of memory");
+		if(pServer)
+			redisFree(pServer);
+		return nullptr;
+	}
+	if(nReadTimeOutInMS > 0)
+	{
+		tv.tv_sec = nReadTimeOutInMS/1000;
+		tv.tv_usec = nReadTimeOutInMS%1000*1000;
+		redisSetTimeout(pServer, tv);
+	}
+	LogDebug() << "Connect To Redis server succeeded:" << strServerAddr << ":" << nPort;
+	return pServer;
+}
+
+ResultCode CRedisConnection::Reconnect ()
+{
+	if(m_pMultiplexer)
+	{
+		//the multiplexer recovers a broken connection by itself, reopen only for a new configuration.
+		if(CCacheDeadline::GetRemainingMS(1) <= 0)
+			return Stock::RE_TIME_OUT;
+		std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+		if(m_pMultiplexer->IsOpen() && m_nMultiplexerConfigVersion == m_nConfigVersion)
+			return Stock::RS_SUCCESS;
+		ResultCode rc = m_pMultiplexer->Open(m_strServerAddress, m_nServerPort, m_nConnectTimeOutInMS);
+		if(RC_SUCCEEDED(rc))
+			m_nMultiplexerConfigVersion = m_nConfigVersion;
+		return rc;
+	}
+	ServerConnection& server = Server();
+	//out of time before a command was written, the context is still in step with the server.
+	if(server.bNothingSent && CCacheDeadline::GetRemainingMS(1) <= 0)
+		return Stock::RE_TIME_OUT;
+	if(server.pContext != nullptr)
+	{
+		redisFree(server.pContext);
+		server.pContext = nullptr;
+	}
+	server.bCommandTimeoutSet = false;
+	std::string strServerAddr;
+	int nPort = 0, nConnectTimeOutInMS = 0;
+	{
+		std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+		strServerAddr = m_strServerAddress;
+		nPort = m_nServerPort;
+		nConnectTimeOutInMS = m_nConnectTimeOutInMS;
+		server.nConfigVersion = m_nConfigVersion;
+	}
+	long long nTimeOutInMS = CCacheDeadline::GetRemainingMS(nConnectTimeOutInMS);
+	if(nTimeOutInMS <= 0)
+		return Stock::RE_TIME_OUT;
+	server.pContext = OpenContext(strServerAddr, nPort, (int)nTimeOutInMS);
+	if(server.pContext == nullptr)
+		return Stock::RE_ERROR;
+	return Stock::RS_SUCCESS;
+}
+
+bool CRedisConnection::IsConnected ()
+{
+	if(m_pMultiplexer)
+		return m_pMultiplexer->IsOpen();
+	return Server().pContext != nullptr;
+}
+
+redisReply* CRedisConnection::WaitReply(std::future<CRedisMultiplexer::ReplyPtr>& future)
+{
+	auto tpDeadline = CCacheDeadline::Deadline();
+	if(tpDeadline != std::chrono::steady_clock::time_point::max()
+			&& future.wait_until(tpDeadline) != std::future_status::ready)
+		return nullptr;	//the reply is freed with the abandoned future.
+	return future.get().release();
+}
+
+/*
+ * The connections of the threads are kept in a thread_local map keyed by the instance id,
+ * the map is destroyed at thread exit, which closes them. The instance keeps weak references
+ * to close the remaining ones when it is destroyed first.
+ */
+CRedisConnection::ServerConnection& CRedisConnection::Server()
+{
+	if(!m_bThreadConnection)
+		return m_server;
+	static thread_local std::unordered_map<unsigned long long, boost::shared_ptr<ServerConnection>> s_mapConnection;
+	boost::shared_ptr<ServerConnection>& pConnection = s_mapConnection[m_nInstanceId];
+	if(pConnection == nullptr)
+	{
+		for(auto it = s_mapConnection.begin(); it != s_mapConnection.end();)
+		{
+			if(it->second && it->second->bReleased)
+				it = s_mapConnection.erase(it);
+			else
+				++it;
+		}
+		pConnection.reset(new ServerConnection());
+		pConnection->nConfigVersion = m_nConfigVersion;
+		std::lock_guard<std::mutex> lock(m_mutexConfig);
+		m_vectThreadConnection.erase(std::remove_if(m_vectThreadConnection.begin(), m_vectThreadConnection.end(),
+				[](const boost::weak_ptr<ServerConnection>& p){return p.expired();}), m_vectThreadConnection.end());
+		m_vectThreadConnection.push_back(pConnection);
+	}
+	else if(pConnection->nConfigVersion != m_nConfigVersion && pConnection->pContext != nullptr)
+	{
+		redisFree(pConnection->pContext);
+		pConnection->pContext = nullptr;
+	}
+	return *pConnection;
+}
+
+void CRedisConnection::ReleaseThreadConnections()
+{
+	std::lock_guard<std::mutex> lock(m_mutexConfig);
+	for(auto& p: m_vectThreadConnection)
+	{
+		boost::shared_ptr<ServerConnection> pConnection = p.lock();
+		if(pConnection == nullptr)
+			continue;
+		if(pConnection->pContext != nullptr)
+		{
+			redisFree(pConnection->pContext);
+			pConnection->pContext = nullptr;
+		}
+		pConnection->bReleased = true;
+	}
+	m_vectThreadConnection.clear();
+}
+
+bool CRedisConnection::LockServer (std::unique_lock<std::timed_mutex>& lock)
+{
+	if(m_bThreadConnection || m_pMultiplexer)
+		return true;
+	lock = std::unique_lock<std::timed_mutex>(m_mutex, std::defer_lock);
+	auto tpDeadline = CCacheDeadline::Deadline();
+	if(tpDeadline == std::chrono::steady_clock::time_point::max())
+	{
+		lock.lock();
+		return true;
+	}
+	return lock.try_lock_until(tpDeadline);
+}
+
+/*
+ * The socket timeout of the connection follows the deadline of the calling thread,
+ * an expired read leaves the context unusable, the caller reconnects.
+ * Called before anything is written, RE_TIME_OUT means nothing was sent and the context is kept
+ * by the following Reconnect.
+ */
+ResultCode CRedisConnection::ApplyCommandTimeout()
+{
+	ServerConnection& server = Server();
+	server.bNothingSent = false;
+	if(server.pContext == nullptr)
+		return RE_COMMUNICATION;
+	if(CCacheDeadline::Deadline() == std::chrono::steady_clock::time_point::max())
+	{
+		if(server.bCommandTimeoutSet)
+		{
+			timeval tv = {0, 0};
+			redisSetTimeout(server.pContext, tv);
+			server.bCommandTimeoutSet = false;
+		}
+		return RS_SUCCESS;
+	}
+	long long nTimeOutInMS = CCacheDeadline::GetRemainingMS(std::numeric_limits<long long>::max());
+	if(nTimeOutInMS <= 0)
+	{
+		server.bNothingSent = true;
+		return RE_TIME_OUT;
+	}
+	timeval tv;
+	tv.tv_sec = nTimeOutInMS/1000;
+	tv.tv_usec = nTimeOutInMS%1000*1000;
+	redisSetTimeout(server.pContext, tv);
+	server.bCommandTimeoutSet = true;
+	return RS_SUCCESS;
+}
+
+redisReply* CRedisConnection::Command (const char* format, ...)
+{
+	va_list ap;
+	if(m_pMultiplexer)
+	{
+		va_start(ap, format);
+		std::future<CRedisMultiplexer::ReplyPtr> future = m_pMultiplexer->vCommand(format, ap);
+		va_end(ap);
+		return WaitReply(future);
+	}
+	if(RC_FAILED(ApplyCommandTimeout()))
+		return nullptr;
+	va_start(ap, format);
+	redisReply* reply = (redisReply*)redisvCommand(Server().pContext, format, ap);
+	va_end(ap);
+	return reply;
+}
+
+redisReply* CRedisConnection::CommandArgv (const std::vector<std::string>& vectArg)
+{
+	if(m_pMultiplexer)
+	{
+		std::future<CRedisMultiplexer::ReplyPtr> future = m_pMultiplexer->CommandArgv(vectArg);
+		return WaitReply(future);
+	}
+	if(RC_FAILED(ApplyCommandTimeout()))
+		return nullptr;
+	std::vector<const char*> vectArgv;
+	std::vector<size_t> vectArgvLen;
+	for(auto& strArg: vectArg)
+	{
+		vectArgv.push_back(strArg.c_str());
+		vectArgvLen.push_back(strArg.size());
+	}
+	return (redisReply*)redisCommandArgv(Server().pContext, (int)vectArg.size(), vectArgv.data(), vectArgvLen.data());
+}
+
+bool CRedisConnection::Pipeline (const std::vector<std::vector<std::string>>& vectCommand, std::vector<redisReply*>& vectReply)
+{
+	vectReply.clear();
+	if(m_pMultiplexer)
+	{
+		std::vector<std::future<CRedisMultiplexer::ReplyPtr>> vectFuture;
+		for(auto& vectArg: vectCommand)
+			vectFuture.push_back(m_pMultiplexer->CommandArgv(vectArg));
+		for(size_t i = 0; i < vectFuture.size() && vectReply.size() == i; i++)
+		{
+			redisReply* reply = WaitReply(vectFuture[i]);
+			if(reply != nullptr)
+				vectReply.push_back(reply);
+		}
+	}
+	else if(RC_SUCCEEDED(ApplyCommandTimeout()))
+	{
+		redisContext* pServer = Server().pContext;
+		for(auto& vectArg: vectCommand)
+		{
+			std::vector<const char*> vectArgv;
+			std::vector<size_t> vectArgvLen;
+			for(auto& strArg: vectArg)
+			{
+				vectArgv.push_back(strArg.c_str());
+				vectArgvLen.push_back(strArg.size());
+			}
+			redisAppendCommandArgv(pServer, (int)vectArg.size(), vectArgv.data(), vectArgvLen.data());
+		}
+		for(size_t i = 0; i < vectCommand.size(); i++)
+		{
+			redisReply* reply = nullptr;
+			if(redisGetReply(pServer, (void**)&reply) != REDIS_OK || reply == nullptr)
+				break;
+			vectReply.push_back(reply);
+		}
+	}
+	if(vectReply.size() == vectCommand.size())
+		return true;
+	//the unread replies leave the connection unusable.
+	for(auto reply: vectReply)
+		freeReplyObject(reply);
+	vectReply.clear();
+	return false;
+}
+
+/*
+ * A NOSCRIPT reply means nothing ran, so the resend is safe.
+ */
+redisReply* CRedisConnection::EvalScript (const char* pScript, std::string& strScriptSha, const std::vector<std::string>& vectArg)
+{
+	std::string strSha;
+	{
+		std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+		strSha = strScriptSha;
+	}
+	for(int nLoad = 0; ; nLoad++)
+	{
+		if(strSha.empty())
+		{
+			redisReply* reply = Command("SCRIPT LOAD %s", pScript);
+			if(reply == nullptr || reply->type != REDIS_REPLY_STRING)
+				return reply;
+			strSha.assign(reply->str, reply->len);
+			freeReplyObject(reply);
+			std::lock_guard<std::mutex> lockConfig(m_mutexConfig);
+			strScriptSha = strSha;
+		}
+		std::vector<std::string> vectCommand{"EVALSHA", strSha};
+		vectCommand.insert(vectCommand.end(), vectArg.begin(), vectArg.end());
+		redisReply* reply = CommandArgv(vectCommand);
+		if(nLoad > 0 || reply == nullptr || reply->type != REDIS_REPLY_ERROR || strncmp(reply->str, "NOSCRIPT", 8) != 0)
+			return reply;
+		//the script cache of the server was flushed, or another server took over.
+		freeReplyObject(reply);
+		strSha.clear();
+	}
+}
@@ -0,0 +1,151 @@
+#ifndef CREDISCONNECTION_H
+#define CREDISCONNECTION_H
+#include "ResultCode.h"
+#include "CacheDeadline.h"
+#include "RedisMultiplexer.h"
+#include <hiredis/hiredis.h>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+/**
+ * class CRedisConnection
+ * The connection to a Redis server used by CRedisCacheBackend and the Redis only features of
+ * CCacheCluster: one shared connection guarded by LockServer, a connection per calling thread
+ * (EnableThreadConnection) or a multiplexed one (EnableMultiplexedConnection).
+ *
+ * The commands are bounded by the CCacheDeadline of the calling thread, a lost reply returns
+ * nullptr and leaves the connection unusable, the caller reconnects by Reconnect.
+ */
+class CRedisConnection
+{
+public:
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * Empty Constructor
+	 */
+	CRedisConnection ();
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CRedisConnection ();
+
+
+	/**
+	 * Set the server and connect now, every thread connection reconnects on its next use.
+	 * @return ResultCode
+	 * @param  strServerAddr
+	 * @param  nPort
+	 * @param  nTimeOutInMS connect time out.
+	 */
+	ResultCode Connect (const std::string& strServerAddr, int nPort, int nTimeOutInMS);
+
+
+	/**
+	 * Set the server without connecting, the connections reconnect on their next use when it changed.
+	 */
+	void SetServer (const std::string& strServerAddr, int nPort, int nTimeOutInMS);
+	void GetServer (std::string& strServerAddr, int& nPort, int& nTimeOutInMS);
+	int GetConnectTimeOut ();
+
+
+	/**
+	 * See CCacheCluster::EnableThreadConnection and CCacheCluster::EnableMultiplexedConnection.
+	 */
+	void EnableThreadConnection (bool bEnable);
+	ResultCode EnableMultiplexedConnection (bool bEnable, size_t nMaxBatchSize = 1024);
+
+
+	/**
+	 * Lock the shared connection until the deadline, a thread or multiplexed connection needs no lock.
+	 * @return false when the deadline is passed.
+	 * @param  lock [out] holds the lock taken.
+	 */
+	bool LockServer (std::unique_lock<std::timed_mutex>& lock);
+	bool IsConnected ();
+	ResultCode Reconnect ();
+
+
+	/**
+	 * @return nullptr when the reply is lost, the caller frees the reply.
+	 */
+	redisReply* Command (const char* format, ...);
+	redisReply* CommandArgv (const std::vector<std::string>& vectArg);
+
+
+	/**
+	 * Send the commands in one round trip.
+	 * @return false when some reply is lost, vectReply is empty then.
+	 * @param  vectCommand
+	 * @param  vectReply [out] one reply per command, the caller frees them.
+	 */
+	bool Pipeline (const std::vector<std::vector<std::string>>& vectCommand, std::vector<redisReply*>& vectReply);
+
+
+	/**
+	 * EVALSHA of the script with vectArg(numkeys, keys, args), the script is sent by SCRIPT LOAD on the
+	 * first call and again after NOSCRIPT.
+	 * @return nullptr when the reply is lost.
+	 * @param  pScript
+	 * @param  strScriptSha caches the digest, guarded by the connection.
+	 * @param  vectArg
+	 */
+	redisReply* EvalScript (const char* pScript, std::string& strScriptSha, const std::vector<std::string>& vectArg);
+
+
+	/**
+	 * Open a connection of its own, for the background threads.
+	 * @return nullptr when failed.
+	 * @param  nReadTimeOutInMS bounds each reply, 0 leaves the reads blocking.
+	 */
+	static redisContext* OpenContext (const std::string& strServerAddr, int nPort, int nTimeOutInMS,
+			int nReadTimeOutInMS = 0);
+
+
+protected:
+	struct ServerConnection
+	{
+		redisContext* pContext = nullptr;
+		bool bCommandTimeoutSet = false;
+		bool bNothingSent = false;	//the last command was refused by ApplyCommandTimeout
+		unsigned nConfigVersion = 0;
+		std::atomic<bool> bReleased{false};	//closed by the destroyed connection
+		~ServerConnection()
+		{
+			if(pContext != nullptr)
+				redisFree(pContext);
+		}
+	};
+
+	ServerConnection& Server();
+	ResultCode ApplyCommandTimeout();
+	redisReply* WaitReply(std::future<CRedisMultiplexer::ReplyPtr>& future);
+	void ReleaseThreadConnections();
+
+	ServerConnection m_server;	//the shared connection, guarded by m_mutex
+	std::timed_mutex m_mutex;
+	const unsigned long long m_nInstanceId;
+	bool m_bThreadConnection = false;
+	std::atomic<unsigned> m_nConfigVersion{0};
+	boost::shared_ptr<CRedisMultiplexer> m_pMultiplexer;
+	unsigned m_nMultiplexerConfigVersion = 0;	//guarded by m_mutexConfig
+
+	//the server configuration, m_vectThreadConnection and the script digests, guarded by m_mutexConfig
+	std::string m_strServerAddress;
+	int m_nServerPort = 6379;
+	int m_nConnectTimeOutInMS = 1000;
+	std::vector<boost::weak_ptr<ServerConnection>> m_vectThreadConnection;
+	std::mutex m_mutexConfig;
+
+
+};
+
+#endif // CREDISCONNECTION_H
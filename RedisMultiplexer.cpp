@@ -0,0 +1,325 @@
+#include "RedisMultiplexer.h"
+#include "Log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+using namespace Stock;
+
+static redisContext* ConnectServer(const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+{
+	timeval tv;
+	tv.tv_sec = nTimeOutInMS/1000;
+	tv.tv_usec = nTimeOutInMS%1000*1000;
+
+	redisContext* pServer = redisConnectWithTimeout(strServerAddr.c_str(), nPort, tv);
+	if(pServer == nullptr || pServer->err)
+	{
+		LogError() << "Connect to Redis server " << strServerAddr << ":" << nPort << " Failed:"
+				<< (pServer ? pServer->errstr : "out of memory");
+		if(pServer)
+			redisFree(pServer);
+		return nullptr;
+	}
+	//the reader thread blocks on the socket until a reply arrives or the socket is shut down.
+	timeval tvNoTimeOut = {0, 0};
+	redisSetTimeout(pServer, tvNoTimeOut);
+	LogDebug() << "Connect To Redis server succeeded:" << strServerAddr << ":" << nPort;
+	return pServer;
+}
+
+// Constructors/Destructors
+//
+
+CRedisMultiplexer::CRedisMultiplexer (size_t nMaxBatchSize):m_nMaxBatchSize(nMaxBatchSize == 0 ? 1 : nMaxBatchSize)
+{
+}
+
+CRedisMultiplexer::~CRedisMultiplexer ()
+{
+	Close();
+}
+
+//
+// Methods
+//
+
+ResultCode CRedisMultiplexer::Open (const std::string& strServerAddr, int nPort, int nTimeOutInMS)
+{
+	if(strServerAddr.empty())
+		LogReturn(RE_INVALIDATE_PARAMETER);
+	std::lock_guard<std::mutex> lockOpen(m_mutexOpen);
+	Stop();
+	redisContext* pServer = ConnectServer(strServerAddr, nPort, nTimeOutInMS);
+	if(pServer == nullptr)
+		LogReturn(RE_COMMUNICATION);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_strServerAddress = strServerAddr;
+	m_nServerPort = nPort;
+	m_nConnectTimeOutInMS = nTimeOutInMS;
+	m_pServer = pServer;
+	m_bBroken = false;
+	m_bOpen = true;
+	m_threadReader = std::thread(&CRedisMultiplexer::ReaderThread, this, pServer);
+	m_threadWriter = std::thread(&CRedisMultiplexer::WriterThread, this);
+	return RS_SUCCESS;
+}
+
+void CRedisMultiplexer::Close ()
+{
+	std::lock_guard<std::mutex> lockOpen(m_mutexOpen);
+	Stop();
+}
+
+bool CRedisMultiplexer::IsOpen ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bOpen;
+}
+
+std::future<CRedisMultiplexer::ReplyPtr> CRedisMultiplexer::Command (const char* format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	std::future<ReplyPtr> future = vCommand(format, ap);
+	va_end(ap);
+	return future;
+}
+
+std::future<CRedisMultiplexer::ReplyPtr> CRedisMultiplexer::vCommand (const char* format, va_list ap)
+{
+	char* pCommand = nullptr;
+	int nLength = redisvFormatCommand(&pCommand, format, ap);
+	if(nLength < 0)
+		LogError() << "format command failed:" << format;
+	return Queue(pCommand, nLength);
+}
+
+std::future<CRedisMultiplexer::ReplyPtr> CRedisMultiplexer::CommandArgv (const std::vector<std::string>& vectArg)
+{
+	std::vector<const char*> vectArgv;
+	std::vector<size_t> vectArgvLen;
+	for(auto& strArg: vectArg)
+	{
+		vectArgv.push_back(strArg.c_str());
+		vectArgvLen.push_back(strArg.size());
+	}
+	char* pCommand = nullptr;
+	long long nLength = redisFormatCommandArgv(&pCommand, (int)vectArg.size(), vectArgv.data(), vectArgvLen.data());
+	if(nLength < 0)
+		LogError() << "format command failed:" << (vectArg.empty() ? std::string() : vectArg[0]);
+	return Queue(pCommand, nLength);
+}
+
+/*
+ * Take the formatted command, a negative length means the format failed.
+ */
+std::future<CRedisMultiplexer::ReplyPtr> CRedisMultiplexer::Queue (char* pCommand, long long nLength)
+{
+	Request request;
+	std::future<ReplyPtr> future = request.promise.get_future();
+	if(nLength < 0)
+	{
+		request.promise.set_value(ReplyPtr());
+		return future;
+	}
+	request.strCommand.assign(pCommand, nLength);
+	free(pCommand);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_bOpen)
+	{
+		request.promise.set_value(ReplyPtr());
+		return future;
+	}
+	m_deqQueued.push_back(std::move(request));
+	//the writer only waits on an empty queue.
+	if(m_deqQueued.size() == 1)
+		m_cvQueue.notify_one();
+	return future;
+}
+
+void CRedisMultiplexer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bOpen = false;
+		if(m_pServer != nullptr)
+			shutdown(m_pServer->fd, SHUT_RDWR);
+		m_cvQueue.notify_all();
+	}
+	//the writer joins the reader when it exits.
+	if(m_threadWriter.joinable())
+		m_threadWriter.join();
+	if(m_threadReader.joinable())
+		m_threadReader.join();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	FailSent();
+	FailQueued();
+	if(m_pServer != nullptr)
+	{
+		redisFree(m_pServer);
+		m_pServer = nullptr;
+	}
+}
+
+/*
+ * The promises are moved to m_deqSent before the batch is written, so the reader
+ * always finds the promise of a reply, the order of m_deqSent is the order on the wire.
+ */
+void CRedisMultiplexer::WriterThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::string strBatch;
+	while(m_bOpen)
+	{
+		if(m_deqQueued.empty())
+		{
+			m_cvQueue.wait(lock);
+			continue;
+		}
+		if(m_bBroken && RC_FAILED(Reconnect(lock)))
+		{
+			FailQueued();
+			continue;
+		}
+		strBatch.clear();
+		for(size_t i = 0; i < m_nMaxBatchSize && !m_deqQueued.empty(); i++)
+		{
+			strBatch += m_deqQueued.front().strCommand;
+			m_deqSent.push_back(std::move(m_deqQueued.front().promise));
+			m_deqQueued.pop_front();
+		}
+		redisContext* pServer = m_pServer;
+		lock.unlock();
+
+		bool bFailed = false;
+		for(size_t nWritten = 0; nWritten < strBatch.size();)
+		{
+			ssize_t nSize = send(pServer->fd, strBatch.data() + nWritten, strBatch.size() - nWritten, MSG_NOSIGNAL);
+			if(nSize < 0 && errno == EINTR)
+				continue;
+			if(nSize <= 0)
+			{
+				LogError() << "write to Redis server failed:" << strerror(errno);
+				bFailed = true;
+				break;
+			}
+			nWritten += nSize;
+		}
+
+		lock.lock();
+		if(bFailed)
+			Break(pServer);
+	}
+	lock.unlock();
+	if(m_threadReader.joinable())
+		m_threadReader.join();
+}
+
+void CRedisMultiplexer::ReaderThread(redisContext* pServer)
+{
+	redisReader* pReader = redisReaderCreate();
+	char buffer[16*1024];
+	bool bBroken = pReader == nullptr;
+	while(!bBroken)
+	{
+		ssize_t nSize = recv(pServer->fd, buffer, sizeof(buffer), 0);
+		if(nSize < 0 && errno == EINTR)
+			continue;
+		if(nSize <= 0 || redisReaderFeed(pReader, buffer, nSize) != REDIS_OK)
+			break;
+
+		void* reply = nullptr;
+		int nResult = REDIS_OK;
+		while((nResult = redisReaderGetReply(pReader, &reply)) == REDIS_OK && reply != nullptr)
+		{
+			std::promise<ReplyPtr> promise;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if(m_bBroken || m_pServer != pServer || m_deqSent.empty())
+				{
+					freeReplyObject(reply);
+					bBroken = true;
+					break;
+				}
+				promise = std::move(m_deqSent.front());
+				m_deqSent.pop_front();
+			}
+			promise.set_value(ReplyPtr((redisReply*)reply));
+			reply = nullptr;
+		}
+		if(nResult != REDIS_OK)
+		{
+			LogError() << "parse the reply of Redis server failed:" << pReader->errstr;
+			bBroken = true;
+		}
+	}
+	if(pReader != nullptr)
+		redisReaderFree(pReader);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Break(pServer);
+}
+
+/*
+ * Called by the writer with m_mutex locked, the lock is released while connecting.
+ */
+ResultCode CRedisMultiplexer::Reconnect(std::unique_lock<std::mutex>& lock)
+{
+	redisContext* pOld = m_pServer;
+	m_pServer = nullptr;
+	std::string strServerAddr = m_strServerAddress;
+	int nPort = m_nServerPort, nTimeOutInMS = m_nConnectTimeOutInMS;
+	lock.unlock();
+
+	if(m_threadReader.joinable())
+		m_threadReader.join();
+	if(pOld != nullptr)
+		redisFree(pOld);
+	redisContext* pServer = ConnectServer(strServerAddr, nPort, nTimeOutInMS);
+
+	lock.lock();
+	if(pServer == nullptr)
+		return RE_COMMUNICATION;
+	if(!m_bOpen)
+	{
+		redisFree(pServer);
+		return RE_NOT_INITIALIZE;
+	}
+	m_pServer = pServer;
+	m_bBroken = false;
+	m_threadReader = std::thread(&CRedisMultiplexer::ReaderThread, this, pServer);
+	return RS_SUCCESS;
+}
+
+/*
+ * Called with m_mutex locked, the requests sent on the broken connection are failed,
+ * the shut down socket wakes up the other thread.
+ */
+void CRedisMultiplexer::Break(redisContext* pServer)
+{
+	if(pServer != m_pServer || m_bBroken)
+		return;
+	m_bBroken = true;
+	shutdown(pServer->fd, SHUT_RDWR);
+	FailSent();
+	m_cvQueue.notify_all();
+}
+
+void CRedisMultiplexer::FailSent()
+{
+	for(auto& promise: m_deqSent)
+		promise.set_value(ReplyPtr());
+	m_deqSent.clear();
+}
+
+void CRedisMultiplexer::FailQueued()
+{
+	for(auto& request: m_deqQueued)
+		request.promise.set_value(ReplyPtr());
+	m_deqQueued.clear();
+}
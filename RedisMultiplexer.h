@@ -0,0 +1,121 @@
+#ifndef CREDISMULTIPLEXER_H
+#define CREDISMULTIPLEXER_H
+#include "ResultCode.h"
+#include <hiredis/hiredis.h>
+#include <stdarg.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * class CRedisMultiplexer
+ * One connection to Redis shared by all the threads of the process.
+ *
+ * Command() formats the request and queues it, a writer thread sends the queued requests
+ * in coalesced batches, so the requests of unrelated callers are pipelined automatically.
+ * A reader thread parses the replies and fulfils the futures in FIFO order, which is
+ * the order Redis answers the requests of a connection.
+ *
+ * When the connection breaks, the requests already sent are failed with a null reply,
+ * the queued ones are sent on the next connection, which is opened by the writer thread.
+ */
+class CRedisMultiplexer
+{
+public:
+	struct ReplyDeleter
+	{
+		void operator()(redisReply* reply) const
+		{
+			freeReplyObject(reply);
+		}
+	};
+	//null means the request failed on the connection.
+	typedef std::unique_ptr<redisReply, ReplyDeleter> ReplyPtr;
+
+	// Constructors/Destructors
+	//
+
+
+	/**
+	 * @param  nMaxBatchSize max requests written in one batch.
+	 */
+	explicit CRedisMultiplexer (size_t nMaxBatchSize = 1024);
+
+	/**
+	 * Empty Destructor
+	 */
+	virtual ~CRedisMultiplexer ();
+
+
+	/**
+	 * Connect and start the writer and reader threads, an opened multiplexer is closed first.
+	 * @return ResultCode
+	 * @param  strServerAddr
+	 * @param  nPort
+	 * @param  nTimeOutInMS connect time out, also used by the reconnects.
+	 */
+	ResultCode Open (const std::string& strServerAddr, int nPort, int nTimeOutInMS);
+
+
+	/**
+	 * Stop the threads, the outstanding requests are failed.
+	 */
+	void Close ();
+
+
+	bool IsOpen ();
+
+
+	/**
+	 * Queue a request, return immediately.
+	 * @return the future of the reply, a closed multiplexer returns a ready null reply.
+	 * @param  format the format of redisCommand.
+	 */
+	std::future<ReplyPtr> Command (const char* format, ...);
+	std::future<ReplyPtr> vCommand (const char* format, va_list ap);
+	std::future<ReplyPtr> CommandArgv (const std::vector<std::string>& vectArg);
+
+
+protected:
+	struct Request
+	{
+		std::string strCommand;
+		std::promise<ReplyPtr> promise;
+	};
+
+	std::future<ReplyPtr> Queue (char* pCommand, long long nLength);
+	void Stop();
+	void WriterThread();
+	void ReaderThread(redisContext* pServer);
+	ResultCode Reconnect(std::unique_lock<std::mutex>& lock);
+	void Break(redisContext* pServer);
+	void FailSent();
+	void FailQueued();
+
+	std::string m_strServerAddress;
+	int m_nServerPort = 6379;
+	int m_nConnectTimeOutInMS = 1000;
+	size_t m_nMaxBatchSize;
+
+	//guarded by m_mutex
+	redisContext* m_pServer = nullptr;
+	bool m_bBroken = false;
+	bool m_bOpen = false;
+	std::deque<Request> m_deqQueued;	//not written yet
+	std::deque<std::promise<ReplyPtr>> m_deqSent;	//written, waiting for the replies
+	std::thread m_threadWriter;
+	std::thread m_threadReader;
+	std::mutex m_mutex;
+	std::condition_variable m_cvQueue;
+
+	std::mutex m_mutexOpen;
+
+
+};
+
+#endif // CREDISMULTIPLEXER_H
@@ -5,6 +5,8 @@
  *      Author: zlin
  */
 #include "CacheCluster.h"
+#include "BasicCacheCluster.h"
+#include "MemoryCacheBackend.h"
 #include "test.Base.h"
 #include <thread>
 #include "StockDataConfig.h"
@@ -424,3 +426,816 @@ TEST_F(CacheClusterTester, TryLock_Unlock)
 
 }
 
+
+TEST_F(CacheClusterTester, EnableDiskCache)
+{
+	std::string strOwner = "DiskCache", strItem = "Item1", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	system("rm -rf /tmp/CacheClusterTester.disk");
+	rc = m_cc.EnableDiskCache("/tmp/CacheClusterTester.disk", 16);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:Set and Get with disk cache, the value returned");
+	strValue = "value";
+	rc = SetItemValue(strOwner, strItem, strValue);
+	ASSERT_GE(rc, 0);
+	strValue.clear();
+	rc = m_cc.GetItemValue(strOwner, strItem, strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value");
+
+	Case("Case2:value set by another client is fetched and kept on disk");
+	CCacheCluster cc;
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	strValue = "value2";
+	rc = cc.SetItemValue(strOwner, "Item2", strValue, 1);
+	m_vectKey.push_back(std::make_pair(strOwner, "Item2"));
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value2");
+
+	Case("Case3:the disk copy expires with the server copy");
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	rc = m_cc.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case4:Remove, the disk copy is removed too");
+	rc = m_cc.RemoveItemValue(strOwner, strItem);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, strItem, strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case5:a value without TTL is kept on disk at most the max life cycle");
+	m_cc.SetHostTierMaxLifeCycle(1);
+	rc = cc.SetItemValue(strOwner, "Item3", "value3");
+	m_vectKey.push_back(std::make_pair(strOwner, "Item3"));
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item3", strValue);
+	ASSERT_GE(rc, 0);
+	rc = cc.SetItemValue(strOwner, "Item3", "value4");
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	rc = m_cc.GetItemValue(strOwner, "Item3", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value4");
+	m_cc.SetHostTierMaxLifeCycle(600);
+	m_cc.DisableDiskCache();
+}
+
+TEST_F(CacheClusterTester, EnableSharedMemoryCache)
+{
+	std::string strOwner = "ShmCache", strItem = "Item1", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	CCacheShmStore::Unlink("CacheClusterTester.shm");
+	rc = m_cc.EnableSharedMemoryCache("CacheClusterTester.shm", 16, 1024);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:Set and Get with shared memory cache, the value returned");
+	strValue = "value";
+	rc = SetItemValue(strOwner, strItem, strValue);
+	ASSERT_GE(rc, 0);
+	strValue.clear();
+	rc = m_cc.GetItemValue(strOwner, strItem, strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value");
+
+	Case("Case2:value fetched by one client is served to another client of the host");
+	CCacheCluster cc;
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	strValue = "value2";
+	rc = cc.SetItemValue(strOwner, "Item2", strValue, 1);
+	m_vectKey.push_back(std::make_pair(strOwner, "Item2"));
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value2");
+	CCacheCluster ccShared;
+	rc = ccShared.EnableSharedMemoryCache("CacheClusterTester.shm", 16, 1024);
+	ASSERT_GE(rc, 0);
+	rc = ccShared.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value2");
+
+	Case("Case3:the shared copy expires with the server copy");
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	rc = m_cc.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case4:Remove, the shared copy is removed too");
+	rc = m_cc.RemoveItemValue(strOwner, strItem);
+	ASSERT_GE(rc, 0);
+	rc = ccShared.GetItemValue(strOwner, strItem, strValue);
+	ASSERT_NE(rc, Stock::RS_SUCCESS);
+	m_cc.DisableSharedMemoryCache();
+	CCacheShmStore::Unlink("CacheClusterTester.shm");
+}
+
+TEST_F(CacheClusterTester, Prefetch_WarmUp)
+{
+	std::string strOwner = "Prefetch", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	std::vector<CCacheCluster::ItemKey> vectKey;
+	for(int i = 0; i < 20; i++)
+	{
+		std::string strItem = "Item" + std::to_string(i);
+		strValue = "value" + std::to_string(i);
+		rc = SetItemValue(strOwner, strItem, strValue);
+		ASSERT_GE(rc, 0);
+		vectKey.push_back(std::make_pair(strOwner, strItem));
+	}
+	vectKey.push_back(std::make_pair(strOwner, "NotExists"));
+	m_cc.SetPrefetchOption(8, 2, 10*1000);
+
+	Case("Case1:WarmUp, all values are avail");
+	rc = m_cc.WarmUp(vectKey, 1000);
+	ASSERT_GE(rc, 0);
+	for(int i = 0; i < 20; i++)
+	{
+		rc = m_cc.GetItemValue(strOwner, "Item" + std::to_string(i), strValue);
+		ASSERT_GE(rc, 0);
+		ASSERT_STREQ(strValue.c_str(), ("value" + std::to_string(i)).c_str());
+	}
+	rc = m_cc.GetItemValue(strOwner, "NotExists", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Set after prefetch, the new value returned");
+	strValue = "new value";
+	rc = SetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "new value");
+
+	Case("Case3:Prefetch returns immediately, GetItemValue waits for the in-flight item");
+	m_cc.ResetLocalCache();
+	rc = m_cc.Prefetch(vectKey);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item19", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value19");
+}
+
+TEST_F(CacheClusterTester, GetHotKeys)
+{
+	std::string strOwner = "HotKey", strValue = "value";
+	ResultCode rc = Stock::RS_SUCCESS;
+	std::vector<std::pair<std::string, size_t>> vectHotKey;
+	rc = SetItemValue(strOwner, "Hot", strValue);
+	ASSERT_GE(rc, 0);
+	rc = SetItemValue(strOwner, "Cold", strValue);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:no access, no hot key");
+	m_cc.GetHotKeys(vectHotKey);
+	ASSERT_TRUE(vectHotKey.empty());
+
+	Case("Case2:the frequently accessed key is hot, the other is not");
+	m_cc.SetHotKeyOption(16, 0.1, 500);
+	for(int i = 0; i < 2000; i++)
+	{
+		rc = m_cc.GetItemValue(strOwner, "Hot", strValue);
+		ASSERT_GE(rc, 0);
+		if(i % 100 == 0)
+			m_cc.GetItemValue(strOwner, "Cold", strValue);
+	}
+	m_cc.GetHotKeys(vectHotKey);
+	ASSERT_EQ(vectHotKey.size(), 1);
+	ASSERT_STREQ(vectHotKey[0].first.c_str(), "Hot_HotKey");
+
+	Case("Case3:the hot key is pinned locally, but a local Set still takes effect");
+	strValue = "new value";
+	rc = SetItemValue(strOwner, "Hot", strValue);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Hot", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "new value");
+
+	Case("Case4:the pinned copy expires with the server copy");
+	m_cc.SetHotKeyOption(16, 0.1, 5000);
+	rc = SetItemValue(strOwner, "Hot", strValue, 1);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Hot", strValue);
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	rc = m_cc.GetItemValue(strOwner, "Hot", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+}
+
+TEST_F(CacheClusterTester, AbsentLookup)
+{
+	std::string strOwner = "Absent", strValue;
+	bool bExists = true;
+	ResultCode rc = Stock::RS_SUCCESS;
+	CCacheCluster cc;
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	m_cc.SetAbsentLifeCycle(300);
+
+	Case("Case1:absent key, then created by another client, visible after the absent life cycle");
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	strValue = "value";
+	rc = cc.SetItemValue(strOwner, "Item1", strValue);
+	m_vectKey.push_back(std::make_pair(strOwner, "Item1"));
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+
+	Case("Case2:absent key, then set locally, visible immediately");
+	rc = m_cc.Exists(strOwner, "Item2", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_FALSE(bExists);
+	rc = SetItemValue(strOwner, "Item2", strValue);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.Exists(strOwner, "Item2", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+
+	Case("Case3:owner filter answers absent locally, the locally set key is present");
+	m_cc.SetAbsentLifeCycle(0);
+	rc = m_cc.EnableOwnerFilter(strOwner, 500);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	rc = cc.SetItemValue(strOwner, "Item3", strValue);
+	m_vectKey.push_back(std::make_pair(strOwner, "Item3"));
+	ASSERT_GE(rc, 0);
+	rc = m_cc.Exists(strOwner, "Item3", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_FALSE(bExists);
+	rc = SetItemValue(strOwner, "Item4", strValue);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.Exists(strOwner, "Item4", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+
+	Case("Case4:after the next sync, the key created by another client is visible");
+	std::this_thread::sleep_for(std::chrono::milliseconds(800));
+	rc = m_cc.Exists(strOwner, "Item3", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+	m_cc.DisableOwnerFilter(strOwner);
+}
+
+TEST_F(CacheClusterTester, DeadlineScope)
+{
+	ResultCode rc = Stock::RS_SUCCESS;
+	rc = m_cc.TryLock("Deadline", "Item1", 10, 0);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:lock wait is bounded by the scope, not by its own time out");
+	auto tpStart = std::chrono::steady_clock::now();
+	{
+		CCacheCluster::CDeadlineScope scope(500);
+		rc = m_cc.TryLock("Deadline", "Item1", 10, 5000);
+	}
+	auto nElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_LT(nElapsed, 1000);
+
+	Case("Case2:a nested scope does not extend the outer deadline");
+	tpStart = std::chrono::steady_clock::now();
+	{
+		CCacheCluster::CDeadlineScope scope(300);
+		CCacheCluster::CDeadlineScope scopeInner(5000);
+		rc = m_cc.WaitForItemValue("Deadline", "Item2", 5000);
+	}
+	nElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_LT(nElapsed, 800);
+
+	Case("Case3:calls with enough budget succeed");
+	m_cc.SetDefaultTimeOut(1000);
+	rc = m_cc.Unlock("Deadline", "Item1");
+	ASSERT_GE(rc, 0);
+	m_cc.SetDefaultTimeOut(-1);
+}
+
+TEST_F(CacheClusterTester, EnableThreadConnection)
+{
+	std::string strOwner = "ThreadConnection";
+	CCacheCluster cc;
+	cc.EnableThreadConnection(true);
+	ResultCode rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:the threads set and get on their own connections");
+	std::vector<std::thread> vectThread;
+	std::vector<ResultCode> vectResult(4, Stock::RS_SUCCESS);
+	for(size_t i = 0; i < vectResult.size(); i++)
+	{
+		m_vectKey.push_back(std::make_pair(strOwner, "Item" + std::to_string(i)));
+		vectThread.push_back(std::thread([&cc, &vectResult, strOwner, i]()
+		{
+			std::string strItem = "Item" + std::to_string(i), strValue;
+			for(int j = 0; j < 100 && RC_SUCCEEDED(vectResult[i]); j++)
+			{
+				vectResult[i] = cc.SetItemValue(strOwner, strItem, std::to_string(j));
+				if(RC_SUCCEEDED(vectResult[i]))
+					vectResult[i] = cc.GetItemValue(strOwner, strItem, strValue);
+				if(RC_SUCCEEDED(vectResult[i]) && strValue != std::to_string(j))
+					vectResult[i] = Stock::RE_INVALIDATE_DATA;
+			}
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	for(auto rcThread: vectResult)
+		ASSERT_GE(rcThread, 0);
+
+	Case("Case2:reconnect, a new thread and the calling thread still work");
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	std::string strValue;
+	std::thread thread([&cc, &rc, &strValue, strOwner]()
+	{
+		rc = cc.GetItemValue(strOwner, "Item0", strValue);
+	});
+	thread.join();
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "99");
+	rc = cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "99");
+}
+
+TEST_F(CacheClusterTester, EnableMultiplexedConnection)
+{
+	std::string strOwner = "Multiplexed", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+
+	Case("Case1:the replies of the pipelined requests are matched in order");
+	CRedisMultiplexer multiplexer;
+	rc = multiplexer.Open(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	std::vector<std::future<CRedisMultiplexer::ReplyPtr>> vectFuture;
+	for(int i = 0; i < 100; i++)
+		vectFuture.push_back(multiplexer.Command("ECHO %d", i));
+	for(int i = 0; i < 100; i++)
+	{
+		CRedisMultiplexer::ReplyPtr reply = vectFuture[i].get();
+		ASSERT_TRUE(reply != nullptr);
+		ASSERT_EQ(reply->type, REDIS_REPLY_STRING);
+		ASSERT_EQ(std::string(reply->str, reply->len), std::to_string(i));
+	}
+	multiplexer.Close();
+	ASSERT_TRUE(multiplexer.Command("PING").get() == nullptr);
+
+	Case("Case2:the threads share the multiplexed connection");
+	CCacheCluster cc;
+	rc = cc.EnableMultiplexedConnection(true);
+	ASSERT_GE(rc, 0);
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	std::vector<std::thread> vectThread;
+	std::vector<ResultCode> vectResult(8, Stock::RS_SUCCESS);
+	for(size_t i = 0; i < vectResult.size(); i++)
+	{
+		m_vectKey.push_back(std::make_pair(strOwner, "Item" + std::to_string(i)));
+		vectThread.push_back(std::thread([&cc, &vectResult, strOwner, i]()
+		{
+			std::string strItem = "Item" + std::to_string(i), strValue;
+			for(int j = 0; j < 100 && RC_SUCCEEDED(vectResult[i]); j++)
+			{
+				vectResult[i] = cc.SetItemValue(strOwner, strItem, std::to_string(j));
+				if(RC_SUCCEEDED(vectResult[i]))
+					vectResult[i] = cc.GetItemValue(strOwner, strItem, strValue);
+				if(RC_SUCCEEDED(vectResult[i]) && strValue != std::to_string(j))
+					vectResult[i] = Stock::RE_INVALIDATE_DATA;
+			}
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	for(auto rcThread: vectResult)
+		ASSERT_GE(rcThread, 0);
+
+	Case("Case3:the lock and the time out work on the multiplexed connection");
+	rc = cc.TryLock(strOwner, "Lock", 10, 0);
+	ASSERT_GE(rc, 0);
+	rc = cc.TryLock(strOwner, "Lock", 10, 300);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	rc = cc.Unlock(strOwner, "Lock");
+	ASSERT_GE(rc, 0);
+}
+
+TEST_F(CacheClusterTester, IncrementCounter_GetCounter)
+{
+	std::string strOwner = "Counter";
+	long long nValue = 0;
+	ResultCode rc = Stock::RS_SUCCESS;
+	m_vectKey.push_back(std::make_pair(strOwner, "Item1"));
+	m_vectKey.push_back(std::make_pair(strOwner, "Item2"));
+
+	Case("Case1:get a non exists counter, 0 returned");
+	rc = m_cc.GetCounter(strOwner, "Item1", nValue);
+	ASSERT_EQ(rc, Stock::RS_NOT_EXISTS);
+	ASSERT_EQ(nValue, 0);
+
+	Case("Case2:increase the counter and a field of the hash");
+	rc = m_cc.IncrementCounter(strOwner, "Item1", 5, nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 5);
+	rc = m_cc.IncrementCounter(strOwner, "Item1", -2, nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 3);
+	rc = m_cc.IncrementCounter(strOwner, "Item2", "Field1", 7, nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 7);
+	rc = m_cc.GetCounter(strOwner, "Item2", "Field1", nValue);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(nValue, 7);
+
+	Case("Case3:not an integer value, failed");
+	std::string strValue = "value";
+	rc = SetItemValue(strOwner, "Item3", strValue);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.IncrementCounter(strOwner, "Item3", 1, nValue);
+	ASSERT_EQ(rc, Stock::RE_INVALIDATE_DATA);
+
+	Case("Case4:aggregated increments from the threads are merged and flushed");
+	m_cc.EnableCounterAggregation(100);
+	std::vector<std::thread> vectThread;
+	for(int i = 0; i < 4; i++)
+	{
+		vectThread.push_back(std::thread([this, strOwner]()
+		{
+			for(int j = 0; j < 1000; j++)
+			{
+				m_cc.AddCounter(strOwner, "Item1", 1);
+				m_cc.AddCounter(strOwner, "Item2", 1, "Field1");
+			}
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	rc = m_cc.FlushCounters();
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetCounter(strOwner, "Item1", nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 4003);
+	rc = m_cc.GetCounter(strOwner, "Item2", "Field1", nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 4007);
+
+	Case("Case5:disable the aggregation, the pending deltas are flushed");
+	m_cc.AddCounter(strOwner, "Item1", 10);
+	m_cc.EnableCounterAggregation(0);
+	rc = m_cc.GetCounter(strOwner, "Item1", nValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nValue, 4013);
+}
+
+TEST_F(CacheClusterTester, TryAcquireTokens)
+{
+	std::string strOwner = "RateLimit";
+	long long nAcquired = 0, nWaitInMS = 0;
+	ResultCode rc = Stock::RS_SUCCESS;
+
+	Case("Case1:a new bucket is full, the batch takes the burst at most");
+	rc = m_cc.TryAcquireTokens(strOwner, "Item1", 10, 5, 1, 100, nAcquired, nWaitInMS);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(nAcquired, 5);
+
+	Case("Case2:the bucket is empty, the exact wait time is returned");
+	rc = m_cc.TryAcquireTokens(strOwner, "Item1", 10, 5, 2, 2, nAcquired, nWaitInMS);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+	ASSERT_GT(nWaitInMS, 100);
+	ASSERT_LE(nWaitInMS, 200);
+
+	Case("Case3:wait for the refill, acquired");
+	auto tpStart = std::chrono::steady_clock::now();
+	rc = m_cc.AcquireTokens(strOwner, "Item1", 10, 5, 2, 2, nAcquired, 1000);
+	auto nElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(nAcquired, 2);
+	ASSERT_GE(nElapsed, 100);
+
+	Case("Case4:the wait is longer than the time out, failed immediately");
+	rc = m_cc.AcquireTokens(strOwner, "Item1", 1, 5, 5, 5, nAcquired, 100);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+
+	Case("Case5:the local bucket spends a batch with one round trip");
+	boost::shared_ptr<CCacheCluster> pCacheCluster(new CCacheCluster());
+	rc = pCacheCluster->ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	CLocalTokenBucket bucket(pCacheCluster, strOwner, "Item2", 10, 20, 8);
+	rc = bucket.Acquire();
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(bucket.GetLocalTokenCount(), 7);
+	for(int i = 0; i < 7; i++)
+	{
+		rc = bucket.Acquire(0);
+		ASSERT_GE(rc, 0);
+	}
+	ASSERT_EQ(bucket.GetLocalTokenCount(), 0);
+	rc = m_cc.TryAcquireTokens(strOwner, "Item2", 10, 20, 12, 12, nAcquired, nWaitInMS);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	rc = m_cc.TryAcquireTokens(strOwner, "Item2", 10, 20, 1, 1, nAcquired, nWaitInMS);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+
+	Case("Case6:a zero time out tries once");
+	rc = m_cc.AcquireTokens(strOwner, "Item3", 1, 5, 5, 5, nAcquired, 0);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(nAcquired, 5);
+	tpStart = std::chrono::steady_clock::now();
+	rc = m_cc.AcquireTokens(strOwner, "Item3", 1, 5, 1, 1, nAcquired, 0);
+	nElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_LT(nElapsed, 500);
+}
+
+TEST_F(CacheClusterTester, CompareAndSetItemValue)
+{
+	std::string strOwner = "CompareAndSet", strValue;
+	long long nVersion = -1;
+	ResultCode rc = Stock::RS_SUCCESS;
+	m_vectKey.push_back(std::make_pair(strOwner, "Item1"));
+	m_vectKey.push_back(std::make_pair(strOwner + "_Version", "Item1"));
+
+	Case("Case1:a new value has version 0");
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue, nVersion);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	ASSERT_EQ(nVersion, 0);
+
+	Case("Case2:set with the expected version, the version increased");
+	rc = m_cc.CompareAndSetItemValue(strOwner, "Item1", nVersion, "value1");
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(nVersion, 1);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue, nVersion);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+	ASSERT_EQ(nVersion, 1);
+
+	Case("Case3:set with a stale version, conflicted, the current version returned");
+	nVersion = 0;
+	rc = m_cc.CompareAndSetItemValue(strOwner, "Item1", nVersion, "value2");
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+	ASSERT_EQ(nVersion, 1);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+
+	Case("Case4:concurrent updaters, no update is lost");
+	std::vector<std::thread> vectThread;
+	std::vector<ResultCode> vectResult(4, Stock::RS_SUCCESS);
+	for(size_t i = 0; i < vectResult.size(); i++)
+	{
+		vectThread.push_back(std::thread([&vectResult, strOwner, i]()
+		{
+			CCacheCluster cc;
+			vectResult[i] = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+			for(int j = 0; j < 50 && RC_SUCCEEDED(vectResult[i]); j++)
+			{
+				vectResult[i] = cc.UpdateItemValue(strOwner, "Item1", [](std::string& strValue, bool bExists)
+				{
+					strValue += "+";
+					return Stock::RS_SUCCESS;
+				}, size_t(-1), 1000);
+			}
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	for(auto rcThread: vectResult)
+		ASSERT_GE(rcThread, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue, nVersion);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(strValue, "value1" + std::string(200, '+'));
+	ASSERT_EQ(nVersion, 201);
+
+	Case("Case5:the update function fails, nothing changed");
+	rc = m_cc.UpdateItemValue(strOwner, "Item1", [](std::string& strValue, bool bExists)
+	{
+		return Stock::RE_INVALIDATE_DATA;
+	});
+	ASSERT_EQ(rc, Stock::RE_INVALIDATE_DATA);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue, nVersion);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nVersion, 201);
+}
+
+TEST_F(CacheClusterTester, WaitForAll_WaitForAny)
+{
+	std::string strOwner = "WaitForKeys", strValue = "value";
+	std::vector<CCacheCluster::ItemKey> vectKey;
+	std::vector<bool> vectReady;
+	ResultCode rc = Stock::RS_SUCCESS;
+	for(int i = 0; i < 200; i++)
+		vectKey.push_back(std::make_pair(strOwner, "Item" + std::to_string(i)));
+
+	Case("Case1:none exists, time out with no ready item");
+	rc = m_cc.WaitForAny(vectKey, 100, vectReady);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_EQ(vectReady.size(), vectKey.size());
+	ASSERT_EQ(std::count(vectReady.begin(), vectReady.end(), true), 0);
+
+	Case("Case2:one created later, WaitForAny reports it");
+	std::thread thread([this, strOwner, strValue]() mutable
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		SetItemValue(strOwner, "Item7", strValue);
+	});
+	rc = m_cc.WaitForAny(vectKey, 2000, vectReady);
+	thread.join();
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_TRUE(vectReady[7]);
+	ASSERT_EQ(std::count(vectReady.begin(), vectReady.end(), true), 1);
+
+	Case("Case3:WaitForAll times out with the partial result");
+	rc = m_cc.WaitForAll(vectKey, 100, vectReady);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_TRUE(vectReady[7]);
+	ASSERT_EQ(std::count(vectReady.begin(), vectReady.end(), true), 1);
+
+	Case("Case4:the rest created by the producers, WaitForAll succeeded within one deadline");
+	thread = std::thread([this, &vectKey, strValue]() mutable
+	{
+		for(auto& key: vectKey)
+			SetItemValue(key.first, key.second, strValue);
+	});
+	auto tpStart = std::chrono::steady_clock::now();
+	rc = m_cc.WaitForAll(vectKey, 5000, vectReady);
+	auto nElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpStart).count();
+	thread.join();
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	ASSERT_EQ(std::count(vectReady.begin(), vectReady.end(), true), (long)vectKey.size());
+	ASSERT_LT(nElapsed, 2000);
+}
+
+TEST_F(CacheClusterTester, TryLock_Unlock_MultiKey)
+{
+	std::string strOwner = "MultiLock";
+	std::vector<CCacheCluster::ItemKey> vectKey1 = {{strOwner, "Item3"}, {strOwner, "Item1"}, {strOwner, "Item2"}};
+	std::vector<CCacheCluster::ItemKey> vectKey2 = {{strOwner, "Item4"}, {strOwner, "Item2"}};
+	CCacheCluster::ItemKey blockingKey;
+	ResultCode rc = Stock::RS_SUCCESS;
+
+	Case("Case1:lock all, succeeded");
+	rc = m_cc.TryLock(vectKey1, 10, 0);
+	ASSERT_GE(rc, 0);
+
+	Case("Case2:an overlapped set is blocked, none of it is locked");
+	rc = m_cc.TryLock(vectKey2, 10, 100, &blockingKey);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_STREQ(blockingKey.second.c_str(), "Item2");
+	rc = m_cc.TryLock(strOwner, "Item4", 10, 0);
+	ASSERT_GE(rc, 0);
+	rc = m_cc.Unlock(strOwner, "Item4");
+	ASSERT_GE(rc, 0);
+
+	Case("Case3:the single lock is excluded by the multi-key lock");
+	rc = m_cc.TryLock(strOwner, "Item1", 10, 0);
+	ASSERT_LT(rc, 0);
+
+	Case("Case4:release all in one round trip, the overlapped set is locked then");
+	rc = m_cc.Unlock(vectKey1);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	{
+		boost::shared_ptr<CCacheCluster> pCacheCluster(new CCacheCluster());
+		rc = pCacheCluster->ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+		ASSERT_GE(rc, 0);
+		CMultiLockGuard guard(pCacheCluster, vectKey2, 10, 0);
+		ASSERT_GE(guard.Result(), 0);
+	}
+	rc = m_cc.Unlock(vectKey2);
+	ASSERT_EQ(rc, Stock::RS_NOT_EXISTS);
+}
+
+TEST_F(CacheClusterTester, BasicCacheCluster)
+{
+	std::string strOwner = "BasicCacheCluster", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	CDefaultCacheCluster cc;
+	rc = cc.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:the default instantiation reads and writes the values of CCacheCluster");
+	strValue = "value1";
+	rc = SetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	rc = cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+	rc = cc.SetItemValue(strOwner, "Item1", "value1.1");
+	ASSERT_GE(rc, 0);
+	rc = m_cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1.1");
+
+	Case("Case2:the raw instantiation, set, get, exists and remove");
+	CRawCacheCluster ccRaw;
+	rc = ccRaw.ConnectCacheServer(s_strServerAddr, s_nPort, 1000);
+	ASSERT_GE(rc, 0);
+	m_vectKey.push_back(std::make_pair(strOwner, "Item2"));
+	rc = ccRaw.SetItemValue(strOwner, "Item2", "value2", 10);
+	ASSERT_GE(rc, 0);
+	rc = ccRaw.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value2");
+	bool bExists = false;
+	rc = ccRaw.Exists(strOwner, "Item2", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+	rc = ccRaw.RemoveItemValue(strOwner, "Item2");
+	ASSERT_GE(rc, 0);
+	rc = ccRaw.GetItemValue(strOwner, "Item2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	rc = ccRaw.RemoveItemValue(strOwner, "Item2");
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+}
+
+TEST_F(CacheClusterTester, SetBackend)
+{
+	std::string strOwner = "Backend", strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	CCacheCluster cc;
+	boost::shared_ptr<CMemoryCacheBackend> pBackend(new CMemoryCacheBackend());
+	cc.SetBackend(pBackend);
+
+	Case("Case1:Set, Get and Remove without a server");
+	rc = cc.SetItemValue(strOwner, "Item1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+	bool bExists = false;
+	rc = cc.Exists(strOwner, "Item1", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+	rc = cc.RemoveItemValue(strOwner, "Item1");
+	ASSERT_GE(rc, 0);
+	rc = cc.GetItemValue(strOwner, "Item1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	rc = cc.RemoveItemValue(strOwner, "Item1");
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:the lock semantics are the same as the server");
+	rc = cc.TryLock(strOwner, "Item2", 1, 0);
+	ASSERT_GE(rc, 0);
+	rc = cc.TryLock(strOwner, "Item2", 1, 0);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	rc = cc.TryLock(strOwner, "Item2", 1, 1500);
+	ASSERT_GE(rc, 0);
+	rc = cc.Unlock(strOwner, "Item2");
+	ASSERT_GE(rc, 0);
+	rc = cc.Unlock(strOwner, "Item2");
+	ASSERT_EQ(rc, Stock::RS_NOT_EXISTS);
+	rc = cc.TryGetProduceRight(strOwner, "Item3", 1);
+	ASSERT_GE(rc, 0);
+	rc = cc.TryGetProduceRight(strOwner, "Item3", 1);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+
+	Case("Case3:two clients on the same backend share the values");
+	CCacheCluster cc2;
+	cc2.SetBackend(pBackend);
+	rc = cc.SetItemValue(strOwner, "Item4", "value4");
+	ASSERT_GE(rc, 0);
+	rc = cc2.GetItemValue(strOwner, "Item4", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value4");
+
+	Case("Case4:Prefetch, WaitForAll and the multi-key locks use the backend");
+	std::vector<CCacheCluster::ItemKey> vectKey = {{strOwner, "Item4"}, {strOwner, "Item5"}};
+	rc = cc.WarmUp(vectKey, 1000);
+	ASSERT_GE(rc, 0);
+	rc = cc.GetItemValue(strOwner, "Item4", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value4");
+	rc = cc.GetItemValue(strOwner, "Item5", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	std::vector<bool> vectReady;
+	rc = cc.WaitForAll(vectKey, 100, vectReady);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_TRUE(vectReady[0]);
+	ASSERT_FALSE(vectReady[1]);
+	rc = cc.TryLock(vectKey, 10, 0);
+	ASSERT_GE(rc, 0);
+	CCacheCluster::ItemKey blockingKey;
+	std::vector<CCacheCluster::ItemKey> vectKey2 = {{strOwner, "Item6"}, {strOwner, "Item5"}};
+	rc = cc2.TryLock(vectKey2, 10, 0, &blockingKey);
+	ASSERT_EQ(rc, Stock::RE_TIME_OUT);
+	ASSERT_STREQ(blockingKey.second.c_str(), "Item5");
+	rc = cc2.TryLock(strOwner, "Item6", 10, 0);
+	ASSERT_GE(rc, 0);	//the failed multi-key lock left nothing locked
+	rc = cc.Unlock(vectKey);
+	ASSERT_EQ(rc, Stock::RS_SUCCESS);
+	rc = cc.Unlock(vectKey);
+	ASSERT_EQ(rc, Stock::RS_NOT_EXISTS);
+
+	Case("Case5:the server side features are not supported");
+	long long nValue = 0;
+	rc = cc.IncrementCounter(strOwner, "Counter", 1, nValue);
+	ASSERT_EQ(rc, Stock::RS_NOT_SUPPORT);
+	long long nVersion = 0;
+	rc = cc.CompareAndSetItemValue(strOwner, "Item7", nVersion, "value7");
+	ASSERT_EQ(rc, Stock::RS_NOT_SUPPORT);
+	rc = cc.EnableOwnerFilter(strOwner);
+	ASSERT_EQ(rc, Stock::RS_NOT_SUPPORT);
+}
@@ -0,0 +1,171 @@
+/*
+ * test.CacheDiskStore.cpp
+ * This file is for functional test only.
+ */
+#include "CacheDiskStore.h"
+#include "test.Base.h"
+#include <thread>
+#include <stdlib.h>
+
+static const std::string s_strDiskCachePath = "/tmp/CacheDiskStoreTester";
+
+class CacheDiskStoreTester:public Stock::CClusterTestBase
+{
+public:
+	CacheDiskStoreTester():CClusterTestBase("CacheDiskStoreTester"){}
+protected:
+	virtual void SetUp()
+	{
+		system(("rm -rf " + s_strDiskCachePath).c_str());
+		ResultCode rc = m_store.Open(s_strDiskCachePath, 4, 1);
+		ASSERT_GE(rc, 0) << "could not open the disk cache:" << s_strDiskCachePath;
+	}
+
+	virtual void TearDown()
+	{
+		m_store.Close();
+		system(("rm -rf " + s_strDiskCachePath).c_str());
+	}
+	CCacheDiskStore m_store;
+
+
+};
+
+TEST_F(CacheDiskStoreTester, Put_Get)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Get non exists key, failed");
+	rc = m_store.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Put and Get, the value returned");
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+
+	Case("Case3:Put again, the latest value returned");
+	rc = m_store.Put("key1", "value2");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value2");
+	ASSERT_EQ(m_store.GetKeyCount(), 1);
+
+	Case("Case4:the value has nil character");
+	std::string strBinary("a\0b\0c", 5);
+	rc = m_store.Put("key2", strBinary);
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(strValue == strBinary);
+
+	Case("Case5:get a timeout value, return not exists");
+	rc = m_store.Put("key3", "value3", 1);
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key3", strValue);
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	rc = m_store.Get("key3", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+}
+
+TEST_F(CacheDiskStoreTester, Remove)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Remove non exists key, failed");
+	rc = m_store.Remove("key1");
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Remove exists key, the value is not avail");
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Remove("key1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+}
+
+TEST_F(CacheDiskStoreTester, Reopen)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Put("key2", "value2");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Put("key1", "value1.1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Remove("key2");
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:after reopen, the latest values are restored, the removed one is not");
+	m_store.Close();
+	rc = m_store.Open(s_strDiskCachePath, 4, 1);
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1.1");
+	rc = m_store.Get("key2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+}
+
+TEST_F(CacheDiskStoreTester, Open_Locked)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+
+	Case("Case1:the directory is opened by another store, busy");
+	CCacheDiskStore store;
+	rc = store.Open(s_strDiskCachePath, 4, 1);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+	ASSERT_FALSE(store.IsOpen());
+
+	Case("Case2:closed by the owner, opened with its values");
+	m_store.Close();
+	rc = store.Open(s_strDiskCachePath, 4, 1);
+	ASSERT_GE(rc, 0);
+	rc = store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+	store.Close();
+}
+
+TEST_F(CacheDiskStoreTester, Compact)
+{
+	std::string strValue(100*1024, 'x');
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:overwrite the same keys many times, the disk size stays in budget");
+	for(int i = 0; i < 200; i++)
+	{
+		rc = m_store.Put(std::to_string(i%5), strValue);
+		ASSERT_GE(rc, 0);
+		while(m_store.Compact() == Stock::RS_SUCCESS);
+	}
+	ASSERT_LE(m_store.GetDiskSize(), 4*1024*1024);
+	ASSERT_EQ(m_store.GetKeyCount(), 5);
+	for(int i = 0; i < 5; i++)
+	{
+		rc = m_store.Get(std::to_string(i), strValue);
+		ASSERT_GE(rc, 0);
+		ASSERT_EQ(strValue.size(), 100*1024);
+	}
+
+	Case("Case2:write more than the budget, the oldest keys are evicted");
+	for(int i = 0; i < 100; i++)
+	{
+		rc = m_store.Put("evict" + std::to_string(i), strValue);
+		ASSERT_GE(rc, 0);
+		while(m_store.Compact() == Stock::RS_SUCCESS);
+	}
+	ASSERT_LE(m_store.GetDiskSize(), 4*1024*1024);
+	rc = m_store.Get("evict0", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	rc = m_store.Get("evict99", strValue);
+	ASSERT_GE(rc, 0);
+}
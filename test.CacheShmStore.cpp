@@ -0,0 +1,179 @@
+/*
+ * test.CacheShmStore.cpp
+ * This file is for functional test only.
+ */
+#include "CacheShmStore.h"
+#include "test.Base.h"
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const std::string s_strShmName = "CacheShmStoreTester";
+
+class CacheShmStoreTester:public Stock::CClusterTestBase
+{
+public:
+	CacheShmStoreTester():CClusterTestBase("CacheShmStoreTester"){}
+protected:
+	virtual void SetUp()
+	{
+		CCacheShmStore::Unlink(s_strShmName);
+		ResultCode rc = m_store.Open(s_strShmName, 4, 1024);
+		ASSERT_GE(rc, 0) << "could not open the shared memory cache:" << s_strShmName;
+	}
+
+	virtual void TearDown()
+	{
+		m_store.Close();
+		CCacheShmStore::Unlink(s_strShmName);
+	}
+	CCacheShmStore m_store;
+
+
+};
+
+TEST_F(CacheShmStoreTester, Put_Get)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Get non exists key, failed");
+	rc = m_store.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Put and Get, the value returned");
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+
+	Case("Case3:Put again, the latest value returned");
+	rc = m_store.Put("key1", std::string(1000, 'x'));
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(strValue == std::string(1000, 'x'));
+
+	Case("Case4:the value has nil character");
+	std::string strBinary("a\0b\0c", 5);
+	rc = m_store.Put("key2", strBinary);
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key2", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(strValue == strBinary);
+
+	Case("Case5:get a timeout value, return not exists");
+	rc = m_store.Put("key3", "value3", 1);
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key3", strValue);
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	rc = m_store.Get("key3", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case6:a value larger than the largest size class, failed");
+	rc = m_store.Put("key4", std::string(3*1024*1024, 'x'));
+	ASSERT_EQ(rc, Stock::RE_OUT_OF_RESOURCE);
+}
+
+TEST_F(CacheShmStoreTester, Remove)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Remove non exists key, failed");
+	rc = m_store.Remove("key1");
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Remove exists key, the value is not avail");
+	rc = m_store.Put("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Remove("key1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case3:Put after remove, the slot is reused");
+	rc = m_store.Put("key1", "value1.1");
+	ASSERT_GE(rc, 0);
+	rc = m_store.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1.1");
+}
+
+TEST_F(CacheShmStoreTester, Evict)
+{
+	std::string strValue(100*1024, 'x');
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:overwrite the same keys many times, the freed blocks are reused");
+	for(int i = 0; i < 200; i++)
+	{
+		rc = m_store.Put(std::to_string(i%5), strValue);
+		ASSERT_GE(rc, 0);
+	}
+	for(int i = 0; i < 5; i++)
+	{
+		rc = m_store.Get(std::to_string(i), strValue);
+		ASSERT_GE(rc, 0);
+		ASSERT_EQ(strValue.size(), 100*1024);
+	}
+
+	Case("Case2:write more than the arena, the puts still succeed by eviction");
+	for(int i = 0; i < 100; i++)
+	{
+		rc = m_store.Put("evict" + std::to_string(i), strValue);
+		ASSERT_GE(rc, 0);
+	}
+	rc = m_store.Get("evict99", strValue);
+	ASSERT_GE(rc, 0);
+	int nCount = 0;
+	for(int i = 0; i < 100; i++)
+		if(m_store.Get("evict" + std::to_string(i), strValue) == Stock::RS_SUCCESS)
+			nCount++;
+	ASSERT_LT(nCount, 100);
+}
+
+TEST_F(CacheShmStoreTester, MultiProcess)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:a value put by the child process is read by the parent");
+	pid_t pid = fork();
+	ASSERT_GE(pid, 0);
+	if(pid == 0)
+	{
+		CCacheShmStore store;
+		if(RC_FAILED(store.Open(s_strShmName, 4, 1024)) || RC_FAILED(store.Put("child", "value1")))
+			_exit(1);
+		_exit(0);
+	}
+	int nStatus = 0;
+	waitpid(pid, &nStatus, 0);
+	ASSERT_TRUE(WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0);
+	rc = m_store.Get("child", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1");
+
+	Case("Case2:concurrent writers and readers of the same keys, the values are never torn");
+	std::vector<std::thread> vectThread;
+	std::atomic<bool> bTorn(false);
+	for(int t = 0; t < 4; t++)
+	{
+		vectThread.push_back(std::thread([&, t]()
+		{
+			std::string strRead;
+			for(int i = 0; i < 2000; i++)
+			{
+				std::string strKey = "key" + std::to_string(i%8);
+				if(t%2 == 0)
+					m_store.Put(strKey, std::string(64 + i%512, 'a' + i%26));
+				else if(m_store.Get(strKey, strRead) == Stock::RS_SUCCESS
+						&& strRead.find_first_not_of(strRead[0]) != std::string::npos)
+					bTorn = true;
+			}
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	ASSERT_FALSE(bTorn);
+}
@@ -9,9 +9,13 @@
 #include "JobCluster.h"
 #include <thread>
 #include <chrono>
+#include <set>
+#include <atomic>
+#include <algorithm>
 #include "Log.h"
 #include "test.Base.h"
 #include "StockDataConfig.h"
+#include "Stock.h"
 
 static std::string ZOO_KEEPER_SERVER;
 static int ZOO_KEEPER_PORT;
@@ -117,6 +121,99 @@ TEST_F(JobClusterTester, CreateJob_GetJobConfig)
 
 
 
+TEST_F(JobClusterTester, CreateJob_TerminateJob_Repeated)
+{
+	CJobCluster jc1;
+	ResultCode rc = RS_SUCCESS;
+	std::string strTaskName;
+	rc = jc1.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	//case 1. the job terminated by another client and created again, the directories are created again.
+	for(int i = 0; i < 3; i++)
+	{
+		rc = jc1.CreateJob("JobClusterTest_Job1", "jobdata");
+		ASSERT_GE(rc, 0);
+		rc = jc1.AddTask("JobClusterTest_Job1", "task data", strTaskName);
+		ASSERT_GE(rc, 0);
+		rc = m_jc.TerminateJob("JobClusterTest_Job1");
+		ASSERT_GE(rc, 0);
+		rc = jc1.AddTask("JobClusterTest_Job1", "task data", strTaskName);
+		ASSERT_LT(rc, 0);
+	}
+
+	//case 2. create an existing job, already exists.
+	rc = jc1.CreateJob("JobClusterTest_Job1", "jobdata");
+	ASSERT_GE(rc, 0);
+	rc = m_jc.CreateJob("JobClusterTest_Job1", "jobdata");
+	ASSERT_EQ(rc, RS_ALREADY_EXISTS);
+}
+
+
+class CJobClusterProbe: public CJobCluster
+{
+public:
+	ResultCode CreateDirChain(const std::string& strDirPath, size_t& nRoundTrips)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t nStart = m_nDirCreateRoundTrips;
+		ResultCode rc = ZooCreateDirChain(strDirPath);
+		nRoundTrips = m_nDirCreateRoundTrips - nStart;
+		return rc;
+	}
+	std::string GetCounterPath(const std::string& strJobName, const std::string& strWorkerName) const
+	{
+		return GetJobCounterPath(strJobName, strWorkerName);
+	}
+};
+
+TEST_F(JobClusterTester, ZooCreateDirChain_Existing)
+{
+	CJobClusterProbe jc;
+	ResultCode rc = jc.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	std::string strPath = jc.GetCounterPath("JobClusterTest_Job1", "DirChain");
+	size_t nRoundTrips = 0;
+
+	//case 1. a deep path, created.
+	rc = jc.CreateDirChain(strPath, nRoundTrips);
+	ASSERT_GE(rc, 0);
+	ASSERT_GE(nRoundTrips, 1u);
+
+	//case 2. the existing path again, a single create.
+	rc = jc.CreateDirChain(strPath, nRoundTrips);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nRoundTrips, 1u);
+}
+
+TEST_F(JobClusterTester, GetJobConfig_DataSize)
+{
+	ResultCode rc = RS_SUCCESS;
+	std::string strJobConfigData;
+	//case 1. data larger than the first buffer, read in full.
+	std::string strLargeData(300 * 1024, 'x');
+	strLargeData[strLargeData.size() - 1] = 'y';
+	rc = m_jc.CreateJob("JobClusterTest_Job1", strLargeData);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.GetJobConfig("JobClusterTest_Job1", strJobConfigData);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(strJobConfigData == strLargeData);
+
+	//case 2. small data read into the same string, only the data returned.
+	rc = m_jc.CreateJob("JobClusterTester_Job2", "small config");
+	ASSERT_GE(rc, 0);
+	for(int i = 0; i < 3; i++)
+	{
+		rc = m_jc.GetJobConfig("JobClusterTester_Job2", strJobConfigData);
+		ASSERT_GE(rc, 0);
+		ASSERT_STREQ(strJobConfigData.c_str(), "small config");
+	}
+
+	//case 3. the job not exists, failed.
+	rc = m_jc.GetJobConfig("JobClusterTester_Job3", strJobConfigData);
+	ASSERT_EQ(rc, RE_NOT_EXISTS);
+}
+
+
 TEST_F(JobClusterTester, AddTask)
 {
 	ResultCode rc = RS_SUCCESS;
@@ -167,6 +264,108 @@ TEST_F(JobClusterTester, AddTask)
 }
 
 
+TEST_F(JobClusterTester, AddTasks_AddTasksAsync)
+{
+	ResultCode rc = RS_SUCCESS;
+	std::string strJobName = "JobClusterTest_Job1";
+	std::vector<std::string> vectTaskData, vectTaskName;
+	for(int i = 0; i < 1000; i++)
+		vectTaskData.push_back("task data " + std::to_string(i));
+	//case 1. add tasks before create job, failed, no task created.
+	rc = m_jc.AddTasks(strJobName, vectTaskData, vectTaskName, 100);
+	ASSERT_LT(rc, 0);
+	ASSERT_TRUE(vectTaskName.empty());
+	rc = m_jc.AddTasksAsync(strJobName, vectTaskData, vectTaskName, 100);
+	ASSERT_LT(rc, 0);
+	ASSERT_TRUE(vectTaskName.empty());
+
+	//case 2. add tasks in batches, all created in order.
+	rc = m_jc.CreateJob(strJobName, "jobdata");
+	ASSERT_GE(rc,0);
+	rc = m_jc.AddTasks(strJobName, vectTaskData, vectTaskName, 100);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTaskName.size(), vectTaskData.size());
+	for(size_t i = 1; i < vectTaskName.size(); i++)
+		ASSERT_LT(vectTaskName[i - 1], vectTaskName[i]);
+
+	//case 3. add tasks with batches in flight, all created in order after the previous ones.
+	std::string strLastName = vectTaskName.back();
+	rc = m_jc.AddTasksAsync(strJobName, vectTaskData, vectTaskName, 64, 4);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTaskName.size(), vectTaskData.size());
+	ASSERT_LT(strLastName, vectTaskName.front());
+	for(size_t i = 1; i < vectTaskName.size(); i++)
+		ASSERT_LT(vectTaskName[i - 1], vectTaskName[i]);
+
+	//case 4. the task data is kept.
+	rc = m_jc.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	m_jc.SetTaskSelection(CJobCluster::SELECT_FIRST);
+	std::string strTaskName, strValue;
+	rc = m_jc.TakeTask(strJobName, strTaskName, strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), vectTaskData[0].c_str());
+
+	//case 5. no task, succeeded.
+	rc = m_jc.AddTasks(strJobName, std::vector<std::string>(), vectTaskName);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(vectTaskName.empty());
+}
+
+
+TEST_F(JobClusterTester, AddTaskAsync_FinishTaskAsync)
+{
+	ResultCode rc = RS_SUCCESS;
+	std::string strJobName = "JobClusterTest_Job1";
+	//case 1. not registered, the futures get the error at once.
+	ASSERT_EQ(m_jc.FinishTaskAsync(strJobName, "task").get(), RE_NOT_INITIALIZE);
+	ASSERT_EQ(m_jc.ReleaseTaskAsync(strJobName, "task").get(), RE_NOT_INITIALIZE);
+
+	//case 2. add tasks with the requests in flight together, all created.
+	rc = m_jc.CreateJob(strJobName, "jobdata");
+	ASSERT_GE(rc,0);
+	std::vector<std::future<CJobCluster::AsyncResult>> vectFuture;
+	for(int i = 0; i < 100; i++)
+		vectFuture.push_back(m_jc.AddTaskAsync(strJobName, "task data " + std::to_string(i)));
+	std::set<std::string> setAdded;
+	for(auto& future: vectFuture)
+	{
+		CJobCluster::AsyncResult result = future.get();
+		ASSERT_GE(result.rc, 0);
+		ASSERT_TRUE(setAdded.insert(result.strValue).second);
+	}
+	CJobCluster::AsyncResult result = m_jc.GetJobConfigAsync(strJobName).get();
+	ASSERT_GE(result.rc, 0);
+	ASSERT_STREQ(result.strValue.c_str(), "jobdata");
+	ASSERT_EQ(m_jc.GetJobConfigAsync("JobClusterTest_Job3").get().rc, Stock::RE_NOT_EXISTS);
+	ASSERT_LT(m_jc.AddTaskAsync("JobClusterTest_Job3", "task data").get().rc, 0);
+
+	//case 3. finish and release the tasks with the requests in flight together.
+	rc = m_jc.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	std::vector<CJobCluster::TakenTask> vectTask;
+	rc = m_jc.TakeTasks(strJobName, 100, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 100);
+	std::vector<std::future<ResultCode>> vectFinish;
+	for(size_t i = 0; i < vectTask.size(); i++)
+	{
+		if(i < 50)
+			vectFinish.push_back(m_jc.FinishTaskAsync(strJobName, vectTask[i].strTaskName));
+		else
+			vectFinish.push_back(m_jc.ReleaseTaskAsync(strJobName, vectTask[i].strTaskName));
+	}
+	for(auto& future: vectFinish)
+		ASSERT_GE(future.get(), 0);
+	rc = m_jc.TakeTasks(strJobName, 100, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 50);
+
+	//case 4. finish a task not exists, failed.
+	ASSERT_LT(m_jc.FinishTaskAsync(strJobName, "testtask").get(), 0);
+}
+
+
 TEST_F(JobClusterTester, RegisterWorker_UnregisterWorker_GetWorkerCount)
 {
 	CJobCluster jc1,jc2,jc3;
@@ -503,6 +702,56 @@ TEST_F(JobClusterTester, TakeTask_FinishTask)
 	ASSERT_LT(rc, 0);
 }
 
+TEST_F(JobClusterTester, TakeTask_WaitingIndex)
+{
+	CJobCluster jc1,jc2;
+	std::string strJobName, strTaskName, strTaskContent;
+	ResultCode rc = RS_SUCCESS;
+	rc = jc1.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc1.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc2.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.CreateJob("JobClusterTest_Job1", "This is the first job");
+	ASSERT_GE(rc, 0);
+
+	//case 1.take right after the tasks are added by another client, all tasks taken once.
+	std::set<std::string> setAdded, setTaken;
+	for(int i = 0; i < 20; i++)
+	{
+		rc = jc2.AddTask("JobClusterTest_Job1", "task " + std::to_string(i), strTaskName);
+		ASSERT_GE(rc, 0);
+		setAdded.insert(strTaskName);
+	}
+	for(int i = 0; i < 20; i++)
+	{
+		strJobName.clear();
+		rc = (i % 2 ? jc1 : jc2).TakeTask(strJobName, strTaskName, strTaskContent);
+		ASSERT_GE(rc, 0);
+		ASSERT_STREQ(strJobName.c_str(), "JobClusterTest_Job1");
+		ASSERT_TRUE(setTaken.insert(strTaskName).second) << strTaskName << " taken twice";
+	}
+	ASSERT_TRUE(setAdded == setTaken);
+
+	//case 2.all tasks taken, take failed.
+	strJobName.clear();
+	rc = jc1.TakeTask(strJobName, strTaskName, strTaskContent);
+	ASSERT_EQ(rc, RE_NOT_EXISTS);
+
+	//case 3.a released task is waiting again and could be taken.
+	rc = jc1.ReleaseTask("JobClusterTest_Job1", *setTaken.begin());
+	ASSERT_GE(rc, 0);
+	strJobName = "JobClusterTest_Job1";
+	rc = jc2.TakeTask(strJobName, strTaskName, strTaskContent);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strTaskName.c_str(), setTaken.begin()->c_str());
+	rc = jc2.TerminateJob("JobClusterTest_Job1");
+	ASSERT_GE(rc, 0);
+}
+
 unsigned long GetTickCount()
 {
     struct timespec ts;
@@ -537,6 +786,148 @@ void create_task(void* pPara)
 }
 
 
+TEST_F(JobClusterTester, SetTaskSelection_GetClaimStatistics)
+{
+	CJobCluster jc1,jc2;
+	std::string strTaskName;
+	ResultCode rc = RS_SUCCESS;
+	rc = jc1.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc1.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc2.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc1.CreateJob("JobClusterTest_Job1", "This is the first job");
+	ASSERT_GE(rc, 0);
+
+	//case 1.no task taken, statistics are empty.
+	CJobCluster::ClaimStatistics statistics = jc1.GetClaimStatistics();
+	ASSERT_EQ(statistics.nClaimed, 0);
+	ASSERT_EQ(statistics.nConflicted, 0);
+
+	//case 2.take concurrently with every selection, each task taken once and counted.
+	CJobCluster::EnumTaskSelection vectSelection[] = {CJobCluster::SELECT_FIRST, CJobCluster::SELECT_RANDOM,
+			CJobCluster::SELECT_WORKER_HASH, CJobCluster::SELECT_TWO_CHOICES};
+	for(auto eSelection: vectSelection)
+	{
+		jc1.ResetClaimStatistics();
+		jc2.ResetClaimStatistics();
+		jc1.SetTaskSelection(eSelection, 4);
+		jc2.SetTaskSelection(eSelection, 4);
+		for(int i = 0; i < 16; i++)
+		{
+			rc = jc1.AddTask("JobClusterTest_Job1", "task data", strTaskName);
+			ASSERT_GE(rc, 0);
+		}
+		std::set<std::string> setTaken1, setTaken2;
+		auto take = [](CJobCluster* pJc, std::set<std::string>* pTaken)
+		{
+			std::string strJobName, strTaskName, strTaskData;
+			while(RC_SUCCEEDED(pJc->TakeTask(strJobName, strTaskName, strTaskData)))
+			{
+				pTaken->insert(strTaskName);
+				strJobName.clear();
+			}
+		};
+		std::thread thread1(take, &jc1, &setTaken1), thread2(take, &jc2, &setTaken2);
+		thread1.join();
+		thread2.join();
+		std::set<std::string> setTaken(setTaken1);
+		for(auto& strTask: setTaken2)
+			ASSERT_TRUE(setTaken.insert(strTask).second) << strTask << " taken twice";
+		ASSERT_EQ(setTaken.size(), 16);
+		ASSERT_EQ(jc1.GetClaimStatistics().nClaimed + jc2.GetClaimStatistics().nClaimed, 16);
+		ASSERT_EQ(jc1.GetClaimStatistics().nFailed + jc2.GetClaimStatistics().nFailed, 0);
+		for(auto& strTask: setTaken1)
+			jc1.FinishTask("JobClusterTest_Job1", strTask);
+		for(auto& strTask: setTaken2)
+			jc2.FinishTask("JobClusterTest_Job1", strTask);
+	}
+	rc = jc1.TerminateJob("JobClusterTest_Job1");
+	ASSERT_GE(rc, 0);
+}
+
+TEST_F(JobClusterTester, TakeTasks_SetPrefetchCount)
+{
+	CJobCluster jc1,jc2;
+	std::vector<std::string> vectTaskData, vectTaskName;
+	std::vector<CJobCluster::TakenTask> vectTask;
+	ResultCode rc = RS_SUCCESS;
+	rc = jc1.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc1.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.ConnectToCluster({{ZOO_KEEPER_SERVER,ZOO_KEEPER_PORT}}, 3000);
+	ASSERT_GE(rc, 0);
+	rc = jc2.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc1.CreateJob("JobClusterTest_Job1", "This is the first job");
+	ASSERT_GE(rc, 0);
+	for(int i = 0; i < 10; i++)
+		vectTaskData.push_back("task data " + std::to_string(i));
+	rc = jc1.AddTasks("JobClusterTest_Job1", vectTaskData, vectTaskName);
+	ASSERT_GE(rc, 0);
+
+	//case 1.take 4 tasks at once, all taken with the data.
+	rc = jc1.TakeTasks("JobClusterTest_Job1", 4, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 4);
+	std::set<std::string> setTaken;
+	for(auto& task: vectTask)
+	{
+		ASSERT_STREQ(task.strJobName.c_str(), "JobClusterTest_Job1");
+		ASSERT_TRUE(setTaken.insert(task.strTaskName).second);
+		auto it = std::find(vectTaskName.begin(), vectTaskName.end(), task.strTaskName);
+		ASSERT_TRUE(it != vectTaskName.end());
+		ASSERT_STREQ(task.strTaskData.c_str(), vectTaskData[it - vectTaskName.begin()].c_str());
+	}
+
+	//case 2.take more than waiting, the rest taken.
+	rc = jc2.TakeTasks("JobClusterTest_Job1", 100, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 6);
+	for(auto& task: vectTask)
+		ASSERT_TRUE(setTaken.insert(task.strTaskName).second);
+	rc = jc2.TakeTasks("JobClusterTest_Job1", 1, vectTask);
+	ASSERT_EQ(rc, RE_NOT_EXISTS);
+
+	//case 3.all tasks of the worker are released when unregistered.
+	rc = jc2.UnregisterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = jc2.TakeTasks("JobClusterTest_Job1", 100, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 6);
+
+	//case 4.prefetch, tasks are claimed ahead and taken from the buffer.
+	rc = jc1.AddTasks("JobClusterTest_Job1", vectTaskData, vectTaskName);
+	ASSERT_GE(rc, 0);
+	jc1.SetPrefetchCount(3, "JobClusterTest_Job1");
+	for(int i = 0; i < 50 && jc1.GetPrefetchedTaskCount() < 3; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	ASSERT_EQ(jc1.GetPrefetchedTaskCount(), 3);
+	std::string strJobName, strTaskName, strTaskData;
+	rc = jc1.TakeTask(strJobName, strTaskName, strTaskData);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strJobName.c_str(), "JobClusterTest_Job1");
+	rc = jc1.FinishTask(strJobName, strTaskName);
+	ASSERT_GE(rc, 0);
+
+	//case 5.the taken and the prefetched tasks of jc1 are released on disconnect.
+	for(int i = 0; i < 50 && jc1.GetPrefetchedTaskCount() < 3; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	rc = jc1.DisconnectFromCluster();
+	ASSERT_GE(rc, 0);
+	rc = jc2.TakeTasks("JobClusterTest_Job1", 100, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 13);	//20 added, 1 finished and 6 held by jc2
+	rc = jc2.TerminateJob("JobClusterTest_Job1");
+	ASSERT_GE(rc, 0);
+}
+
 TEST_F(JobClusterTester, WaitForNewTask_TakeTask)
 {
 	CJobCluster jc1,jc2;
@@ -810,6 +1201,191 @@ TEST_F(JobClusterTester, TerminateJob)
 }
 
 
+TEST_F(JobClusterTester, TerminateJob_BulkDelete)
+{
+	ResultCode rc = RS_SUCCESS;
+	std::vector<std::string> vectTaskData(2000, "task data"), vectTaskName;
+	rc = m_jc.CreateJob("JobClusterTester_Job3", "config");
+	ASSERT_GE(rc, 0);
+	rc = m_jc.AddTasks("JobClusterTester_Job3", vectTaskData, vectTaskName);
+	ASSERT_GE(rc, 0);
+
+	//case 1.terminate a large job in small batches, the progress is reported and all nodes deleted.
+	m_jc.SetBulkDeleteOption(64, 8);
+	std::vector<CJobCluster::DeleteProgress> vectProgress;
+	std::atomic<bool> bTerminated(false);
+	std::atomic<int> nOtherCalls(0);
+	std::thread threadOther([&]()
+	{
+		//the other calls are not blocked while the tree is removed.
+		std::string strData;
+		while(!bTerminated)
+		{
+			m_jc.GetJobConfig("JobClusterTester_Job2", strData);
+			nOtherCalls++;
+		}
+	});
+	rc = m_jc.TerminateJob("JobClusterTester_Job3", [&](const CJobCluster::DeleteProgress& progress)
+	{
+		vectProgress.push_back(progress);
+	});
+	bTerminated = true;
+	threadOther.join();
+	ASSERT_GE(rc, 0);
+	ASSERT_GT(vectProgress.size(), 1);
+	ASSERT_GT(nOtherCalls, 0);
+	for(size_t i = 1; i < vectProgress.size(); i++)
+		ASSERT_GE(vectProgress[i].nDeleted, vectProgress[i - 1].nDeleted);
+	ASSERT_GE(vectProgress.back().nDeleted, 2000);
+	ASSERT_EQ(vectProgress.back().nDeleted, vectProgress.back().nListed);
+	ASSERT_EQ(vectProgress.back().nFailed, 0);
+
+	//case 2.the job is gone.
+	std::string strTaskName;
+	rc = m_jc.AddTask("JobClusterTester_Job3", "task data", strTaskName);
+	ASSERT_LT(rc, 0);
+	std::string strData;
+	rc = m_jc.GetJobConfig("JobClusterTester_Job3", strData);
+	ASSERT_LT(rc, 0);
+}
+
+
+TEST_F(JobClusterTester, SetPayloadOffload)
+{
+	if(Stock::CStock::Instance().GetCacheCluster() == nullptr)
+		return;
+	ResultCode rc = RS_SUCCESS;
+	std::string strJob, strTask, strTaskData, strTaskName;
+	rc = m_jc.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+	rc = m_jc.CreateJob("JobClusterTester_Job3", "config");
+	ASSERT_GE(rc, 0);
+	m_jc.SetPayloadOffload(1024);
+
+	//case 1.a task larger than the threshold is offloaded, the data is resolved when taken.
+	std::string strLargeData(1024 * 1024 * 2, 'x');
+	rc = m_jc.AddTask("JobClusterTester_Job3", strLargeData, strTaskName);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(strTask, strTaskName);
+	ASSERT_TRUE(strTaskData == strLargeData);
+
+	//case 2.a released task keeps its payload for the next worker.
+	rc = m_jc.ReleaseTask(strJob, strTask);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(strTaskData == strLargeData);
+	rc = m_jc.FinishTask(strJob, strTask);
+	ASSERT_GE(rc, 0);
+
+	//case 3.the small tasks and the batches mixing both sizes are taken with their own data.
+	std::vector<std::string> vectTaskData{"small data", strLargeData, "small data 2"}, vectTaskName;
+	rc = m_jc.AddTasks("JobClusterTester_Job3", vectTaskData, vectTaskName);
+	ASSERT_GE(rc, 0);
+	std::vector<CJobCluster::TakenTask> vectTask;
+	rc = m_jc.TakeTasks("JobClusterTester_Job3", 3, vectTask);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectTask.size(), 3);
+	for(auto& task: vectTask)
+	{
+		size_t nIndex = std::find(vectTaskName.begin(), vectTaskName.end(), task.strTaskName) - vectTaskName.begin();
+		ASSERT_LT(nIndex, vectTaskData.size());
+		ASSERT_TRUE(task.strTaskData == vectTaskData[nIndex]);
+		rc = m_jc.FinishTask(task.strJobName, task.strTaskName);
+		ASSERT_GE(rc, 0);
+	}
+
+	//case 4.small data looking like a reference is offloaded too, it is taken as it was added.
+	std::string strFakeData = "\x1bTaskPayload:not a payload";
+	rc = m_jc.AddTask("JobClusterTester_Job3", strFakeData, strTaskName);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strTaskData.c_str(), strFakeData.c_str());
+	rc = m_jc.ReleaseTask(strJob, strTask);
+	ASSERT_GE(rc, 0);
+
+	//case 5.the job with payloads not finished is terminated.
+	rc = m_jc.AddTask("JobClusterTester_Job3", strLargeData, strTaskName);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.TerminateJob("JobClusterTester_Job3");
+	ASSERT_GE(rc, 0);
+	rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+	ASSERT_LT(rc, 0);
+}
+
+
+TEST_F(JobClusterTester, AddTask_Priority_SetJobWeight)
+{
+	ResultCode rc = RS_SUCCESS;
+	std::string strJob, strTask, strTaskData, strTaskName;
+	rc = m_jc.RegisiterWorker();
+	ASSERT_GE(rc, 0);
+
+	//case 1.the tasks of a higher class are taken first, whenever they were added.
+	rc = m_jc.CreateJob("JobClusterTest_Job1", "config");
+	ASSERT_GE(rc, 0);
+	rc = m_jc.AddTask("JobClusterTest_Job1", "low", strTaskName, CJobCluster::TASK_PRIORITY_LOW);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(CJobCluster::GetTaskPriority(strTaskName), CJobCluster::TASK_PRIORITY_LOW);
+	rc = m_jc.AddTask("JobClusterTest_Job1", "normal", strTaskName);
+	ASSERT_GE(rc, 0);
+	std::vector<std::string> vectTaskData{"high1", "high2"}, vectTaskName;
+	rc = m_jc.AddTasks("JobClusterTest_Job1", vectTaskData, vectTaskName, 256, CJobCluster::TASK_PRIORITY_HIGH);
+	ASSERT_GE(rc, 0);
+	m_jc.SetTaskSelection(CJobCluster::SELECT_FIRST);
+	for(auto strExpected: {"high1", "high2", "normal", "low"})
+	{
+		strJob = "JobClusterTest_Job1";
+		rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+		ASSERT_GE(rc, 0);
+		ASSERT_STREQ(strTaskData.c_str(), strExpected);
+		rc = m_jc.FinishTask(strJob, strTask);
+		ASSERT_GE(rc, 0);
+	}
+	m_jc.SetTaskSelection(CJobCluster::SELECT_RANDOM);
+
+	//case 2.the jobs always waiting are served in proportion to their weights.
+	rc = m_jc.CreateJob("JobClusterTester_Job2", "config");
+	ASSERT_GE(rc, 0);
+	rc = m_jc.CreateJob("JobClusterTester_Job3", "config");
+	ASSERT_GE(rc, 0);
+	std::vector<std::string> vectManyData(40, "task data");
+	rc = m_jc.AddTasks("JobClusterTester_Job2", vectManyData, vectTaskName);
+	ASSERT_GE(rc, 0);
+	rc = m_jc.AddTasks("JobClusterTester_Job3", vectManyData, vectTaskName);
+	ASSERT_GE(rc, 0);
+	m_jc.SetJobWeight("JobClusterTester_Job2", 3);
+	m_jc.SetJobWeight("JobClusterTester_Job3", 1);
+	m_jc.ResetJobShares();
+	for(int i = 0; i < 40; i++)
+	{
+		strJob.clear();
+		rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+		ASSERT_GE(rc, 0);
+		rc = m_jc.FinishTask(strJob, strTask);
+		ASSERT_GE(rc, 0);
+	}
+	std::map<std::string, CJobCluster::JobShare> mapShare;
+	m_jc.GetJobShares(mapShare);
+	ASSERT_NEAR(mapShare["JobClusterTester_Job2"].nServed, 30, 1);
+	ASSERT_NEAR(mapShare["JobClusterTester_Job3"].nServed, 10, 1);
+	ASSERT_NEAR(mapShare["JobClusterTester_Job2"].dShare, mapShare["JobClusterTester_Job2"].dWeightShare, 0.05);
+
+	//case 3.a high task of another job is taken before the jobs of the normal class.
+	rc = m_jc.AddTask("JobClusterTester_Job3", "urgent", strTaskName, CJobCluster::TASK_PRIORITY_HIGH);
+	ASSERT_GE(rc, 0);
+	strJob.clear();
+	rc = m_jc.TakeTask(strJob, strTask, strTaskData);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strTaskData.c_str(), "urgent");
+	rc = m_jc.FinishTask(strJob, strTask);
+	ASSERT_GE(rc, 0);
+}
+
+
 TEST_F(JobClusterTester, AddTaskResult_)
 {
 	ResultCode rc = RS_SUCCESS;
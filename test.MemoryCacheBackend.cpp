@@ -0,0 +1,172 @@
+/*
+ * test.MemoryCacheBackend.cpp
+ * This file is for functional test only.
+ */
+#include "MemoryCacheBackend.h"
+#include "test.Base.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+
+class MemoryCacheBackendTester:public Stock::CClusterTestBase
+{
+public:
+	MemoryCacheBackendTester():CClusterTestBase("MemoryCacheBackendTester"){}
+protected:
+	CMemoryCacheBackend m_backend;
+
+
+};
+
+TEST_F(MemoryCacheBackendTester, Set_Get)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Get non exists key, failed");
+	rc = m_backend.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Set and Get, the latest value returned");
+	rc = m_backend.Set("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Set("key1", "value1.1");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Get("key1", strValue);
+	ASSERT_GE(rc, 0);
+	ASSERT_STREQ(strValue.c_str(), "value1.1");
+
+	Case("Case3:get a timeout value, return not exists and the key is released");
+	rc = m_backend.Set("key2", "value2", 1);
+	ASSERT_GE(rc, 0);
+	bool bExists = false;
+	rc = m_backend.Exists("key2", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_TRUE(bExists);
+	ASSERT_EQ(m_backend.GetKeyCount(), 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	ASSERT_EQ(m_backend.GetKeyCount(), 1);
+	rc = m_backend.Get("key2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case4:set without life cycle after a life cycle, the value doesn't expire");
+	rc = m_backend.Set("key3", "value3", 1);
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Set("key3", "value3");
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	rc = m_backend.Get("key3", strValue);
+	ASSERT_GE(rc, 0);
+}
+
+TEST_F(MemoryCacheBackendTester, Delete_Expire)
+{
+	std::string strValue;
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:Delete non exists key, failed");
+	rc = m_backend.Delete("key1");
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case2:Delete exists key, the value is not avail");
+	rc = m_backend.Set("key1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Delete("key1");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Get("key1", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case3:Expire non exists key, failed");
+	rc = m_backend.Expire("key1", 1);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+
+	Case("Case4:Expire exists key, the value expires");
+	rc = m_backend.Set("key2", "value2");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Expire("key2", 1);
+	ASSERT_GE(rc, 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	rc = m_backend.Get("key2", strValue);
+	ASSERT_EQ(rc, Stock::RE_NOT_EXISTS);
+	ASSERT_EQ(m_backend.GetKeyCount(), 0);
+}
+
+TEST_F(MemoryCacheBackendTester, SetNX)
+{
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:SetNX twice, the second is busy");
+	rc = m_backend.SetNX("lock1", "1", 1);
+	ASSERT_GE(rc, 0);
+	rc = m_backend.SetNX("lock1", "1", 1);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+
+	Case("Case2:SetNX after the life cycle, succeeded");
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	rc = m_backend.SetNX("lock1", "1", 1);
+	ASSERT_GE(rc, 0);
+
+	Case("Case3:concurrent SetNX of the same key, only one succeeds");
+	std::atomic<int> nSucceeded(0);
+	std::vector<std::thread> vectThread;
+	for(int i = 0; i < 8; i++)
+	{
+		vectThread.push_back(std::thread([&]()
+		{
+			if(m_backend.SetNX("lock2", "1") == Stock::RS_SUCCESS)
+				nSucceeded++;
+		}));
+	}
+	for(auto& thread: vectThread)
+		thread.join();
+	ASSERT_EQ(nSucceeded, 1);
+}
+
+TEST_F(MemoryCacheBackendTester, Multi)
+{
+	ResultCode rc = Stock::RS_SUCCESS;
+	Case("Case1:GetWithLifeCycle, -1 without life cycle");
+	rc = m_backend.Set("multi1", "value1");
+	ASSERT_GE(rc, 0);
+	rc = m_backend.Set("multi2", "value2", 10);
+	ASSERT_GE(rc, 0);
+	std::string strValue;
+	long long nLifeCycleInMS = 0;
+	rc = m_backend.GetWithLifeCycle("multi1", strValue, nLifeCycleInMS);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(strValue, "value1");
+	ASSERT_EQ(nLifeCycleInMS, -1);
+	rc = m_backend.GetWithLifeCycle("multi2", strValue, nLifeCycleInMS);
+	ASSERT_GE(rc, 0);
+	ASSERT_GT(nLifeCycleInMS, 0);
+	ASSERT_LE(nLifeCycleInMS, 10000);
+
+	Case("Case2:MultiGet, -2 for not exists key");
+	std::vector<std::string> vectKey = {"multi1", "multi3", "multi2"};
+	std::vector<std::string> vectValue;
+	std::vector<long long> vectLifeCycleInMS;
+	rc = m_backend.MultiGet(vectKey, vectValue, vectLifeCycleInMS);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectValue.size(), 3u);
+	ASSERT_EQ(vectValue[0], "value1");
+	ASSERT_EQ(vectLifeCycleInMS[1], -2);
+	ASSERT_EQ(vectValue[2], "value2");
+
+	Case("Case3:MultiSetNX on a taken key, busy and the other keys are not taken");
+	std::vector<std::string> vectLock = {"lock3", "multi2", "lock4"};
+	size_t nBlocking = 0;
+	rc = m_backend.MultiSetNX(vectLock, "1", 10, nBlocking);
+	ASSERT_EQ(rc, Stock::RE_BUSY);
+	ASSERT_EQ(nBlocking, 1u);
+	bool bExists = true;
+	rc = m_backend.Exists("lock3", bExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_FALSE(bExists);
+
+	Case("Case4:MultiDelete, count the deleted keys");
+	size_t nDeleted = 0;
+	rc = m_backend.MultiDelete(vectKey, nDeleted);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(nDeleted, 2u);
+	std::vector<bool> vectExists;
+	rc = m_backend.MultiExists(vectKey, vectExists);
+	ASSERT_GE(rc, 0);
+	ASSERT_EQ(vectExists, std::vector<bool>(3, false));
+}